@@ -9,7 +9,10 @@ struct datarec {
 	/* TODO 2: Add byte counter */
 };
 
-/* TODO 3: Define your map here */
+/* TODO 3: Define your map here
+ * (use BPF_F_MMAPABLE as map_flags if you want to read it from userspace
+ * with mmap() instead of bpf_map_lookup_elem())
+ */
 
 SEC("xdp")
 int xdp_prog_map(struct xdp_md *ctx) {
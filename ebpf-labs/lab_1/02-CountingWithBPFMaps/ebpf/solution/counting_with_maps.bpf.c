@@ -14,6 +14,8 @@ struct {
     __type(key, int);
     __type(value, struct datarec);
     __uint(max_entries, 1024);
+    /* Let userspace read the counters through mmap(), without syscalls */
+    __uint(map_flags, BPF_F_MMAPABLE);
 } xdp_stats_map SEC(".maps");
 
 SEC("xdp")
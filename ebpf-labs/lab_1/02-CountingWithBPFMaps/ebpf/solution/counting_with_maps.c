@@ -7,17 +7,17 @@
 #include <bpf/libbpf.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <linux/if_link.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "log.h"
+#include "event_loop.h"
 
 // Include skeleton file
 #include "counting_with_maps.skel.h"
@@ -30,6 +30,8 @@ struct datarec {
 
 static int ifindex_iface = 0;
 static __u32 xdp_flags = 0;
+static const char *export_file = NULL;
+static const char *iface = NULL;
 
 static const char *const usages[] = {
     "counting_with_maps [options] [[--] args]",
@@ -50,56 +52,89 @@ static void cleanup_ifaces() {
     }
 }
 
-void sigint_handler(int sig_no) {
-    log_debug("Closing program...");
-    cleanup_ifaces();
-    exit(0);
+/* Write the counters in the Prometheus text format. The file is replaced
+ * atomically, so that it can be scraped at any time (e.g., by the textfile
+ * collector of node_exporter).
+ */
+static void export_stats(const struct datarec *value) {
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", export_file);
+    f = fopen(tmp, "w");
+    if (!f) {
+        log_error("Error while opening %s: %s", tmp, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "# HELP xdp_rx_packets_total Packets received by the XDP program\n");
+    fprintf(f, "# TYPE xdp_rx_packets_total counter\n");
+    fprintf(f, "xdp_rx_packets_total{iface=\"%s\"} %llu\n", iface, value->rx_packets);
+    fprintf(f, "# HELP xdp_rx_bytes_total Bytes received by the XDP program\n");
+    fprintf(f, "# TYPE xdp_rx_bytes_total counter\n");
+    fprintf(f, "xdp_rx_bytes_total{iface=\"%s\"} %llu\n", iface, value->rx_bytes);
+    fclose(f);
+
+    if (rename(tmp, export_file))
+        log_error("Error while renaming %s: %s", tmp, strerror(errno));
 }
 
-void poll_stats(struct counting_with_maps_bpf *skel) {
-    /* TODO 1: get the map file descriptor for the skeleton */
+/* The map is BPF_F_MMAPABLE: its values are mapped in our address space and
+ * the counters are read directly, without any syscall
+ */
+static const volatile struct datarec *stats = MAP_FAILED;
+static size_t stats_size = 0;
+static struct datarec last_stats = {0};
+
+static int map_stats(struct counting_with_maps_bpf *skel) {
     int map_fd = 0;
-    
+
     map_fd = bpf_map__fd(skel->maps.xdp_stats_map);
     if (map_fd < 0) {
         log_fatal("Error while retrieving the map file descriptor");
-        exit(1);
+        return -1;
     }
 
-    while(true) {
-        /* TODO 2: define the value type (struct datarec) */
-        struct datarec value;
-        int key = 0;
-        int err = 0;
-        
-        /* TODO 4: get the value of the map for the key 0 */
-        err = bpf_map_lookup_elem(map_fd, &key, &value);
-        if (err != 0) {
-            log_fatal("Error while retrieving the value from the map");
-            exit(1);
-        }
-
-        if (value.rx_packets == 0 && value.rx_bytes == 0) {
-            continue;
-        }
-        
-        /* TODO 5: print the number of packets received */
-        log_info("Number of packets received: %llu", value.rx_packets);
-        /* TODO 6: print the number of bytes received */
-        log_info("Number of bytes received: %llu", value.rx_bytes);
-        sleep(1);
+    stats_size = bpf_map__max_entries(skel->maps.xdp_stats_map) * sizeof(struct datarec);
+    stats_size = (stats_size + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+    stats = mmap(NULL, stats_size, PROT_READ, MAP_SHARED, map_fd, 0);
+    if (stats == MAP_FAILED) {
+        log_fatal("Error while mapping the map in memory: %s", strerror(errno));
+        return -1;
     }
+
+    return 0;
+}
+
+/* Called by the event loop every second */
+static int poll_stats(struct event_loop *loop, void *ctx) {
+    struct datarec value;
+
+    value.rx_packets = stats[0].rx_packets;
+    value.rx_bytes = stats[0].rx_bytes;
+
+    log_info("Number of packets received: %llu (%llu pps)", value.rx_packets,
+             value.rx_packets - last_stats.rx_packets);
+    log_info("Number of bytes received: %llu (%llu Bps)", value.rx_bytes,
+             value.rx_bytes - last_stats.rx_bytes);
+    last_stats = value;
+
+    if (export_file)
+        export_stats(&value);
+
+    return 0;
 }
 
 int main(int argc, const char **argv) {
     struct counting_with_maps_bpf *skel = NULL;
+    struct event_loop loop = {0};
     int err;
-    const char *iface = NULL;
 
     struct argparse_option options[] = {
         OPT_HELP(),
         OPT_GROUP("Basic options"),
         OPT_STRING('i', "iface", &iface, "Interface where to attach the BPF program", NULL, 0, 0),
+        OPT_STRING('e', "export", &export_file, "File where to export the stats in Prometheus text format", NULL, 0, 0),
         OPT_END(),
     };
 
@@ -139,17 +174,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -166,13 +196,26 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(1);
+    err = map_stats(skel);
+    if (err) {
+        goto cleanup;
+    }
+
+    /* Print the stats every second until SIGINT/SIGTERM */
+    err = event_loop__add_timer(&loop, 1000, poll_stats, skel);
+    if (err) {
+        log_fatal("Error while creating the stats timer");
+        goto cleanup;
+    }
 
-    poll_stats(skel);
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
     counting_with_maps_bpf__destroy(skel);
+    event_loop__destroy(&loop);
+    if (stats != MAP_FAILED)
+        munmap((void *)stats, stats_size);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
@@ -12,12 +12,8 @@
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "log.h"
+#include "event_loop.h"
 
 // Include skeleton file
 #include "packet_rewriting.skel.h"
@@ -50,49 +46,43 @@ static void cleanup_ifaces() {
     }
 }
 
-void sigint_handler(int sig_no) {
-    log_debug("Closing program...");
-    cleanup_ifaces();
-    exit(0);
-}
-
-void poll_stats(struct packet_rewriting_bpf *skel) {
+/* Called by the event loop every second, ctx is the skeleton */
+static int poll_stats(struct event_loop *loop, void *ctx) {
+    struct packet_rewriting_bpf *skel = ctx;
     /* TODO 1: get the map file descriptor for the skeleton */
     int map_fd = 0;
-    
+    /* TODO 2: define the value type (struct datarec) */
+    struct datarec value;
+    int key = 0;
+    int err = 0;
+
     map_fd = bpf_map__fd(skel->maps.xdp_stats_map);
     if (map_fd < 0) {
         log_fatal("Error while retrieving the map file descriptor");
-        exit(1);
+        return -1;
     }
 
-    while(true) {
-        /* TODO 2: define the value type (struct datarec) */
-        struct datarec value;
-        int key = 0;
-        int err = 0;
-        
-        /* TODO 4: get the value of the map for the key 0 */
-        err = bpf_map_lookup_elem(map_fd, &key, &value);
-        if (err != 0) {
-            log_fatal("Error while retrieving the value from the map");
-            exit(1);
-        }
+    /* TODO 4: get the value of the map for the key 0 */
+    err = bpf_map_lookup_elem(map_fd, &key, &value);
+    if (err != 0) {
+        log_fatal("Error while retrieving the value from the map");
+        return -1;
+    }
 
-        if (value.rx_packets == 0 && value.rx_bytes == 0) {
-            continue;
-        }
-        
-        /* TODO 5: print the number of packets received */
-        log_info("Number of packets received: %llu", value.rx_packets);
-        /* TODO 6: print the number of bytes received */
-        log_info("Number of bytes received: %llu", value.rx_bytes);
-        sleep(1);
+    if (value.rx_packets == 0 && value.rx_bytes == 0) {
+        return 0;
     }
+
+    /* TODO 5: print the number of packets received */
+    log_info("Number of packets received: %llu", value.rx_packets);
+    /* TODO 6: print the number of bytes received */
+    log_info("Number of bytes received: %llu", value.rx_bytes);
+    return 0;
 }
 
 int main(int argc, const char **argv) {
     struct packet_rewriting_bpf *skel = NULL;
+    struct event_loop loop = {0};
     int err;
     const char *iface = NULL;
 
@@ -139,17 +129,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -166,13 +151,19 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(1);
+    /* Print the stats every second until SIGINT/SIGTERM */
+    err = event_loop__add_timer(&loop, 1000, poll_stats, skel);
+    if (err) {
+        log_fatal("Error while creating the stats timer");
+        goto cleanup;
+    }
 
-    poll_stats(skel);
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
     packet_rewriting_bpf__destroy(skel);
+    event_loop__destroy(&loop);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
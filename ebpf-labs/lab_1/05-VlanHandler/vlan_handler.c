@@ -12,12 +12,8 @@
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "log.h"
+#include "event_loop.h"
 
 // Include skeleton file
 #include "vlan_handler.skel.h"
@@ -54,14 +50,9 @@ static void cleanup_ifaces() {
     }
 }
 
-void sigint_handler(int sig_no) {
-    log_debug("Closing program...");
-    cleanup_ifaces();
-    exit(0);
-}
-
 int main(int argc, const char **argv) {
     struct vlan_handler_bpf *skel = NULL;
+    struct event_loop loop = {0};
     int err;
     const char *iface1 = NULL;
     const char *iface2 = NULL;
@@ -129,17 +120,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -164,11 +150,13 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(10000);
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
     vlan_handler_bpf__destroy(skel);
+    event_loop__destroy(&loop);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
@@ -39,6 +39,36 @@ struct {
    __uint(max_entries, 16);
 } ip_to_port SEC(".maps");
 
+/* Same as threshold_map, for IPv6 sources */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct in6_addr);
+    __type(value, struct value_t);
+    __uint(max_entries, 1024);
+} threshold_map_v6 SEC(".maps");
+
+struct ipv6_lpm_key {
+   __u32 prefixlen;
+   struct in6_addr addr;
+};
+
+/* IPv6 destinations are looked up by longest prefix match */
+struct {
+   __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+   __type(key, struct ipv6_lpm_key);
+   __type(value, __u32);
+   __uint(map_flags, BPF_F_NO_PREALLOC);
+   __uint(max_entries, 16);
+} ipv6_to_port SEC(".maps");
+
+/* Maximum number of IPv6 extension headers walked before giving up */
+#define IPV6_EXT_MAX_CHAIN 6
+/* Length of the fragment header and mask of the fragment offset in its
+ * second 16-bit word (the low 3 bits are flags)
+ */
+#define IPV6_FRAG_HDR_LEN 8
+#define IPV6_FRAG_OFFSET 0xfff8
+
 static __always_inline int parse_ethhdr(void *data, void *data_end, __u16 *nh_off, struct ethhdr **ethhdr) {
    struct ethhdr *eth = (struct ethhdr *)data;
    int hdr_size = sizeof(*eth);
@@ -79,6 +109,61 @@ static __always_inline int parse_iphdr(void *data, void *data_end, __u16 *nh_off
    return ip->protocol;
 }
 
+static __always_inline int parse_ipv6hdr(void *data, void *data_end, __u16 *nh_off, struct ipv6hdr **ipv6hdr) {
+   struct ipv6hdr *ip6 = (struct ipv6hdr *)(data + *nh_off);
+   __u8 nexthdr;
+
+   if ((void *)ip6 + sizeof(*ip6) > data_end)
+      return -1;
+
+   *nh_off += sizeof(*ip6);
+   *ipv6hdr = ip6;
+   nexthdr = ip6->nexthdr;
+
+   /* Skip the extension headers to find the upper-layer protocol (only the
+    * first fragment has it, the next ones are reported as IPPROTO_FRAGMENT)
+    */
+#pragma unroll
+   for (int i = 0; i < IPV6_EXT_MAX_CHAIN; i++) {
+      struct ipv6_opt_hdr *opt = (struct ipv6_opt_hdr *)(data + *nh_off);
+
+      /* The bounds are only checked for the extension headers: the upper-layer
+       * header may be shorter than 2 bytes (e.g., no next header)
+       */
+      switch (nexthdr) {
+         case IPPROTO_HOPOPTS:
+         case IPPROTO_ROUTING:
+         case IPPROTO_DSTOPTS:
+            if ((void *)opt + sizeof(*opt) > data_end)
+               return -1;
+            *nh_off += (opt->hdrlen + 1) * 8;
+            break;
+         case IPPROTO_FRAGMENT:
+            if ((void *)opt + IPV6_FRAG_HDR_LEN > data_end)
+               return -1;
+            /* Only the first fragment carries the upper-layer header: the other
+             * ones are reported as fragments, so their payload is not parsed as
+             * ports
+             */
+            if (*(__be16 *)((void *)opt + 2) & bpf_htons(IPV6_FRAG_OFFSET))
+               return IPPROTO_FRAGMENT;
+            *nh_off += IPV6_FRAG_HDR_LEN;
+            break;
+         case IPPROTO_AH:
+            if ((void *)opt + sizeof(*opt) > data_end)
+               return -1;
+            *nh_off += (opt->hdrlen + 2) * 4;
+            break;
+         default:
+            return nexthdr;
+      }
+
+      nexthdr = opt->nexthdr;
+   }
+
+   return -1;
+}
+
 SEC("xdp")
 int xdp_hhdv1(struct xdp_md *ctx) {
    void *data_end = (void *)(long)ctx->data_end;
@@ -86,7 +171,8 @@ int xdp_hhdv1(struct xdp_md *ctx) {
 
    __u16 nf_off = 0;
    struct ethhdr *eth;
-   struct iphdr *ip;
+   struct iphdr *ip = NULL;
+   struct ipv6hdr *ip6 = NULL;
    int eth_type, ip_type;
    int action = XDP_PASS;
 
@@ -94,30 +180,38 @@ int xdp_hhdv1(struct xdp_md *ctx) {
 
    eth_type = parse_ethhdr(data, data_end, &nf_off, &eth);
 
-   if (eth_type != bpf_htons(ETH_P_IP)) {
-      bpf_printk("Packet is not an IPv4 packet");
+   if (eth_type == bpf_htons(ETH_P_IP)) {
+      ip_type = parse_iphdr(data, data_end, &nf_off, &ip);
+   } else if (eth_type == bpf_htons(ETH_P_IPV6)) {
+      ip_type = parse_ipv6hdr(data, data_end, &nf_off, &ip6);
+   } else {
+      bpf_printk("Packet is not an IPv4 or IPv6 packet");
       return XDP_DROP;
    }
 
-   ip_type = parse_iphdr(data, data_end, &nf_off, &ip);
-
    if (ip_type < 0) {
-      bpf_printk("Packet is not a valid IPv4 packet");
+      bpf_printk("Packet is not a valid IP packet");
       return XDP_DROP;
    }
 
    if (ctx->ingress_ifindex != hhdv1_cfg.ifindex_if4) {
-      struct value_t *val = bpf_map_lookup_elem(&threshold_map, &ip->saddr);
+      struct value_t *val;
+
+      if (ip)
+         val = bpf_map_lookup_elem(&threshold_map, &ip->saddr);
+      else
+         val = bpf_map_lookup_elem(&threshold_map_v6, &ip6->saddr);
+
       if (!val) {
-         bpf_printk("No threshold set for IP %d", ip->saddr);
+         bpf_printk("No threshold set for the source IP");
          bpf_printk("Dropping packet");
          goto drop;
       }
 
-      bpf_printk("Current # of packets received for IP %d: %d. Threshold is: %d", ip->saddr, val->packets_rcvd, val->threshold);
+      bpf_printk("Current # of packets received: %d. Threshold is: %d", val->packets_rcvd, val->threshold);
       __sync_fetch_and_add(&val->packets_rcvd, 1);
       if (val->packets_rcvd > val->threshold) {
-         bpf_printk("Threshold exceeded for IP %d", ip->saddr);
+         bpf_printk("Threshold exceeded for the source IP");
          bpf_printk("Dropping packet");
          goto drop;
       }
@@ -128,14 +222,23 @@ int xdp_hhdv1(struct xdp_md *ctx) {
       bpf_printk("Packet received from interface %d", ctx->ingress_ifindex);
 
       // Check if IP is in map
-      __u32 *port = bpf_map_lookup_elem(&ip_to_port, &ip->daddr);
+      __u32 *port;
+
+      if (ip) {
+         port = bpf_map_lookup_elem(&ip_to_port, &ip->daddr);
+      } else {
+         struct ipv6_lpm_key key = {.prefixlen = 128};
+
+         __builtin_memcpy(&key.addr, &ip6->daddr, sizeof(key.addr));
+         port = bpf_map_lookup_elem(&ipv6_to_port, &key);
+      }
 
       if (!port) {
-         bpf_printk("IP %d not found in map", ip->daddr);
+         bpf_printk("Destination IP not found in map");
          goto drop;
       }
 
-      bpf_printk("IP %d found in map. Forwarding packet to port %d", ip->daddr, *port);
+      bpf_printk("Destination IP found in map. Forwarding packet to port %d", *port);
 
       switch (*port) {
          case 1:
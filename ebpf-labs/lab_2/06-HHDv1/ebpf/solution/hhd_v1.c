@@ -15,12 +15,9 @@
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "log.h"
+#include "event_loop.h"
+#include "map_utils.h"
 #include "hhd_v1.h"
 
 struct map_value_t {
@@ -28,16 +25,45 @@ struct map_value_t {
    __u64 packets_rcvd;
 };
 
+struct ipv6_lpm_key {
+   __u32 prefixlen;
+   struct in6_addr addr;
+};
+
 static const char *const usages[] = {
     "hhd_v1 [options] [[--] args]",
     "hhd_v1 [options]",
     NULL,
 };
 
+/* Set the threshold of a source. A source that is already in the map keeps
+ * its counter, so that reloading the configuration does not unblock the
+ * current heavy hitters
+ */
+static int set_threshold(int map_fd, const void *key, __u64 threshold) {
+    struct map_value_t value = {0};
+
+    if (!bpf_map_lookup_elem(map_fd, key, &value)) {
+        if (value.threshold == threshold)
+            return 0;
+        /* Packets counted between the lookup and the update are lost */
+        value.threshold = threshold;
+        return bpf_map_update_elem(map_fd, key, &value, BPF_EXIST);
+    }
+
+    value.threshold = threshold;
+    return bpf_map_update_elem(map_fd, key, &value, BPF_NOEXIST);
+}
+
 int load_maps_config(const char *config_file, struct hhd_v1_bpf *skel) {
     struct ips *ips;
     cyaml_err_t err;
     int ret = EXIT_SUCCESS;
+    /* Keys of the configuration, to delete the ones removed from the file */
+    __u32 *keys_v4 = NULL;
+    struct in6_addr *keys_v6 = NULL;
+    struct ipv6_lpm_key *keys_lpm = NULL;
+    __u32 n_v4 = 0, n_v6 = 0, n_lpm = 0;
 
     /* Load input file. */
 	err = cyaml_load_file(config_file, &config, &ips_schema, (void **) &ips, NULL);
@@ -48,6 +74,15 @@ int load_maps_config(const char *config_file, struct hhd_v1_bpf *skel) {
 
     log_info("Loaded %d IPs", ips->ips_count);
 
+    keys_v4 = calloc(ips->ips_count + 1, sizeof(*keys_v4));
+    keys_v6 = calloc(ips->ips_count + 1, sizeof(*keys_v6));
+    keys_lpm = calloc(ips->ips_count + 1, sizeof(*keys_lpm));
+    if (!keys_v4 || !keys_v6 || !keys_lpm) {
+        log_error("Failed to allocate the keys of the configuration");
+        ret = EXIT_FAILURE;
+        goto cleanup_yaml;
+    }
+
     // Get file descriptor of the map
     int threshold_map_fd = bpf_map__fd(skel->maps.threshold_map);
 
@@ -58,32 +93,63 @@ int load_maps_config(const char *config_file, struct hhd_v1_bpf *skel) {
         goto cleanup_yaml;
     }
 
+    int threshold_map_v6_fd = bpf_map__fd(skel->maps.threshold_map_v6);
+    if (threshold_map_v6_fd < 0) {
+        log_error("Failed to get file descriptor of BPF map: %s", strerror(errno));
+        ret = EXIT_FAILURE;
+        goto cleanup_yaml;
+    }
+
     /* Load the IPs in the BPF map */
     for (int i = 0; i < ips->ips_count; i++) {
         log_info("Loading IP %s", ips->ips[i].ip);
         log_info("Threshold: %d", ips->ips[i].threshold);
 
+        // IPv6 addresses go in their own map. The entry may have a prefix
+        // length for ipv6_to_port, but thresholds are per source host: the
+        // threshold is set on the address before the "/"
+        if (strchr(ips->ips[i].ip, ':')) {
+            struct in6_addr *addr6 = &keys_v6[n_v6];
+            char buf[INET6_ADDRSTRLEN + 4];
+            char *slash;
+
+            snprintf(buf, sizeof(buf), "%s", ips->ips[i].ip);
+            slash = strchr(buf, '/');
+            if (slash)
+                *slash = '\0';
+
+            if (inet_pton(AF_INET6, buf, addr6) != 1) {
+                log_error("Failed to convert IPv6 %s", ips->ips[i].ip);
+                ret = EXIT_FAILURE;
+                goto cleanup_yaml;
+            }
+            if (slash && atoi(slash + 1) != 128)
+                log_warn("The threshold of %s only applies to the source %s", ips->ips[i].ip,
+                         buf);
+
+            if (set_threshold(threshold_map_v6_fd, addr6, ips->ips[i].threshold) != 0) {
+                log_error("Failed to update BPF map: %s", strerror(errno));
+                ret = EXIT_FAILURE;
+                goto cleanup_yaml;
+            }
+            n_v6++;
+            continue;
+        }
+
         // Convert the IP to an integer
         struct in_addr addr;
-        int ret = inet_pton(AF_INET, ips->ips[i].ip, &addr);
-        if (ret != 1) {
+        if (inet_pton(AF_INET, ips->ips[i].ip, &addr) != 1) {
             log_error("Failed to convert IP %s to integer", ips->ips[i].ip);
             ret = EXIT_FAILURE;
             goto cleanup_yaml;
         }
 
-        // Now write the IP to the BPF map
-        struct map_value_t value = {
-            .threshold = ips->ips[i].threshold,
-            .packets_rcvd = 0,
-        };
-
-        ret = bpf_map_update_elem(threshold_map_fd, &addr.s_addr, &value, BPF_ANY);
-        if (ret != 0) {
+        if (set_threshold(threshold_map_fd, &addr.s_addr, ips->ips[i].threshold) != 0) {
             log_error("Failed to update BPF map: %s", strerror(errno));
             ret = EXIT_FAILURE;
-            goto cleanup_yaml;  
-        }        
+            goto cleanup_yaml;
+        }
+        keys_v4[n_v4++] = addr.s_addr;
     }
 
     // Get fd of port map
@@ -96,39 +162,102 @@ int load_maps_config(const char *config_file, struct hhd_v1_bpf *skel) {
         goto cleanup_yaml;
     }
 
+    int ipv6_port_map_fd = bpf_map__fd(skel->maps.ipv6_to_port);
+    if (ipv6_port_map_fd < 0) {
+        log_error("Failed to get file descriptor of BPF map: %s", strerror(errno));
+        ret = EXIT_FAILURE;
+        goto cleanup_yaml;
+    }
+
     /* Load the IPs in the BPF map */
     for (int i = 0; i < ips->ips_count; i++) {
         log_info("Loading IP %s", ips->ips[i].ip);
         log_info("Port: %d", ips->ips[i].port);
 
+        uint32_t port = ips->ips[i].port;
+
+        // IPv6 destinations go in the LPM map, the prefix length is optional
+        if (strchr(ips->ips[i].ip, ':')) {
+            struct ipv6_lpm_key *key = &keys_lpm[n_lpm];
+            char buf[INET6_ADDRSTRLEN + 4];
+            char *slash;
+
+            key->prefixlen = 128;
+            snprintf(buf, sizeof(buf), "%s", ips->ips[i].ip);
+            slash = strchr(buf, '/');
+            if (slash) {
+                *slash = '\0';
+                key->prefixlen = atoi(slash + 1);
+            }
+
+            if (key->prefixlen > 128 || inet_pton(AF_INET6, buf, &key->addr) != 1) {
+                log_error("Failed to convert IPv6 %s", ips->ips[i].ip);
+                ret = EXIT_FAILURE;
+                goto cleanup_yaml;
+            }
+
+            if (bpf_map_update_elem(ipv6_port_map_fd, key, &port, BPF_ANY) != 0) {
+                log_error("Failed to update BPF map: %s", strerror(errno));
+                ret = EXIT_FAILURE;
+                goto cleanup_yaml;
+            }
+            n_lpm++;
+            continue;
+        }
+
         // Convert the IP to an integer
         struct in_addr addr;
-        int ret = inet_pton(AF_INET, ips->ips[i].ip, &addr);
-        if (ret != 1) {
+        if (inet_pton(AF_INET, ips->ips[i].ip, &addr) != 1) {
             log_error("Failed to convert IP %s to integer", ips->ips[i].ip);
             ret = EXIT_FAILURE;
             goto cleanup_yaml;
         }
 
-        uint32_t port = ips->ips[i].port;
-
-        ret = bpf_map_update_elem(port_map_fd, &addr.s_addr, &port, BPF_ANY);
-        if (ret != 0) {
+        if (bpf_map_update_elem(port_map_fd, &addr.s_addr, &port, BPF_ANY) != 0) {
             log_error("Failed to update BPF map: %s", strerror(errno));
             ret = EXIT_FAILURE;
-            goto cleanup_yaml;  
-        }        
+            goto cleanup_yaml;
+        }
     }
 
+    /* Entries removed from the file (on a reload) */
+    if (map_prune(threshold_map_fd, keys_v4, n_v4, sizeof(*keys_v4)) ||
+        map_prune(threshold_map_v6_fd, keys_v6, n_v6, sizeof(*keys_v6)) ||
+        map_prune(port_map_fd, keys_v4, n_v4, sizeof(*keys_v4)) ||
+        map_prune(ipv6_port_map_fd, keys_lpm, n_lpm, sizeof(*keys_lpm)))
+        ret = EXIT_FAILURE;
+
 cleanup_yaml:
     /* Free the data */
 	cyaml_free(&config, &ips_schema, ips, 0);
+    free(keys_v4);
+    free(keys_v6);
+    free(keys_lpm);
 
     return ret;
 }
 
+struct reload_ctx {
+    const char *config_file;
+    struct hhd_v1_bpf *skel;
+};
+
+/* Called by the event loop when the configuration file is rewritten */
+static int reload_config(struct event_loop *loop, void *ctx) {
+    struct reload_ctx *reload = ctx;
+
+    log_info("Configuration file %s changed, reloading it", reload->config_file);
+    if (load_maps_config(reload->config_file, reload->skel)) {
+        log_error("Error while reloading map configuration");
+    }
+
+    return 0;
+}
+
 int main(int argc, const char **argv) {
     struct hhd_v1_bpf *skel = NULL;
+    struct event_loop loop = {0};
+    struct reload_ctx reload = {0};
     int err;
     const char *config_file = NULL;
     const char *iface1 = NULL;
@@ -188,17 +317,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -220,11 +344,22 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(10000);
+    /* Reload the configuration when the file changes */
+    reload.config_file = config_file;
+    reload.skel = skel;
+    err = event_loop__watch_file(&loop, config_file, reload_config, &reload);
+    if (err) {
+        log_fatal("Error while watching %s", config_file);
+        goto cleanup;
+    }
+
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
     hhd_v1_bpf__destroy(skel);
+    event_loop__destroy(&loop);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
@@ -15,12 +15,8 @@
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "log.h"
+#include "event_loop.h"
 #include "hhd_v1.h"
 
 /* TODO 2: Define the struct containing the map value
@@ -96,8 +92,27 @@ cleanup_yaml:
     return ret;
 }
 
+struct reload_ctx {
+    const char *config_file;
+    struct hhd_v1_bpf *skel;
+};
+
+/* Called by the event loop when the configuration file is rewritten */
+static int reload_config(struct event_loop *loop, void *ctx) {
+    struct reload_ctx *reload = ctx;
+
+    log_info("Configuration file %s changed, reloading it", reload->config_file);
+    if (load_maps_config(reload->config_file, reload->skel)) {
+        log_error("Error while reloading map configuration");
+    }
+
+    return 0;
+}
+
 int main(int argc, const char **argv) {
     struct hhd_v1_bpf *skel = NULL;
+    struct event_loop loop = {0};
+    struct reload_ctx reload = {0};
     int err;
     const char *config_file = NULL;
     const char *iface1 = NULL;
@@ -157,17 +172,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -189,11 +199,22 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(10000);
+    /* Reload the configuration when the file changes */
+    reload.config_file = config_file;
+    reload.skel = skel;
+    err = event_loop__watch_file(&loop, config_file, reload_config, &reload);
+    if (err) {
+        log_fatal("Error while watching %s", config_file);
+        goto cleanup;
+    }
+
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
     hhd_v1_bpf__destroy(skel);
+    event_loop__destroy(&loop);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
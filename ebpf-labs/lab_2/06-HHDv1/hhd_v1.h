@@ -200,10 +200,4 @@ static void get_iface_ifindex(const char *iface1, const char *iface2, const char
     }
 }
 
-void sigint_handler(int sig_no) {
-    log_debug("Closing program...");
-    cleanup_ifaces();
-    exit(0);
-}
-
 #endif //HHD_V1_H_
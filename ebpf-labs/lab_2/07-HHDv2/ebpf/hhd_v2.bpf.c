@@ -16,6 +16,7 @@
 #include "fasthash.h"
 #include "hhd_v2_utils.bpf.h"
 #include "jhash.h"
+#include "sketch_hash.h"
 
 #define BLOOM_FILTER_ENTRIES 4096
 #define FASTHASH_SEED 0xdeadbeef
@@ -95,7 +96,9 @@ int xdp_hhd_v2(struct xdp_md *ctx) {
     __u16 src_mac_key;
     int action = XDP_PASS;
     __u32 ipv4_lookup_map_key;
-    // struct iphdr *ip;
+    /* Set one of them (e.g., with parse_iphdr() or parse_ipv6hdr()) */
+    struct iphdr *ip = NULL;
+    struct ipv6hdr *ip6 = NULL;
     // struct tcphdr *tcp;
     // struct udphdr *udp;
 
@@ -115,18 +118,55 @@ int xdp_hhd_v2(struct xdp_md *ctx) {
      * If it is, return XDP_PASS.
      */
 
-    /* TODO 2: Check if the packet is IPv4.
+    /* TODO 2: Check if the packet is IPv4 or IPv6.
      * If it is, continue with the program.
      * If it is not, return XDP_DROP.
      */
 
-    /* TODO 3: Parse the IPv4 header.
-     * If the packet is not a valid IPv4 packet, return XDP_DROP.
+    /* TODO 3: Parse the IPv4 header (or the IPv6 one, with the parse_ipv6hdr()
+     * helper of hhd_v2_utils.bpf.h, which also skips the extension headers).
+     * If the packet is not a valid IP packet, return XDP_DROP.
+     * Keep the header in ip (or ip6), it is used by the code below.
      */
 
+    /* The allow/deny lists are checked for you, once ip or ip6 is set:
+     * sources in the deny list are always dropped, the ones in the allow list
+     * (e.g., monitoring probes) are forwarded without being counted by the
+     * sketch
+     */
+    if (ip || ip6) {
+        struct in6_addr src;
+
+        if (ip) {
+            if ((void *)ip + sizeof(*ip) > data_end) {
+                action = XDP_ABORTED;
+                goto out;
+            }
+            ipv4_mapped(ip->saddr, &src);
+        } else {
+            if ((void *)ip6 + sizeof(*ip6) > data_end) {
+                action = XDP_ABORTED;
+                goto out;
+            }
+            __builtin_memcpy(&src, &ip6->saddr, sizeof(src));
+        }
+
+        switch (src_list_check(&src)) {
+        case SRC_LIST_DENY:
+            bpf_printk("Source in the deny list, dropping packet");
+            return XDP_DROP;
+        case SRC_LIST_ALLOW:
+            goto forward;
+        default:
+            break;
+        }
+    }
+
     /* TODO 5: Define a C struct for the 5-tuple
      * (source IP, destination IP, source port, destination port, protocol).
      * Fill the struct with the values from the packet.
+     * For IPv6 packets you can use struct flow_v6 (hhd_v2_utils.bpf.h), which
+     * holds the full 128-bit addresses: remember to zero it before filling it.
      */
 
     /* TODO 7: Check if the packet is TCP or UDP
@@ -146,6 +186,12 @@ int xdp_hhd_v2(struct xdp_md *ctx) {
      * The second parameter is the size of the data to hash.
      * The third parameter is the seed to use for the hash function.
      * You can use the define values FASTHASH_SEED and JHASH_SEED for the seed.
+     *
+     * Alternatively, hash the flow only once with sketch_hash() and derive the
+     * index of every row with sketch_index() (see sketch_hash.h): more rows then
+     * cost no extra hash passes, and the userspace tools can reproduce the same
+     * indices (sketch_hash_batch.h). IPv6 flows are hashed with sketch_hash_v6(),
+     * whose key has the same layout of struct flow_v6.
      */
 
     /* TODO 14: Check if the values from the bloom filter are above the threshold
@@ -157,8 +203,12 @@ int xdp_hhd_v2(struct xdp_md *ctx) {
 
 forward:
     /* TODO 15: Copy inside the ipv4_lookup_map_key variable the destination IP
-     * address of the packet The value should be in network byte order. E.g.,
-     * ipv4_lookup_map_key = flow.daddr;
+     * address of the packet The value should be in network byte order. Take it
+     * from the IPv4 header, not from the 5-tuple: the sources in the allow list
+     * jump here before the 5-tuple is filled. E.g.,
+     * ipv4_lookup_map_key = ip->daddr;
+     * IPv6 packets only need ip6 to be set, they are looked up below by
+     * longest prefix match in ipv6_lookup_map.
      */
 
     /* From here on, you don't need to modify anything
@@ -169,7 +219,19 @@ forward:
 
     /* In this case the packet is allowed to pass, let's see if the hash map
      * contains the dst ip */
-    val = bpf_map_lookup_elem(&ipv4_lookup_map, &ipv4_lookup_map_key);
+    if (ip6) {
+        struct ipv6_lpm_key ipv6_lookup_map_key = {.prefixlen = 128};
+
+        if ((void *)ip6 + sizeof(*ip6) > data_end) {
+            action = XDP_ABORTED;
+            goto out;
+        }
+
+        __builtin_memcpy(&ipv6_lookup_map_key.addr, &ip6->daddr, sizeof(struct in6_addr));
+        val = bpf_map_lookup_elem(&ipv6_lookup_map, &ipv6_lookup_map_key);
+    } else {
+        val = bpf_map_lookup_elem(&ipv4_lookup_map, &ipv4_lookup_map_key);
+    }
 
     if (!val) {
         bpf_printk("Error looking up destination IP in map");
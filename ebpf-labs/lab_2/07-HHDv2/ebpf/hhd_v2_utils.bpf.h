@@ -49,4 +49,162 @@ struct {
     __uint(max_entries, 1024);
 } src_mac_map SEC(".maps");
 
+struct ipv6_lpm_key {
+    __u32 prefixlen;
+    struct in6_addr addr;
+};
+
+// Define LPM map that will work as IPv6 lookup table
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __type(key, struct ipv6_lpm_key);
+    __type(value, struct ipv4_lookup_val);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, 1024);
+} ipv6_lookup_map SEC(".maps");
+
+/* Allow and deny lists of source addresses. Every list is a bloom filter,
+ * which answers "definitely not in the list" in constant time and with a
+ * fixed amount of memory, backed by a hash map that confirms the (rare)
+ * positive answers, so false positives of the filter never change the
+ * verdict. IPv4 addresses are stored IPv4-mapped (::ffff:a.b.c.d), so both
+ * families share the same maps. max_entries is set by the loader on the size
+ * of the lists.
+ */
+#define SRC_LIST_BLOOM_HASHES 3
+
+struct {
+    __uint(type, BPF_MAP_TYPE_BLOOM_FILTER);
+    __type(value, struct in6_addr);
+    __uint(max_entries, 1);
+    __uint(map_extra, SRC_LIST_BLOOM_HASHES);
+} allow_bloom SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct in6_addr);
+    __type(value, __u8);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, 1);
+} allow_list SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_BLOOM_FILTER);
+    __type(value, struct in6_addr);
+    __uint(max_entries, 1);
+    __uint(map_extra, SRC_LIST_BLOOM_HASHES);
+} deny_bloom SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct in6_addr);
+    __type(value, __u8);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, 1);
+} deny_list SEC(".maps");
+
+enum src_list_verdict {
+    SRC_LIST_NONE,
+    SRC_LIST_ALLOW,
+    SRC_LIST_DENY,
+};
+
+static __always_inline void ipv4_mapped(__be32 addr, struct in6_addr *addr6) {
+    addr6->in6_u.u6_addr32[0] = 0;
+    addr6->in6_u.u6_addr32[1] = 0;
+    addr6->in6_u.u6_addr32[2] = bpf_htonl(0x0000ffff);
+    addr6->in6_u.u6_addr32[3] = addr;
+}
+
+/* Check a source address (IPv4-mapped for IPv4 packets) against the lists,
+ * the deny list wins if the address is in both
+ */
+static __always_inline enum src_list_verdict src_list_check(struct in6_addr *saddr) {
+    if (!bpf_map_peek_elem(&deny_bloom, saddr) && bpf_map_lookup_elem(&deny_list, saddr))
+        return SRC_LIST_DENY;
+
+    if (!bpf_map_peek_elem(&allow_bloom, saddr) && bpf_map_lookup_elem(&allow_list, saddr))
+        return SRC_LIST_ALLOW;
+
+    return SRC_LIST_NONE;
+}
+
+/* 5-tuple of IPv6 flows, to be hashed as a whole (128-bit addresses). The
+ * padding is explicit, so that zeroing the struct is enough to get the same
+ * hash for the same flow.
+ */
+struct flow_v6 {
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+    __be16 sport;
+    __be16 dport;
+    __u8 proto;
+    __u8 pad[3];
+};
+
+/* Maximum number of IPv6 extension headers walked before giving up */
+#define IPV6_EXT_MAX_CHAIN 6
+/* Length of the fragment header and mask of the fragment offset in its
+ * second 16-bit word (the low 3 bits are flags)
+ */
+#define IPV6_FRAG_HDR_LEN 8
+#define IPV6_FRAG_OFFSET 0xfff8
+
+/* Parse the IPv6 header and skip its extension headers, returning the
+ * upper-layer protocol (nh_off then points to its header), IPPROTO_FRAGMENT
+ * for the fragments after the first one, or -1.
+ */
+static __always_inline int parse_ipv6hdr(void *data, void *data_end, __u16 *nh_off,
+                                         struct ipv6hdr **ipv6hdr) {
+    struct ipv6hdr *ip6 = (struct ipv6hdr *)(data + *nh_off);
+    __u8 nexthdr;
+
+    if ((void *)ip6 + sizeof(*ip6) > data_end)
+        return -1;
+
+    *nh_off += sizeof(*ip6);
+    *ipv6hdr = ip6;
+    nexthdr = ip6->nexthdr;
+
+#pragma unroll
+    for (int i = 0; i < IPV6_EXT_MAX_CHAIN; i++) {
+        struct ipv6_opt_hdr *opt = (struct ipv6_opt_hdr *)(data + *nh_off);
+
+        /* The bounds are only checked for the extension headers: the upper-layer
+         * header may be shorter than 2 bytes (e.g., no next header)
+         */
+        switch (nexthdr) {
+        case IPPROTO_HOPOPTS:
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+            if ((void *)opt + sizeof(*opt) > data_end)
+                return -1;
+            *nh_off += (opt->hdrlen + 1) * 8;
+            break;
+        case IPPROTO_FRAGMENT:
+            if ((void *)opt + IPV6_FRAG_HDR_LEN > data_end)
+                return -1;
+            /* Only the first fragment carries the upper-layer header: the other
+             * ones are reported as fragments, so their payload is not parsed as
+             * ports
+             */
+            if (*(__be16 *)((void *)opt + 2) & bpf_htons(IPV6_FRAG_OFFSET))
+                return IPPROTO_FRAGMENT;
+            *nh_off += IPV6_FRAG_HDR_LEN;
+            break;
+        case IPPROTO_AH:
+            if ((void *)opt + sizeof(*opt) > data_end)
+                return -1;
+            *nh_off += (opt->hdrlen + 2) * 4;
+            break;
+        default:
+            return nexthdr;
+        }
+
+        nexthdr = opt->nexthdr;
+    }
+
+    return -1;
+}
+
 #endif // HHD_V2_UTILS_H_
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <linux/types.h>
+
+#include "fasthash.h"
+
+/* Sketch indexing shared by the XDP program and the userspace tools.
+ *
+ * Instead of running one hash function per row of the sketch (e.g., jhash
+ * and fasthash64), the 5-tuple is hashed once with fasthash64 and the index
+ * of every row is derived with Kirsch-Mitzenmacher double hashing:
+ *
+ *     g_i(x) = h1(x) + i * h2(x)  (mod entries)
+ *
+ * where h1 and h2 are the low and high 32 bits of the hash. h2 is forced to
+ * be odd, so that with a power-of-two number of entries the rows of a flow
+ * never collapse on the same index. Adding rows costs a multiply-add, not a
+ * full hash pass, and userspace can reproduce the in-kernel indices exactly.
+ */
+
+#define SKETCH_HASH_SEED 0xdeadbeef
+#define SKETCH_MAX_ROWS 8
+
+/* 5-tuple hashed by the sketch: 16 bytes, i.e., two 64-bit words for
+ * fasthash64. The padding must be zeroed.
+ */
+struct sketch_flow_key {
+    __be32 saddr;
+    __be32 daddr;
+    __be16 sport;
+    __be16 dport;
+    __u8 proto;
+    __u8 pad[3];
+};
+
+/* IPv6 5-tuple hashed by the sketch: 40 bytes, i.e., five 64-bit words,
+ * with the same layout of struct flow_v6 (hhd_v2_utils.bpf.h). The padding
+ * must be zeroed.
+ */
+struct sketch_flow_key_v6 {
+    __be32 saddr[4];
+    __be32 daddr[4];
+    __be16 sport;
+    __be16 dport;
+    __u8 proto;
+    __u8 pad[3];
+};
+
+static __attribute__((always_inline)) inline __u64
+sketch_hash(const struct sketch_flow_key *key) {
+    return fasthash64(key, sizeof(*key), SKETCH_HASH_SEED);
+}
+
+static __attribute__((always_inline)) inline __u64
+sketch_hash_v6(const struct sketch_flow_key_v6 *key) {
+    return fasthash64(key, sizeof(*key), SKETCH_HASH_SEED);
+}
+
+/* Index of the given row; entries must be a power of two */
+static __attribute__((always_inline)) inline __u32 sketch_index(__u64 hash, __u32 row,
+                                                                __u32 entries) {
+    __u32 h1 = (__u32)hash;
+    __u32 h2 = (__u32)(hash >> 32) | 1;
+
+    return (h1 + row * h2) & (entries - 1);
+}
@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <linux/if_link.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
@@ -15,13 +16,10 @@
 #include <argparse.h>
 #include <net/if.h>
 
-#ifndef __USE_POSIX
-#define __USE_POSIX
-#endif
-#include <signal.h>
-
 #include "hhd_v2.h"
 #include "log.h"
+#include "event_loop.h"
+#include "map_utils.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -42,10 +40,20 @@ struct src_mac_val {
     __u8 srcMac[6];
 };
 
+struct ipv6_lpm_key {
+    __u32 prefixlen;
+    struct in6_addr addr;
+};
+
 int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *macs) {
     struct ips *ips;
     cyaml_err_t err;
     int ret = EXIT_SUCCESS;
+    /* Keys of the configuration, to delete the ones removed from the file */
+    __u32 *keys_v4 = NULL;
+    struct ipv6_lpm_key *keys_v6 = NULL;
+    __u16 *keys_port = NULL;
+    __u32 n_v4 = 0, n_v6 = 0;
 
     /* Load input file. */
     err = cyaml_load_file(config_file, &config, &ips_schema, (void **)&ips, NULL);
@@ -56,6 +64,15 @@ int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *ma
 
     log_info("Loaded %d IPs", ips->ips_count);
 
+    keys_v4 = calloc(ips->ips_count + 1, sizeof(*keys_v4));
+    keys_v6 = calloc(ips->ips_count + 1, sizeof(*keys_v6));
+    keys_port = calloc(ips->ips_count + 1, sizeof(*keys_port));
+    if (!keys_v4 || !keys_v6 || !keys_port) {
+        log_error("Failed to allocate the keys of the configuration");
+        ret = EXIT_FAILURE;
+        goto cleanup_yaml;
+    }
+
     // Get fd of ipv4_lookup_map
     int ipv4_lookup_map_fd = bpf_map__fd(skel->maps.ipv4_lookup_map);
 
@@ -66,6 +83,16 @@ int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *ma
         goto cleanup_yaml;
     }
 
+    // Get fd of ipv6_lookup_map
+    int ipv6_lookup_map_fd = bpf_map__fd(skel->maps.ipv6_lookup_map);
+
+    // Check if the file descriptor is valid
+    if (ipv6_lookup_map_fd < 0) {
+        log_error("Failed to get file descriptor of BPF map: %s", strerror(errno));
+        ret = EXIT_FAILURE;
+        goto cleanup_yaml;
+    }
+
     struct ipv4_lookup_val val = {0};
 
     /* Load the IPs in the BPF map */
@@ -74,9 +101,27 @@ int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *ma
         log_info("Port: %d", ips->ips[i].port);
         log_info("MAC dst: %s", ips->ips[i].mac);
 
-        // Convert the IP to an integer
+        // Convert the IP to an integer (IPv6 ones go in the LPM map, with an
+        // optional prefix length)
         struct in_addr addr;
-        int ret = inet_pton(AF_INET, ips->ips[i].ip, &addr);
+        struct ipv6_lpm_key key6 = {.prefixlen = 128};
+        bool is_ipv6 = strchr(ips->ips[i].ip, ':') != NULL;
+
+        if (is_ipv6) {
+            char buf[INET6_ADDRSTRLEN + 4];
+            char *slash;
+
+            snprintf(buf, sizeof(buf), "%s", ips->ips[i].ip);
+            slash = strchr(buf, '/');
+            if (slash) {
+                *slash = '\0';
+                key6.prefixlen = atoi(slash + 1);
+            }
+            ret = key6.prefixlen <= 128 ? inet_pton(AF_INET6, buf, &key6.addr) : 0;
+        } else {
+            ret = inet_pton(AF_INET, ips->ips[i].ip, &addr);
+        }
+
         if (ret != 1) {
             log_error("Failed to convert IP %s to integer", ips->ips[i].ip);
             ret = EXIT_FAILURE;
@@ -102,12 +147,20 @@ int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *ma
 
         val.outPort = ips->ips[i].port;
 
-        ret = bpf_map_update_elem(ipv4_lookup_map_fd, &addr.s_addr, &val, BPF_ANY);
+        if (is_ipv6)
+            ret = bpf_map_update_elem(ipv6_lookup_map_fd, &key6, &val, BPF_ANY);
+        else
+            ret = bpf_map_update_elem(ipv4_lookup_map_fd, &addr.s_addr, &val, BPF_ANY);
         if (ret != 0) {
             log_error("Failed to update BPF map: %s", strerror(errno));
             ret = EXIT_FAILURE;
             goto cleanup_yaml;
         }
+
+        if (is_ipv6)
+            keys_v6[n_v6++] = key6;
+        else
+            keys_v4[n_v4++] = addr.s_addr;
     }
 
     /* Let's now load the Source MACs into the map */
@@ -140,17 +193,168 @@ int load_maps_config(struct hhd_v2_bpf *skel, const char *config_file, mac_t *ma
             ret = EXIT_FAILURE;
             goto cleanup_yaml;
         }
+        keys_port[i] = src_mac_key;
     }
 
+    /* Entries removed from the file (on a reload) */
+    if (map_prune(ipv4_lookup_map_fd, keys_v4, n_v4, sizeof(*keys_v4)) ||
+        map_prune(ipv6_lookup_map_fd, keys_v6, n_v6, sizeof(*keys_v6)) ||
+        map_prune(src_mac_map_fd, keys_port, ips->ips_count, sizeof(*keys_port)))
+        ret = EXIT_FAILURE;
+
 cleanup_yaml:
     /* Free the data */
     cyaml_free(&config, &ips_schema, ips, 0);
+    free(keys_v4);
+    free(keys_v6);
+    free(keys_port);
 
     return ret;
 }
 
+/* Source addresses of the allow/deny lists, IPv4 ones are stored IPv4-mapped
+ * (::ffff:a.b.c.d) as in the XDP program
+ */
+struct src_list {
+    struct in6_addr *addrs;
+    __u32 count;
+};
+
+/* Read a list of addresses, one per line ('#' starts a comment) */
+static int read_src_list(const char *path, struct src_list *list) {
+    char line[INET6_ADDRSTRLEN + 64];
+    __u32 cap = 0;
+    int err = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *str = line + strspn(line, " \t");
+        struct in6_addr *addr;
+        struct in_addr addr4;
+        int ret;
+
+        str[strcspn(str, " \t\r\n#")] = '\0';
+        if (*str == '\0')
+            continue;
+
+        if (list->count == cap) {
+            struct in6_addr *addrs;
+
+            cap = cap ? cap * 2 : 1024;
+            addrs = realloc(list->addrs, cap * sizeof(*addrs));
+            if (!addrs) {
+                log_error("Cannot allocate the list of %s", path);
+                err = -ENOMEM;
+                break;
+            }
+            list->addrs = addrs;
+        }
+
+        addr = &list->addrs[list->count];
+        if (strchr(str, ':')) {
+            ret = inet_pton(AF_INET6, str, addr);
+        } else {
+            ret = inet_pton(AF_INET, str, &addr4);
+            memset(addr, 0, sizeof(*addr));
+            addr->s6_addr32[2] = htonl(0x0000ffff);
+            addr->s6_addr32[3] = addr4.s_addr;
+        }
+
+        if (ret != 1) {
+            log_error("Invalid address %s in %s", str, path);
+            err = -EINVAL;
+            break;
+        }
+        list->count++;
+    }
+
+    fclose(fp);
+    log_info("Read %u addresses from %s", list->count, path);
+    return err;
+}
+
+/* The maps of the lists are sized on the lists before loading the program,
+ * so the memory they use is bounded by the number of addresses (the bloom
+ * filter is sized by the kernel for max_entries elements)
+ */
+static int size_src_list(struct bpf_map *bloom, struct bpf_map *hash, const struct src_list *list) {
+    __u32 entries = list->count ? list->count : 1;
+
+    if (bpf_map__set_max_entries(bloom, entries) || bpf_map__set_max_entries(hash, entries)) {
+        log_error("Failed to set the size of %s", bpf_map__name(hash));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int load_src_list(struct bpf_map *bloom, struct bpf_map *hash, const struct src_list *list) {
+    DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_ANY);
+    __u32 count = list->count;
+    __u8 *values;
+    int err = 0;
+
+    if (!count)
+        return 0;
+
+    values = malloc(count);
+    if (!values) {
+        log_error("Cannot allocate the values of %s", bpf_map__name(hash));
+        return -ENOMEM;
+    }
+    memset(values, 1, count);
+
+    /* The hash map is filled with a single syscall */
+    if (bpf_map_update_batch(bpf_map__fd(hash), list->addrs, values, &count, &opts)) {
+        log_error("Failed to update BPF map %s: %s", bpf_map__name(hash), strerror(errno));
+        err = -1;
+        goto out;
+    }
+
+    /* Bloom filters have no keys (NULL) and no batch operations */
+    for (__u32 i = 0; i < list->count; i++) {
+        if (bpf_map_update_elem(bpf_map__fd(bloom), NULL, &list->addrs[i], BPF_ANY)) {
+            log_error("Failed to update BPF map %s: %s", bpf_map__name(bloom), strerror(errno));
+            err = -1;
+            goto out;
+        }
+    }
+
+out:
+    free(values);
+    return err;
+}
+
+struct reload_ctx {
+    const char *config_file;
+    struct hhd_v2_bpf *skel;
+    mac_t *macs;
+};
+
+/* Called by the event loop when the configuration file is rewritten */
+static int reload_config(struct event_loop *loop, void *ctx) {
+    struct reload_ctx *reload = ctx;
+
+    log_info("Configuration file %s changed, reloading it", reload->config_file);
+    if (load_maps_config(reload->skel, reload->config_file, reload->macs)) {
+        log_error("Error while reloading map configuration");
+    }
+
+    return 0;
+}
+
 int main(int argc, const char **argv) {
     struct hhd_v2_bpf *skel = NULL;
+    struct event_loop loop = {0};
+    struct reload_ctx reload = {0};
+    struct src_list allow = {0};
+    struct src_list deny = {0};
     int err;
     int threshold = DEFAULT_THRESHOLD;
     const char *config_file = NULL;
@@ -158,6 +362,8 @@ int main(int argc, const char **argv) {
     const char *iface2 = NULL;
     const char *iface3 = NULL;
     const char *iface4 = NULL;
+    const char *allow_file = NULL;
+    const char *deny_file = NULL;
 
     struct argparse_option options[] = {
         OPT_HELP(),
@@ -168,6 +374,8 @@ int main(int argc, const char **argv) {
         OPT_STRING('2', "iface2", &iface2, "2nd interface where to attach the BPF program", NULL, 0, 0),
         OPT_STRING('3', "iface3", &iface2, "3rd interface where to attach the BPF program", NULL, 0, 0),
         OPT_STRING('4', "iface4", &iface2, "4th interface where to attach the BPF program", NULL, 0, 0),
+        OPT_STRING('a', "allow", &allow_file, "File with the source IPs that are never dropped", NULL, 0, 0),
+        OPT_STRING('d', "deny", &deny_file, "File with the source IPs that are always dropped", NULL, 0, 0),
         OPT_END(),
     };
 
@@ -219,6 +427,19 @@ int main(int argc, const char **argv) {
     /* Add iface configuration to hhd_v2.cfg */
     skel->rodata->hhd_v2_cfg.threshold = threshold;
 
+    /* The lists are read before loading the program, to size their maps */
+    err = allow_file ? read_src_list(allow_file, &allow) : 0;
+    if (!err && deny_file)
+        err = read_src_list(deny_file, &deny);
+    if (!err)
+        err = size_src_list(skel->maps.allow_bloom, skel->maps.allow_list, &allow);
+    if (!err)
+        err = size_src_list(skel->maps.deny_bloom, skel->maps.deny_list, &deny);
+    if (err) {
+        log_fatal("Error while reading the allow/deny lists");
+        goto cleanup;
+    }
+
     /* Set program type to XDP */
     bpf_program__set_type(skel->progs.xdp_hhd_v2, BPF_PROG_TYPE_XDP);
 
@@ -228,17 +449,12 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &sigint_handler;
-
-    if (sigaction(SIGINT, &action, NULL) == -1) {
-        log_error("sigation failed");
-        goto cleanup;
-    }
-
-    if (sigaction(SIGTERM, &action, NULL) == -1) {
-        log_error("sigation failed");
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
         goto cleanup;
     }
 
@@ -256,7 +472,13 @@ int main(int argc, const char **argv) {
         goto cleanup;
     }
 
-    free(macs);
+    err = load_src_list(skel->maps.allow_bloom, skel->maps.allow_list, &allow);
+    if (!err)
+        err = load_src_list(skel->maps.deny_bloom, skel->maps.deny_list, &deny);
+    if (err) {
+        log_fatal("Error while loading the allow/deny lists");
+        goto cleanup;
+    }
 
     xdp_flags = 0;
     xdp_flags |= XDP_FLAGS_DRV_MODE;
@@ -269,7 +491,18 @@ int main(int argc, const char **argv) {
 
     log_info("Successfully attached!");
 
-    sleep(10000);
+    /* Reload the configuration when the file changes */
+    reload.config_file = config_file;
+    reload.skel = skel;
+    reload.macs = macs;
+    err = event_loop__watch_file(&loop, config_file, reload_config, &reload);
+    if (err) {
+        log_fatal("Error while watching %s", config_file);
+        goto cleanup;
+    }
+
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
 
 cleanup:
     cleanup_ifaces();
@@ -277,7 +510,10 @@ cleanup:
     if (macs) {
         free(macs);
     }
+    free(allow.addrs);
+    free(deny.addrs);
     hhd_v2_bpf__destroy(skel);
+    event_loop__destroy(&loop);
     log_info("Program stopped correctly");
     return -err;
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#ifndef SKETCH_HASH_BATCH_H_
+#define SKETCH_HASH_BATCH_H_
+
+#include <stddef.h>
+
+#include <immintrin.h>
+
+#include "ebpf/sketch_hash.h"
+
+/* Userspace batch version of sketch_hash()/sketch_hash_v6()/sketch_index() (see
+ * ebpf/sketch_hash.h), producing exactly the same indices as the XDP program.
+ *
+ * The AVX2 path hashes 4 keys at a time. AVX2 has no 64-bit multiply, so it
+ * is emulated with three 32x32->64 multiplies (_mm256_mul_epu32): the high
+ * 32x32 product does not contribute to the low 64 bits of the result. The
+ * AVX2 code is selected at runtime, no special build flags are needed.
+ */
+
+#define FASTHASH_M 0x880355f21e6d1965ULL
+#define FASTHASH_MIX_M 0x2127599bf4325c37ULL
+
+__attribute__((target("avx2"))) static inline __m256i sketch_mul64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2"))) static inline __m256i sketch_mix_avx2(__m256i h) {
+    h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 23));
+    h = sketch_mul64_avx2(h, _mm256_set1_epi64x(FASTHASH_MIX_M));
+    return _mm256_xor_si256(h, _mm256_srli_epi64(h, 47));
+}
+
+__attribute__((target("avx2"))) static size_t
+sketch_hash_batch_avx2(const struct sketch_flow_key *keys, size_t n, __u64 *hashes) {
+    const __m256i m = _mm256_set1_epi64x(FASTHASH_M);
+    const __m256i init =
+        _mm256_set1_epi64x(SKETCH_HASH_SEED ^ (sizeof(struct sketch_flow_key) * FASTHASH_M));
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        /* a = [k0.w0 k0.w1 | k1.w0 k1.w1], b = [k2.w0 k2.w1 | k3.w0 k3.w1] */
+        __m256i a = _mm256_loadu_si256((const __m256i *)&keys[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&keys[i + 2]);
+        /* Unpacking works within 128-bit lanes: keys end up as [k0 k2 | k1 k3] */
+        __m256i w0 = _mm256_unpacklo_epi64(a, b);
+        __m256i w1 = _mm256_unpackhi_epi64(a, b);
+        __m256i h = init;
+
+        h = sketch_mul64_avx2(_mm256_xor_si256(h, sketch_mix_avx2(w0)), m);
+        h = sketch_mul64_avx2(_mm256_xor_si256(h, sketch_mix_avx2(w1)), m);
+        h = sketch_mix_avx2(h);
+
+        /* Back to [k0 k1 | k2 k3] */
+        _mm256_storeu_si256((__m256i *)&hashes[i], _mm256_permute4x64_epi64(h, 0xd8));
+    }
+
+    return i;
+}
+
+/* IPv6 keys are five words and 40 bytes apart: each word of 4 keys is
+ * gathered into one register
+ */
+__attribute__((target("avx2"))) static size_t
+sketch_hash_batch_v6_avx2(const struct sketch_flow_key_v6 *keys, size_t n, __u64 *hashes) {
+    const __m256i m = _mm256_set1_epi64x(FASTHASH_M);
+    const __m256i init =
+        _mm256_set1_epi64x(SKETCH_HASH_SEED ^ (sizeof(struct sketch_flow_key_v6) * FASTHASH_M));
+    /* Offsets of the 4 keys, in words */
+    const __m256i stride = _mm256_setr_epi64x(0, 5, 10, 15);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        const long long *base = (const long long *)&keys[i];
+        __m256i h = init;
+
+        for (int w = 0; w < 5; w++) {
+            __m256i v = _mm256_i64gather_epi64(base + w, stride, 8);
+
+            h = sketch_mul64_avx2(_mm256_xor_si256(h, sketch_mix_avx2(v)), m);
+        }
+        _mm256_storeu_si256((__m256i *)&hashes[i], sketch_mix_avx2(h));
+    }
+
+    return i;
+}
+
+/* Compute sketch_hash() of n keys */
+static inline void sketch_hash_batch(const struct sketch_flow_key *keys, size_t n,
+                                     __u64 *hashes) {
+    size_t i = 0;
+
+    if (__builtin_cpu_supports("avx2"))
+        i = sketch_hash_batch_avx2(keys, n, hashes);
+
+    for (; i < n; i++)
+        hashes[i] = sketch_hash(&keys[i]);
+}
+
+/* Compute sketch_hash_v6() of n keys */
+static inline void sketch_hash_batch_v6(const struct sketch_flow_key_v6 *keys, size_t n,
+                                        __u64 *hashes) {
+    size_t i = 0;
+
+    if (__builtin_cpu_supports("avx2"))
+        i = sketch_hash_batch_v6_avx2(keys, n, hashes);
+
+    for (; i < n; i++)
+        hashes[i] = sketch_hash_v6(&keys[i]);
+}
+
+/* Compute the indices of the first rows of the sketch for n hashes; indices
+ * are stored row by row (indices[row * n + i])
+ */
+static inline void sketch_index_batch(const __u64 *hashes, size_t n, __u32 rows, __u32 entries,
+                                      __u32 *indices) {
+    for (__u32 row = 0; row < rows; row++) {
+        __u32 *out = &indices[(size_t)row * n];
+
+        /* Plain 32-bit arithmetic, auto-vectorized by the compiler */
+        for (size_t i = 0; i < n; i++)
+            out[i] = sketch_index(hashes[i], row, entries);
+    }
+}
+
+#endif // SKETCH_HASH_BATCH_H_
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <bpf/libbpf.h>
+
+#include "log.h"
+
+/* Single-threaded event loop shared by the loaders of the labs.
+ *
+ * Everything the control plane has to react to is a file descriptor
+ * multiplexed by one epoll instance:
+ * - SIGINT/SIGTERM are blocked and received through a signalfd, so that the
+ *   cleanup (e.g., detaching the XDP programs) runs in the normal flow of
+ *   main() and not inside an asynchronous signal handler;
+ * - periodic work (stats, sketch decay, ...) uses timerfds;
+ * - BPF ring buffers are consumed when their epoll fd becomes readable;
+ * - configuration files are watched with inotify.
+ *
+ * Callbacks return 0 to keep the loop running, or a negative value to stop
+ * it (the value is then returned by event_loop_run()).
+ */
+
+#define EVENT_LOOP_MAX_EVENTS 16
+
+struct event_loop;
+
+typedef int (*event_loop_cb)(struct event_loop *loop, void *ctx);
+
+enum event_source_type {
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_SIGNAL,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_RINGBUF,
+    EVENT_SOURCE_FILE,
+};
+
+struct event_source {
+    enum event_source_type type;
+    int fd;
+    event_loop_cb cb;
+    void *ctx;
+    struct ring_buffer *rb;
+    char file_name[NAME_MAX + 1];
+    struct event_source *next;
+};
+
+struct event_loop {
+    int epoll_fd;
+    bool stop;
+    int ret;
+    sigset_t old_mask;
+    struct event_source *sources;
+};
+
+static inline struct event_source *event_loop__add_source(struct event_loop *loop,
+                                                          enum event_source_type type, int fd,
+                                                          event_loop_cb cb, void *ctx) {
+    struct epoll_event ev = {.events = EPOLLIN};
+    struct event_source *src;
+
+    src = calloc(1, sizeof(*src));
+    if (!src)
+        return NULL;
+
+    src->type = type;
+    src->fd = fd;
+    src->cb = cb;
+    src->ctx = ctx;
+    ev.data.ptr = src;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        log_error("Failed to add fd %d to the event loop: %s", fd, strerror(errno));
+        free(src);
+        return NULL;
+    }
+
+    src->next = loop->sources;
+    loop->sources = src;
+    return src;
+}
+
+/* Create the loop; SIGINT and SIGTERM stop it. On failure nothing is left
+ * open and the signal mask is the one of the caller
+ */
+static inline int event_loop__init(struct event_loop *loop) {
+    struct event_source *src;
+    sigset_t mask;
+    int fd, err;
+
+    memset(loop, 0, sizeof(*loop));
+    /* Until the signals are blocked old_mask is the current mask, so that
+     * event_loop__destroy() is harmless after a failed init
+     */
+    sigprocmask(SIG_SETMASK, NULL, &loop->old_mask);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        err = -errno;
+        log_error("Failed to create the epoll instance: %s", strerror(-err));
+        loop->epoll_fd = -1;
+        return err;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, &loop->old_mask)) {
+        err = -errno;
+        log_error("Failed to block signals: %s", strerror(-err));
+        goto err_epoll;
+    }
+
+    fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0) {
+        err = -errno;
+        log_error("Failed to create the signalfd: %s", strerror(-err));
+        goto err_mask;
+    }
+
+    src = event_loop__add_source(loop, EVENT_SOURCE_SIGNAL, fd, NULL, NULL);
+    if (!src) {
+        close(fd);
+        err = -ENOMEM;
+        goto err_mask;
+    }
+
+    return 0;
+
+err_mask:
+    sigprocmask(SIG_SETMASK, &loop->old_mask, NULL);
+err_epoll:
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+    return err;
+}
+
+/* Call cb every time fd is readable */
+static inline int event_loop__add_fd(struct event_loop *loop, int fd, event_loop_cb cb,
+                                     void *ctx) {
+    return event_loop__add_source(loop, EVENT_SOURCE_FD, fd, cb, ctx) ? 0 : -ENOMEM;
+}
+
+/* Call cb every interval_ms milliseconds */
+static inline int event_loop__add_timer(struct event_loop *loop, unsigned int interval_ms,
+                                        event_loop_cb cb, void *ctx) {
+    struct itimerspec its = {
+        .it_interval = {.tv_sec = interval_ms / 1000, .tv_nsec = (interval_ms % 1000) * 1000000L},
+    };
+    int fd;
+
+    its.it_value = its.it_interval;
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) {
+        log_error("Failed to create the timerfd: %s", strerror(errno));
+        return -errno;
+    }
+
+    if (timerfd_settime(fd, 0, &its, NULL)) {
+        log_error("Failed to arm the timerfd: %s", strerror(errno));
+        close(fd);
+        return -errno;
+    }
+
+    if (!event_loop__add_source(loop, EVENT_SOURCE_TIMER, fd, cb, ctx)) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Consume the ring buffer (its own callbacks handle the samples) when data is
+ * available; the ring buffer is still owned, and freed, by the caller.
+ */
+static inline int event_loop__add_ringbuf(struct event_loop *loop, struct ring_buffer *rb) {
+    struct event_source *src;
+
+    src = event_loop__add_source(loop, EVENT_SOURCE_RINGBUF, ring_buffer__epoll_fd(rb), NULL,
+                                 NULL);
+    if (!src)
+        return -ENOMEM;
+
+    src->rb = rb;
+    return 0;
+}
+
+/* Call cb when the file at path is rewritten. The directory is watched, since
+ * most editors replace the file instead of writing it in place.
+ */
+static inline int event_loop__watch_file(struct event_loop *loop, const char *path,
+                                         event_loop_cb cb, void *ctx) {
+    char dir_buf[PATH_MAX], name_buf[PATH_MAX];
+    struct event_source *src;
+    int fd;
+
+    snprintf(dir_buf, sizeof(dir_buf), "%s", path);
+    snprintf(name_buf, sizeof(name_buf), "%s", path);
+
+    fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        log_error("Failed to create the inotify instance: %s", strerror(errno));
+        return -errno;
+    }
+
+    if (inotify_add_watch(fd, dirname(dir_buf), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_error("Failed to watch %s: %s", path, strerror(errno));
+        close(fd);
+        return -errno;
+    }
+
+    src = event_loop__add_source(loop, EVENT_SOURCE_FILE, fd, cb, ctx);
+    if (!src) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    snprintf(src->file_name, sizeof(src->file_name), "%s", basename(name_buf));
+    return 0;
+}
+
+/* Ask the loop to return from event_loop__run() with the given value */
+static inline void event_loop__stop(struct event_loop *loop, int ret) {
+    loop->stop = true;
+    loop->ret = ret;
+}
+
+static inline int event_loop__dispatch(struct event_loop *loop, struct event_source *src) {
+    union {
+        struct signalfd_siginfo si;
+        __u64 expirations;
+        char inotify[sizeof(struct inotify_event) + NAME_MAX + 1];
+    } buf;
+    bool changed = false;
+    ssize_t len;
+
+    switch (src->type) {
+    case EVENT_SOURCE_SIGNAL:
+        if (read(src->fd, &buf.si, sizeof(buf.si)) == sizeof(buf.si)) {
+            log_debug("Received signal %u, closing program...", buf.si.ssi_signo);
+            event_loop__stop(loop, 0);
+        }
+        return 0;
+    case EVENT_SOURCE_TIMER:
+        /* The expirations are not needed, but the fd must be drained */
+        if (read(src->fd, &buf.expirations, sizeof(buf.expirations)) < 0)
+            return 0;
+        return src->cb(loop, src->ctx);
+    case EVENT_SOURCE_RINGBUF:
+        return ring_buffer__consume(src->rb) < 0 ? -EIO : 0;
+    case EVENT_SOURCE_FILE:
+        while ((len = read(src->fd, buf.inotify, sizeof(buf.inotify))) > 0) {
+            for (char *p = buf.inotify; p < buf.inotify + len;) {
+                struct inotify_event *ev = (struct inotify_event *)p;
+
+                if (ev->len && !strcmp(ev->name, src->file_name))
+                    changed = true;
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+        return changed ? src->cb(loop, src->ctx) : 0;
+    case EVENT_SOURCE_FD:
+    default:
+        return src->cb(loop, src->ctx);
+    }
+}
+
+/* Run until a signal is received, a callback fails or event_loop__stop() */
+static inline int event_loop__run(struct event_loop *loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (!loop->stop) {
+        int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("epoll_wait failed: %s", strerror(errno));
+            return -errno;
+        }
+
+        for (int i = 0; i < n && !loop->stop; i++) {
+            int err = event_loop__dispatch(loop, events[i].data.ptr);
+
+            if (err < 0)
+                event_loop__stop(loop, err);
+        }
+    }
+
+    return loop->ret;
+}
+
+static inline void event_loop__destroy(struct event_loop *loop) {
+    struct event_source *src = loop->sources;
+
+    while (src) {
+        struct event_source *next = src->next;
+
+        /* Ring buffer fds belong to libbpf */
+        if (src->type != EVENT_SOURCE_RINGBUF)
+            close(src->fd);
+        free(src);
+        src = next;
+    }
+    loop->sources = NULL;
+
+    if (loop->epoll_fd > 0)
+        close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+
+    sigprocmask(SIG_SETMASK, &loop->old_mask, NULL);
+}
+
+#endif // EVENT_LOOP_H_
@@ -0,0 +1,71 @@
+#ifndef MAP_UTILS_H_
+#define MAP_UTILS_H_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bpf/bpf.h>
+#include <linux/types.h>
+
+#include "log.h"
+
+/* Delete the entries of a map whose key is not among the nkeys keys (of
+ * key_size bytes each) of the configuration, e.g., after a reload of a file
+ * where some entries have been removed. The stale keys are collected first,
+ * since deleting while walking with bpf_map_get_next_key() restarts the walk.
+ */
+static inline int map_prune(int map_fd, const void *keys, __u32 nkeys, size_t key_size) {
+    __u8 *stale = NULL, *key, *next;
+    __u32 nstale = 0, cap = 0;
+    void *prev = NULL;
+    int err = 0;
+
+    key = calloc(2, key_size);
+    if (!key)
+        return -ENOMEM;
+    next = key + key_size;
+
+    while (!bpf_map_get_next_key(map_fd, prev, next)) {
+        __u32 i;
+
+        for (i = 0; i < nkeys; i++) {
+            if (!memcmp((const __u8 *)keys + (size_t)i * key_size, next, key_size))
+                break;
+        }
+
+        if (i == nkeys) {
+            if (nstale == cap) {
+                __u8 *tmp;
+
+                cap = cap ? cap * 2 : 16;
+                tmp = realloc(stale, (size_t)cap * key_size);
+                if (!tmp) {
+                    err = -ENOMEM;
+                    goto cleanup;
+                }
+                stale = tmp;
+            }
+            memcpy(stale + (size_t)nstale++ * key_size, next, key_size);
+        }
+
+        memcpy(key, next, key_size);
+        prev = key;
+    }
+
+    for (__u32 i = 0; i < nstale; i++) {
+        if (bpf_map_delete_elem(map_fd, stale + (size_t)i * key_size) && errno != ENOENT) {
+            err = -errno;
+            log_error("Failed to delete a stale entry of the BPF map: %s", strerror(errno));
+        }
+    }
+    if (nstale)
+        log_info("Deleted %u entries no longer in the configuration", nstale);
+
+cleanup:
+    free(stale);
+    free(key);
+    return err;
+}
+
+#endif // MAP_UTILS_H_
@@ -0,0 +1,65 @@
+#ifndef ENCAP_H_
+#define ENCAP_H_
+
+#include "l4_lb_utils.bpf.h"
+
+/* Outer headers of each backend, indexed as the backends map */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct encap_hdr);
+    __uint(max_entries, MAX_BACKENDS);
+} encap_hdrs SEC(".maps");
+
+/* Encapsulate the IPv4 packet (tot_len bytes) with the precomputed outer
+ * headers of a backend: one bpf_xdp_adjust_head(), then the Ethernet header
+ * is moved in front of the new headers and these are copied from the map.
+ * Only the lengths depend on the packet, and the IP checksum is updated
+ * incrementally for them. The inner packet is not modified, so its checksums
+ * are still valid. With GUE, sport gives the entropy for RSS on the backend;
+ * the UDP checksum is 0 (allowed over IPv4).
+ */
+static __always_inline int encap_push(struct xdp_md *ctx, const struct encap_hdr *hdr,
+                                      __u16 tot_len, int gue, __be16 sport) {
+    int len = sizeof(struct iphdr) + (gue ? sizeof(struct udphdr) : 0);
+    void *data_end, *data;
+    struct ethhdr *eth, *old_eth;
+    struct iphdr *outer;
+    struct udphdr *udp;
+
+    if (bpf_xdp_adjust_head(ctx, -len))
+        return -1;
+
+    /* Pointers are invalidated by bpf_xdp_adjust_head() */
+    data_end = (void *)(long)ctx->data_end;
+    data = (void *)(long)ctx->data;
+    eth = data;
+    old_eth = data + len;
+    outer = (void *)(eth + 1);
+    udp = (void *)(outer + 1);
+
+    if ((void *)(old_eth + 1) > data_end)
+        return -1;
+
+    /* The old header starts at least 20 bytes after the new one, they do
+     * not overlap
+     */
+    __builtin_memcpy(eth, old_eth, sizeof(*eth));
+    __builtin_memcpy(outer, &hdr->ip, sizeof(*outer));
+
+    outer->tot_len = bpf_htons(tot_len + len);
+    csum_replace2(&outer->check, 0, outer->tot_len);
+
+    if (gue) {
+        if ((void *)(udp + 1) > data_end)
+            return -1;
+
+        __builtin_memcpy(udp, &hdr->udp, sizeof(*udp));
+        udp->source = sport;
+        udp->len = bpf_htons(tot_len + sizeof(*udp));
+    }
+
+    return 0;
+}
+
+#endif // ENCAP_H_
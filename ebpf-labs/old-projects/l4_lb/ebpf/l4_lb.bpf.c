@@ -0,0 +1,459 @@
+#include <linux/bpf.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "encap.bpf.h"
+#include "jhash.h"
+#include "l4_lb_utils.bpf.h"
+#include "synproxy.bpf.h"
+
+#define LB_HASH_SEED 0x4c344c42
+
+const volatile struct {
+    __be32 vip;
+    __u16 mss;
+    __u8 synproxy;
+    __u8 mode;
+    __u8 scheduler;
+    __u32 num_backends;
+} l4_lb_cfg = {};
+
+/* Only TCP connections are counted: their end is seen (FIN/RST) */
+static __always_inline void backend_conns_add(__u8 proto, __u32 idx, __s64 delta) {
+    __s64 *conns;
+
+    if (proto != IPPROTO_TCP)
+        return;
+
+    conns = bpf_map_lookup_elem(&backend_conns, &idx);
+    if (conns)
+        __sync_fetch_and_add(conns, delta);
+}
+
+/* Backend with the fewest active connections relative to its weight, i.e.,
+ * the smallest conns / weight (compared as conns_i * weight_j < conns_j *
+ * weight_i). The scan starts from a backend given by the hash of the flow,
+ * so that ties are spread over the backends.
+ */
+static __always_inline __u32 least_conn(__u32 hash) {
+    __u32 num = l4_lb_cfg.num_backends;
+    __u32 best = MAX_BACKENDS;
+    __s64 best_conns = 0;
+    __u32 best_weight = 0;
+
+    if (!num || num > MAX_BACKENDS)
+        return MAX_BACKENDS;
+
+    for (__u32 i = 0; i < MAX_BACKENDS; i++) {
+        struct backend *backend;
+        __u32 idx;
+        __s64 *conns;
+
+        if (i >= num)
+            break;
+
+        idx = (hash + i) % num;
+        backend = bpf_map_lookup_elem(&backends, &idx);
+        conns = bpf_map_lookup_elem(&backend_conns, &idx);
+        if (!backend || !conns || !backend->ip || !backend->weight)
+            continue;
+
+        if (best == MAX_BACKENDS || *conns * best_weight < best_conns * backend->weight) {
+            best = idx;
+            best_conns = *conns;
+            best_weight = backend->weight;
+        }
+    }
+
+    return best;
+}
+
+/* Pick the backend of a new connection, from the Maglev table or with the
+ * least-connections scheduler
+ */
+static __always_inline struct backend *select_backend(struct ct_key *key, __u32 *idx) {
+    __u32 hash = jhash(key, sizeof(*key), LB_HASH_SEED);
+    __u32 slot = hash % MAGLEV_TABLE_SIZE;
+    struct backend *backend;
+    __u32 *backend_idx;
+    __u32 least;
+    __u32 zero = 0;
+    void *table;
+
+    if (l4_lb_cfg.scheduler == LB_SCHED_LEAST_CONN) {
+        least = least_conn(hash);
+        backend_idx = &least;
+    } else {
+        table = bpf_map_lookup_elem(&maglev_tables, &zero);
+        if (!table)
+            return NULL;
+
+        backend_idx = bpf_map_lookup_elem(table, &slot);
+        if (!backend_idx)
+            return NULL;
+    }
+
+    backend = bpf_map_lookup_elem(&backends, backend_idx);
+    if (!backend || !backend->ip)
+        return NULL;
+
+    *idx = *backend_idx;
+    return backend;
+}
+
+/* Key of the entry of the other direction of the connection */
+static __always_inline void ct_reverse_key(const struct ct_key *key, const struct ct_val *ct,
+                                           struct ct_key *rkey) {
+    rkey->saddr = ct->dir == CT_DIR_ORIG ? ct->nat_addr : key->daddr;
+    rkey->daddr = ct->dir == CT_DIR_ORIG ? key->saddr : ct->nat_addr;
+    rkey->sport = key->dport;
+    rkey->dport = key->sport;
+    rkey->proto = key->proto;
+}
+
+/* Create the entries of both directions of a new connection */
+static __always_inline int ct_create(struct ct_key *key, __be32 backend, __u32 idx, __u8 state,
+                                     __u32 cookie) {
+    struct ct_val val = {
+        .nat_addr = backend,
+        .backend = idx,
+        .cookie = cookie,
+        .dir = CT_DIR_ORIG,
+        .state = state,
+    };
+    struct ct_key rkey = {};
+
+    ct_reverse_key(key, &val, &rkey);
+    if (bpf_map_update_elem(&conntrack, key, &val, BPF_ANY))
+        return -1;
+
+    val.nat_addr = key->daddr;
+    val.dir = CT_DIR_REPLY;
+    if (bpf_map_update_elem(&conntrack, &rkey, &val, BPF_ANY)) {
+        bpf_map_delete_elem(&conntrack, key);
+        return -1;
+    }
+
+    backend_conns_add(key->proto, idx, 1);
+    return 0;
+}
+
+static __always_inline void ct_delete(struct ct_key *key, struct ct_val *ct) {
+    struct ct_key rkey = {};
+
+    if (ct->state != CT_CLOSING)
+        backend_conns_add(key->proto, ct->backend, -1);
+
+    ct_reverse_key(key, ct, &rkey);
+    bpf_map_delete_elem(&conntrack, &rkey);
+    bpf_map_delete_elem(&conntrack, key);
+}
+
+/* The connection is ending: it no longer counts for its backend. The entries
+ * are kept, for the last packets of the connection, until LRU evicts them.
+ * orig is the CT_DIR_ORIG entry, the only one whose state changes.
+ */
+static __always_inline void ct_close(struct ct_key *key, struct ct_val *orig, __u8 flags) {
+    if (!(flags & (TCP_FLAG_FIN_BIT | TCP_FLAG_RST_BIT)) || orig->state != CT_ESTABLISHED)
+        return;
+
+    orig->state = CT_CLOSING;
+    backend_conns_add(key->proto, orig->backend, -1);
+}
+
+/* Translate the destination (CT_DIR_ORIG) or the source (CT_DIR_REPLY) address
+ * and forward the packet
+ */
+static __always_inline int nat_forward(struct xdp_md *ctx, struct iphdr *ip, void *l4, __u8 proto,
+                                       __be32 addr, __u8 dir) {
+    __be32 *field = dir == CT_DIR_ORIG ? &ip->daddr : &ip->saddr;
+
+    csum_replace4(&ip->check, *field, addr);
+    l4_csum_replace_addr(l4, proto, *field, addr);
+    *field = addr;
+
+    return lb_forward(ctx, ip->saddr, ip->daddr, bpf_ntohs(ip->tot_len), 0);
+}
+
+/* Packets from the clients to the VIP */
+static __always_inline int lb_orig(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *ip,
+                                   void *l4, __u16 l4_off, struct ct_key *key, struct ct_val *ct,
+                                   struct lb_stats *stats) {
+    struct tcphdr *tcp = key->proto == IPPROTO_TCP ? l4 : NULL;
+    __u8 flags = tcp ? tcp_flags(tcp) : 0;
+    struct backend *backend;
+    __be32 saddr, daddr;
+    __u32 idx;
+
+    /* With the SYN-proxy, or after the end of the previous connection, a new
+     * SYN on a known 5-tuple is a new connection
+     */
+    if (ct && tcp && (l4_lb_cfg.synproxy || ct->state == CT_CLOSING) &&
+        (flags & (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT)) == TCP_FLAG_SYN_BIT) {
+        ct_delete(key, ct);
+        ct = NULL;
+    }
+
+    if (ct) {
+        /* The handshake with the backend is still in progress */
+        if (ct->state == CT_SYN_SENT) {
+            stats->dropped++;
+            return XDP_DROP;
+        }
+
+        if (tcp)
+            ct_close(key, ct, flags);
+
+        if (tcp && ct->seq_delta) {
+            __be32 old = tcp->ack_seq;
+
+            tcp->ack_seq = bpf_htonl(bpf_ntohl(old) + ct->seq_delta);
+            csum_replace4(&tcp->check, old, tcp->ack_seq);
+        }
+
+        return nat_forward(ctx, ip, l4, key->proto, ct->nat_addr, CT_DIR_ORIG);
+    }
+
+    if (tcp && l4_lb_cfg.synproxy) {
+        if ((flags & (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT)) == TCP_FLAG_SYN_BIT) {
+            stats->syncookies_sent++;
+            return synproxy_syn(ctx, eth, ip, tcp, l4_off, l4_lb_cfg.mss);
+        }
+
+        /* Only the ACK of a cookie can create a connection */
+        if ((flags & (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT | TCP_FLAG_RST_BIT)) !=
+                TCP_FLAG_ACK_BIT ||
+            bpf_tcp_raw_check_syncookie_ipv4(ip, tcp)) {
+            stats->syncookies_invalid++;
+            return XDP_DROP;
+        }
+        stats->syncookies_valid++;
+
+        backend = select_backend(key, &idx);
+        if (!backend || ct_create(key, backend->ip, idx, CT_SYN_SENT,
+                                  bpf_ntohl(tcp->ack_seq) - 1)) {
+            stats->dropped++;
+            return XDP_DROP;
+        }
+        stats->new_flows++;
+
+        saddr = ip->saddr;
+        daddr = backend->ip;
+        if (synproxy_ack_to_syn(ctx, eth, ip, tcp, daddr, l4_lb_cfg.mss))
+            return XDP_DROP;
+
+        return lb_forward(ctx, saddr, daddr, 0, 0);
+    }
+
+    backend = select_backend(key, &idx);
+    if (!backend) {
+        stats->dropped++;
+        return XDP_DROP;
+    }
+
+    /* Without state the connection is still forwarded, to the same backend */
+    if (!ct_create(key, backend->ip, idx, CT_ESTABLISHED, 0))
+        stats->new_flows++;
+
+    return nat_forward(ctx, ip, l4, key->proto, backend->ip, CT_DIR_ORIG);
+}
+
+/* Direct Server Return: the packets of the clients reach the backend with
+ * the VIP still as destination, and the backend (which owns the VIP on its
+ * loopback, or decapsulates IPIP/GUE) answers the clients directly. Only the
+ * client -> VIP direction is tracked, to keep existing connections on their
+ * backend.
+ */
+static __always_inline int lb_dsr(struct xdp_md *ctx, struct iphdr *ip, void *l4,
+                                  struct ct_key *key, struct ct_val *ct, struct lb_stats *stats) {
+    struct ct_val val = {.dir = CT_DIR_ORIG, .state = CT_ESTABLISHED};
+    __u16 tot_len = bpf_ntohs(ip->tot_len);
+    int gue = l4_lb_cfg.mode == LB_MODE_DSR_GUE;
+    struct backend *backend;
+    struct encap_hdr *hdr;
+    __be16 sport;
+
+    if (ct && key->proto == IPPROTO_TCP && ct->state == CT_CLOSING &&
+        (tcp_flags(l4) & (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT)) == TCP_FLAG_SYN_BIT)
+        ct = NULL;
+
+    if (ct) {
+        val.nat_addr = ct->nat_addr;
+        val.backend = ct->backend;
+        if (key->proto == IPPROTO_TCP)
+            ct_close(key, ct, tcp_flags(l4));
+    } else {
+        backend = select_backend(key, &val.backend);
+        if (!backend) {
+            stats->dropped++;
+            return XDP_DROP;
+        }
+
+        val.nat_addr = backend->ip;
+        if (!bpf_map_update_elem(&conntrack, key, &val, BPF_ANY)) {
+            backend_conns_add(key->proto, val.backend, 1);
+            stats->new_flows++;
+        }
+    }
+
+    if (l4_lb_cfg.mode == LB_MODE_DSR_L2)
+        return lb_forward(ctx, ip->saddr, val.nat_addr, tot_len, 1);
+
+    hdr = bpf_map_lookup_elem(&encap_hdrs, &val.backend);
+    if (!hdr) {
+        stats->dropped++;
+        return XDP_DROP;
+    }
+
+    /* Source ports of the same flow are the same, in the ephemeral range */
+    sport = bpf_htons(0xc000 | (jhash_2words(key->saddr, key->sport, LB_HASH_SEED) & 0x3fff));
+
+    if (encap_push(ctx, hdr, tot_len, gue, sport)) {
+        stats->dropped++;
+        return XDP_DROP;
+    }
+
+    return lb_forward(ctx, hdr->ip.saddr, hdr->ip.daddr,
+                      tot_len + sizeof(struct iphdr) + (gue ? sizeof(struct udphdr) : 0), 0);
+}
+
+/* Packets from the backends to the clients */
+static __always_inline int lb_reply(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *ip,
+                                    void *l4, struct ct_key *key, struct ct_val *ct,
+                                    struct lb_stats *stats) {
+    struct tcphdr *tcp = key->proto == IPPROTO_TCP ? l4 : NULL;
+    __u8 flags = tcp ? tcp_flags(tcp) : 0;
+
+    if (ct->state == CT_SYN_SENT) {
+        struct ct_key okey = {};
+        struct ct_val *orig;
+
+        if (!tcp)
+            return XDP_DROP;
+
+        if ((flags & (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT)) !=
+            (TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT)) {
+            if (flags & TCP_FLAG_RST_BIT)
+                ct_delete(key, ct);
+            stats->dropped++;
+            return XDP_DROP;
+        }
+
+        /* From now on, sequence numbers of the backend are shifted */
+        ct->seq_delta = bpf_ntohl(tcp->seq) - ct->cookie;
+        ct->state = CT_ESTABLISHED;
+
+        ct_reverse_key(key, ct, &okey);
+        orig = bpf_map_lookup_elem(&conntrack, &okey);
+        if (orig) {
+            orig->seq_delta = ct->seq_delta;
+            orig->state = CT_ESTABLISHED;
+        }
+
+        stats->synproxy_handshakes++;
+        return synproxy_synack_to_ack(ctx, eth, ip, tcp);
+    }
+
+    if (tcp && (flags & (TCP_FLAG_FIN_BIT | TCP_FLAG_RST_BIT))) {
+        struct ct_key okey = {};
+        struct ct_val *orig;
+
+        ct_reverse_key(key, ct, &okey);
+        orig = bpf_map_lookup_elem(&conntrack, &okey);
+        if (orig)
+            ct_close(&okey, orig, flags);
+    }
+
+    if (tcp && ct->seq_delta) {
+        __be32 old = tcp->seq;
+
+        tcp->seq = bpf_htonl(bpf_ntohl(old) - ct->seq_delta);
+        csum_replace4(&tcp->check, old, tcp->seq);
+    }
+
+    return nat_forward(ctx, ip, l4, key->proto, ct->nat_addr, CT_DIR_REPLY);
+}
+
+SEC("xdp")
+int l4_lb(struct xdp_md *ctx) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct lb_stats *stats;
+    struct ct_key key = {};
+    struct ethhdr *eth;
+    struct iphdr *ip;
+    struct tcphdr *tcp;
+    struct udphdr *udp;
+    struct ct_val *ct;
+    __u16 nf_off = 0;
+    __u16 l4_off;
+    __u32 zero = 0;
+    void *l4;
+    int proto;
+
+    stats = bpf_map_lookup_elem(&lb_stats_map, &zero);
+    if (!stats)
+        return XDP_ABORTED;
+
+    /* ARP and everything else is handled by the stack */
+    if (parse_ethhdr(data, data_end, &nf_off, &eth) != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+
+    proto = parse_iphdr(data, data_end, &nf_off, &ip);
+    if (proto < 0)
+        return XDP_PASS;
+
+    /* Fragments cannot be balanced on the 5-tuple */
+    if (ip->frag_off & bpf_htons(IP_MF | IP_OFFSET))
+        return XDP_PASS;
+
+    l4_off = nf_off;
+    if (proto == IPPROTO_TCP) {
+        if (parse_tcphdr(data, data_end, &nf_off, &tcp) < 0)
+            return XDP_PASS;
+        key.sport = tcp->source;
+        key.dport = tcp->dest;
+        l4 = tcp;
+    } else if (proto == IPPROTO_UDP) {
+        if (parse_udphdr(data, data_end, &nf_off, &udp) < 0)
+            return XDP_PASS;
+        key.sport = udp->source;
+        key.dport = udp->dest;
+        l4 = udp;
+    } else {
+        return XDP_PASS;
+    }
+
+    key.saddr = ip->saddr;
+    key.daddr = ip->daddr;
+    key.proto = proto;
+
+    ct = bpf_map_lookup_elem(&conntrack, &key);
+
+    if (ip->daddr == l4_lb_cfg.vip) {
+        stats->packets++;
+        if (l4_lb_cfg.mode != LB_MODE_NAT)
+            return lb_dsr(ctx, ip, l4, &key, ct, stats);
+        return lb_orig(ctx, eth, ip, l4, l4_off, &key, ct, stats);
+    }
+
+    if (ct && ct->dir == CT_DIR_REPLY) {
+        stats->packets++;
+        return lb_reply(ctx, eth, ip, l4, &key, ct, stats);
+    }
+
+    return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
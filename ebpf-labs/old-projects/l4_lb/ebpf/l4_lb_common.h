@@ -0,0 +1,100 @@
+#pragma once
+
+#include <linux/ip.h>
+#include <linux/types.h>
+#include <linux/udp.h>
+
+/* Definitions shared by the XDP program and the loader */
+
+#define MAX_BACKENDS 256
+/* Size of the Maglev table: a prime, much larger than the number of backends */
+#define MAGLEV_TABLE_SIZE 65537
+#define CT_MAX_ENTRIES 65536
+
+enum lb_mode {
+    /* Both directions go through the load balancer, which translates the VIP */
+    LB_MODE_NAT,
+    /* Direct Server Return: packets keep the VIP as destination, replies go
+     * from the backends straight to the clients. With L2 only the destination
+     * MAC is rewritten (backends on the same link), with IPIP the packet is
+     * encapsulated towards the backend.
+     */
+    LB_MODE_DSR_L2,
+    LB_MODE_DSR_IPIP,
+    /* As IPIP, over UDP (GUE variant 1: the inner packet follows the UDP
+     * header), so that the NICs of the backends spread the flows over their
+     * queues
+     */
+    LB_MODE_DSR_GUE,
+};
+
+enum lb_scheduler {
+    /* Consistent hashing of the 5-tuple, slots proportional to the weights */
+    LB_SCHED_MAGLEV,
+    /* Fewest active TCP connections relative to the weight */
+    LB_SCHED_LEAST_CONN,
+};
+
+struct backend {
+    __be32 ip;
+    /* 0 when the backend is down: no new flows */
+    __u32 weight;
+};
+
+/* Outer headers of the packets sent to a backend (DSR with encapsulation),
+ * built by the loader with tot_len and the UDP length set to 0 and the IP
+ * checksum computed on them: the XDP program only copies them and adds the
+ * lengths. The UDP header is only used by LB_MODE_DSR_GUE.
+ */
+struct encap_hdr {
+    struct iphdr ip;
+    struct udphdr udp;
+};
+
+struct ct_key {
+    __be32 saddr;
+    __be32 daddr;
+    __be16 sport;
+    __be16 dport;
+    __u8 proto;
+    __u8 pad[3];
+};
+
+enum ct_dir {
+    /* client -> VIP, daddr is translated to the backend */
+    CT_DIR_ORIG,
+    /* backend -> client, saddr is translated to the VIP */
+    CT_DIR_REPLY,
+};
+
+enum ct_state {
+    CT_ESTABLISHED,
+    /* SYN-proxy: the SYN has been sent to the backend, waiting for its SYN-ACK */
+    CT_SYN_SENT,
+    /* FIN or RST seen: no longer counted as an active connection */
+    CT_CLOSING,
+};
+
+struct ct_val {
+    /* New daddr (CT_DIR_ORIG) or saddr (CT_DIR_REPLY) */
+    __be32 nat_addr;
+    __u32 backend;
+    /* SYN-proxy: ISN sent to the client (the cookie) and difference between
+     * the ISN of the backend and the cookie, applied to every packet
+     */
+    __u32 cookie;
+    __u32 seq_delta;
+    __u8 dir;
+    __u8 state;
+    __u8 pad[2];
+};
+
+struct lb_stats {
+    __u64 packets;
+    __u64 new_flows;
+    __u64 syncookies_sent;
+    __u64 syncookies_valid;
+    __u64 syncookies_invalid;
+    __u64 synproxy_handshakes;
+    __u64 dropped;
+};
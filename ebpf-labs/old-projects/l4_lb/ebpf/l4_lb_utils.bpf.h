@@ -0,0 +1,263 @@
+#ifndef L4_LB_UTILS_H_
+#define L4_LB_UTILS_H_
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "l4_lb_common.h"
+
+#ifndef AF_INET
+#define AF_INET 2
+#endif
+
+#define IP_MF 0x2000
+#define IP_OFFSET 0x1fff
+
+#define TCP_FLAG_FIN_BIT 0x01
+#define TCP_FLAG_SYN_BIT 0x02
+#define TCP_FLAG_RST_BIT 0x04
+#define TCP_FLAG_ACK_BIT 0x10
+
+/* Table of the backends, indexed by the entries of the Maglev table */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct backend);
+    __uint(max_entries, MAX_BACKENDS);
+} backends SEC(".maps");
+
+/* Active connections of each backend, for the least-connections scheduler */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, __s64);
+    __uint(max_entries, MAX_BACKENDS);
+} backend_conns SEC(".maps");
+
+/* Maglev lookup table, built by the loader: the hash of the 5-tuple selects
+ * a slot, which holds the index of the backend. The table is the only inner
+ * map of maglev_tables: when the set of healthy backends changes, the loader
+ * fills a new table and replaces the old one with a single update, so the
+ * program never sees a half-written table.
+ */
+struct maglev_table {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, MAGLEV_TABLE_SIZE);
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct maglev_table);
+} maglev_tables SEC(".maps");
+
+/* Connection tracking: every connection has an entry for each direction, so
+ * that the replies of the backend can be translated back to the VIP. LRU
+ * keeps the memory bounded, evicted connections that are still active pick
+ * the same backend again as long as the Maglev table does not change.
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct ct_key);
+    __type(value, struct ct_val);
+    __uint(max_entries, CT_MAX_ENTRIES);
+} conntrack SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct lb_stats);
+    __uint(max_entries, 1);
+} lb_stats_map SEC(".maps");
+
+static __always_inline int parse_ethhdr(void *data, void *data_end, __u16 *nh_off,
+                                        struct ethhdr **ethhdr) {
+    struct ethhdr *eth = (struct ethhdr *)data;
+    int hdr_size = sizeof(*eth);
+
+    /* Byte-count bounds check; check if current pointer + size of header
+     * is after data_end.
+     */
+    if ((void *)eth + hdr_size > data_end)
+        return -1;
+
+    *nh_off += hdr_size;
+    *ethhdr = eth;
+
+    return eth->h_proto; /* network-byte-order */
+}
+
+static __always_inline int parse_iphdr(void *data, void *data_end, __u16 *nh_off,
+                                       struct iphdr **iphdr) {
+    struct iphdr *ip = (struct iphdr *)(data + *nh_off);
+    int hdr_size;
+
+    if ((void *)ip + sizeof(*ip) > data_end)
+        return -1;
+
+    hdr_size = ip->ihl * 4;
+
+    /* Sanity check packet field is valid */
+    if (hdr_size < sizeof(*ip))
+        return -1;
+
+    /* Variable-length IPv4 header, need to use byte-based arithmetic */
+    if ((void *)ip + hdr_size > data_end)
+        return -1;
+
+    *nh_off += hdr_size;
+    *iphdr = ip;
+
+    return ip->protocol;
+}
+
+static __always_inline int parse_tcphdr(void *data, void *data_end, __u16 *nh_off,
+                                        struct tcphdr **tcphdr) {
+    struct tcphdr *tcp = (struct tcphdr *)(data + *nh_off);
+    int len;
+
+    if ((void *)tcp + sizeof(*tcp) > data_end)
+        return -1;
+
+    len = tcp->doff * 4;
+    if (len < sizeof(*tcp))
+        return -1;
+
+    if ((void *)tcp + len > data_end)
+        return -1;
+
+    *nh_off += len;
+    *tcphdr = tcp;
+
+    return len;
+}
+
+static __always_inline int parse_udphdr(void *data, void *data_end, __u16 *nh_off,
+                                        struct udphdr **udphdr) {
+    struct udphdr *udp = (struct udphdr *)(data + *nh_off);
+
+    if ((void *)udp + sizeof(*udp) > data_end)
+        return -1;
+
+    *nh_off += sizeof(*udp);
+    *udphdr = udp;
+
+    return sizeof(*udp);
+}
+
+static __always_inline __u8 tcp_flags(const struct tcphdr *tcp) {
+    return ((const __u8 *)tcp)[13];
+}
+
+static __always_inline __u16 csum_fold(__u32 csum) {
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+/* Incremental checksum update (RFC 1624, eqn. 3) after replacing a 32-bit or
+ * a 16-bit field of the packet. The one's complement sum does not depend on
+ * the byte order, so fields are used as they are in the packet.
+ */
+static __always_inline void csum_replace4(__sum16 *sum, __be32 from, __be32 to) {
+    __u32 csum = (__u16)~*sum;
+
+    csum += (__u16)~from + (__u16)~(from >> 16) + (__u16)to + (__u16)(to >> 16);
+    *sum = csum_fold(csum);
+}
+
+static __always_inline void csum_replace2(__sum16 *sum, __be16 from, __be16 to) {
+    __u32 csum = (__u16)~*sum;
+
+    csum += (__u16)~from + (__u16)to;
+    *sum = csum_fold(csum);
+}
+
+/* Sum of n 16-bit words, n must be a constant */
+static __always_inline __u32 csum_words(const void *p, int n) {
+    const __u16 *w = p;
+    __u32 csum = 0;
+
+#pragma unroll
+    for (int i = 0; i < n; i++)
+        csum += w[i];
+
+    return csum;
+}
+
+static __always_inline __u16 ipv4_csum(struct iphdr *ip) {
+    ip->check = 0;
+    return csum_fold(csum_words(ip, sizeof(*ip) / 2));
+}
+
+/* Update the L4 checksum after changing one of the addresses: the pseudo
+ * header covers them. UDP packets without checksum are left alone.
+ */
+static __always_inline void l4_csum_replace_addr(void *l4, __u8 proto, __be32 from, __be32 to) {
+    if (proto == IPPROTO_TCP) {
+        csum_replace4(&((struct tcphdr *)l4)->check, from, to);
+    } else {
+        struct udphdr *udp = l4;
+
+        if (!udp->check)
+            return;
+        csum_replace4(&udp->check, from, to);
+        if (!udp->check)
+            udp->check = 0xffff;
+    }
+}
+
+/* Send the packet to daddr through the routing table of the host: MAC
+ * addresses are filled from the neighbour table, packets whose next hop is
+ * not resolved yet go to the stack, which resolves it. With direct, daddr
+ * must be on a connected subnet: only the MAC addresses are rewritten, so the
+ * packet cannot go through a gateway.
+ */
+static __always_inline int lb_forward(struct xdp_md *ctx, __be32 saddr, __be32 daddr,
+                                      __u16 tot_len, int direct) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct bpf_fib_lookup fib = {};
+    struct ethhdr *eth = data;
+    int rc;
+
+    if ((void *)(eth + 1) > data_end)
+        return XDP_DROP;
+
+    fib.family = AF_INET;
+    fib.l4_protocol = 0;
+    fib.tot_len = tot_len;
+    fib.ipv4_src = saddr;
+    fib.ipv4_dst = daddr;
+    fib.ifindex = ctx->ingress_ifindex;
+
+    rc = bpf_fib_lookup(ctx, &fib, sizeof(fib), 0);
+    switch (rc) {
+    case BPF_FIB_LKUP_RET_SUCCESS:
+        /* On success ipv4_dst is replaced with the gateway, if any */
+        if (direct && fib.ipv4_dst != daddr)
+            return XDP_DROP;
+        __builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+        __builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+        if (fib.ifindex == ctx->ingress_ifindex)
+            return XDP_TX;
+        return bpf_redirect(fib.ifindex, 0);
+    case BPF_FIB_LKUP_RET_NO_NEIGH:
+        return XDP_PASS;
+    default:
+        return XDP_DROP;
+    }
+}
+
+#endif // L4_LB_UTILS_H_
@@ -0,0 +1,223 @@
+#ifndef SYNPROXY_H_
+#define SYNPROXY_H_
+
+#include "l4_lb_utils.bpf.h"
+
+/* SYN-proxy with SYN cookies (Linux 6.0+).
+ *
+ * The load balancer answers the SYNs for the VIP by itself, with a SYN-ACK
+ * whose sequence number is a SYN cookie (bpf_tcp_raw_gen_syncookie_ipv4()),
+ * and keeps no state. Only when the client completes the handshake with a
+ * valid cookie (bpf_tcp_raw_check_syncookie_ipv4()) a backend is selected:
+ * the ACK of the client is turned into the SYN for the backend, and the
+ * SYN-ACK of the backend into the ACK that completes the handshake with it.
+ * From then on, the sequence numbers of the backend are shifted by seq_delta
+ * (its ISN minus the cookie) in both directions. A SYN flood costs one
+ * XDP_TX per SYN and no memory.
+ *
+ * The cookie only encodes the MSS, so window scaling, SACK and timestamps are
+ * not negotiated on either side. Data sent by the client with (or right
+ * after) its ACK is dropped while the handshake with the backend is in
+ * progress, and is retransmitted by the client.
+ */
+
+#define SYNPROXY_WINDOW 65535
+#define TCP_MAX_HDR_LEN 60
+
+#ifndef IP_DF
+#define IP_DF 0x4000
+#endif
+
+#ifndef TCPOPT_MSS
+#define TCPOPT_MSS 2
+#endif
+
+struct tcp_mss_opt {
+    __u8 kind;
+    __u8 len;
+    __be16 mss;
+};
+
+/* Segment without payload generated by the proxy */
+struct synproxy_pkt {
+    __u8 smac[ETH_ALEN];
+    __u8 dmac[ETH_ALEN];
+    __be32 saddr;
+    __be32 daddr;
+    __be16 sport;
+    __be16 dport;
+    __u32 seq;
+    __u32 ack_seq;
+    __u16 window;
+    __u16 mss; /* 0: no MSS option */
+    __u8 flags;
+};
+
+/* Replace the whole packet with the segment described by p. If the tail of
+ * the packet cannot grow (e.g., to add the MSS option to a bare ACK), the
+ * segment is built without the option.
+ */
+static __always_inline int synproxy_build(struct xdp_md *ctx, struct synproxy_pkt *p) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    int len = sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct tcphdr);
+    __u16 tcp_len = sizeof(struct tcphdr);
+    struct tcp_mss_opt *opt;
+    struct ethhdr *eth;
+    struct iphdr *ip;
+    struct tcphdr *tcp;
+    __u32 csum;
+
+    if (p->mss &&
+        !bpf_xdp_adjust_tail(ctx, len + (int)sizeof(*opt) - (int)(data_end - data))) {
+        tcp_len += sizeof(*opt);
+    } else {
+        p->mss = 0;
+        if (bpf_xdp_adjust_tail(ctx, len - (int)(data_end - data)))
+            return -1;
+    }
+
+    /* Pointers are invalidated by bpf_xdp_adjust_tail() */
+    data_end = (void *)(long)ctx->data_end;
+    data = (void *)(long)ctx->data;
+    eth = data;
+    ip = (void *)(eth + 1);
+    tcp = (void *)(ip + 1);
+
+    if ((void *)(tcp + 1) > data_end)
+        return -1;
+
+    __builtin_memcpy(eth->h_source, p->smac, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, p->dmac, ETH_ALEN);
+    eth->h_proto = bpf_htons(ETH_P_IP);
+
+    *(__u8 *)ip = 0x45; /* version 4, no options */
+    ip->tos = 0;
+    ip->tot_len = bpf_htons(sizeof(*ip) + tcp_len);
+    ip->id = 0;
+    ip->frag_off = bpf_htons(IP_DF);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = p->saddr;
+    ip->daddr = p->daddr;
+    ip->check = ipv4_csum(ip);
+
+    tcp->source = p->sport;
+    tcp->dest = p->dport;
+    tcp->seq = bpf_htonl(p->seq);
+    tcp->ack_seq = bpf_htonl(p->ack_seq);
+    /* Data offset and flags */
+    ((__be16 *)tcp)[6] = bpf_htons((tcp_len / 4) << 12 | p->flags);
+    tcp->window = bpf_htons(p->window);
+    tcp->check = 0;
+    tcp->urg_ptr = 0;
+
+    /* Pseudo header + TCP header */
+    csum = (__u16)p->saddr + (__u16)(p->saddr >> 16) + (__u16)p->daddr +
+           (__u16)(p->daddr >> 16) + bpf_htons(IPPROTO_TCP) + bpf_htons(tcp_len);
+    csum += csum_words(tcp, sizeof(*tcp) / 2);
+
+    if (p->mss) {
+        opt = (void *)(tcp + 1);
+        if ((void *)(opt + 1) > data_end)
+            return -1;
+
+        opt->kind = TCPOPT_MSS;
+        opt->len = sizeof(*opt);
+        opt->mss = bpf_htons(p->mss);
+        csum += csum_words(opt, sizeof(*opt) / 2);
+    }
+
+    tcp->check = csum_fold(csum);
+    return 0;
+}
+
+/* Answer a SYN with a SYN-ACK carrying the cookie, sent back with XDP_TX */
+static __always_inline int synproxy_syn(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *ip,
+                                        struct tcphdr *tcp, __u16 tcp_off, __u16 mss) {
+    __u8 tcp_buf[TCP_MAX_HDR_LEN] = {};
+    struct synproxy_pkt p = {};
+    __u32 tcp_len = tcp->doff * 4;
+    __s64 cookie;
+
+    if (tcp_len < sizeof(*tcp) || tcp_len > sizeof(tcp_buf))
+        return XDP_DROP;
+
+    /* The cookie encodes the MSS option of the SYN: copy the whole header on
+     * the stack, so that its variable size is bounded for the verifier
+     */
+    if (bpf_xdp_load_bytes(ctx, tcp_off, tcp_buf, tcp_len))
+        return XDP_DROP;
+
+    cookie = bpf_tcp_raw_gen_syncookie_ipv4(ip, (struct tcphdr *)tcp_buf, tcp_len);
+    if (cookie < 0)
+        return XDP_DROP;
+
+    __builtin_memcpy(p.smac, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(p.dmac, eth->h_source, ETH_ALEN);
+    p.saddr = ip->daddr;
+    p.daddr = ip->saddr;
+    p.sport = tcp->dest;
+    p.dport = tcp->source;
+    p.seq = (__u32)cookie;
+    p.ack_seq = bpf_ntohl(tcp->seq) + 1;
+    p.flags = TCP_FLAG_SYN_BIT | TCP_FLAG_ACK_BIT;
+    p.window = SYNPROXY_WINDOW;
+    p.mss = mss;
+
+    if (synproxy_build(ctx, &p))
+        return XDP_DROP;
+
+    return XDP_TX;
+}
+
+/* Turn the ACK that completes the handshake with the client into the SYN for
+ * the backend, the caller forwards it
+ */
+static __always_inline int synproxy_ack_to_syn(struct xdp_md *ctx, struct ethhdr *eth,
+                                               struct iphdr *ip, struct tcphdr *tcp,
+                                               __be32 backend, __u16 mss) {
+    struct synproxy_pkt p = {};
+
+    /* MAC addresses are set when forwarding */
+    __builtin_memcpy(p.smac, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(p.dmac, eth->h_dest, ETH_ALEN);
+    p.saddr = ip->saddr;
+    p.daddr = backend;
+    p.sport = tcp->source;
+    p.dport = tcp->dest;
+    /* Same ISN of the client */
+    p.seq = bpf_ntohl(tcp->seq) - 1;
+    p.ack_seq = 0;
+    p.flags = TCP_FLAG_SYN_BIT;
+    p.window = bpf_ntohs(tcp->window);
+    p.mss = mss;
+
+    return synproxy_build(ctx, &p);
+}
+
+/* Turn the SYN-ACK of the backend into the ACK that completes the handshake
+ * with it, sent back with XDP_TX
+ */
+static __always_inline int synproxy_synack_to_ack(struct xdp_md *ctx, struct ethhdr *eth,
+                                                  struct iphdr *ip, struct tcphdr *tcp) {
+    struct synproxy_pkt p = {};
+
+    __builtin_memcpy(p.smac, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(p.dmac, eth->h_source, ETH_ALEN);
+    p.saddr = ip->daddr;
+    p.daddr = ip->saddr;
+    p.sport = tcp->dest;
+    p.dport = tcp->source;
+    p.seq = bpf_ntohl(tcp->ack_seq);
+    p.ack_seq = bpf_ntohl(tcp->seq) + 1;
+    p.flags = TCP_FLAG_ACK_BIT;
+    p.window = SYNPROXY_WINDOW;
+
+    if (synproxy_build(ctx, &p))
+        return XDP_DROP;
+
+    return XDP_TX;
+}
+
+#endif // SYNPROXY_H_
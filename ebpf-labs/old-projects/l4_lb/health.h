@@ -0,0 +1,275 @@
+#ifndef HEALTH_H_
+#define HEALTH_H_
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "log.h"
+
+/* Asynchronous health checks of the backends.
+ *
+ * Every interval, each backend gets a probe: a non-blocking TCP connect() to
+ * its port and, for HTTP checks, a GET of the configured path that must be
+ * answered with a 2xx status. The sockets of the probes live in a private
+ * epoll instance, which is itself a single fd of the event loop of the
+ * loader, so hundreds of probes run in parallel in the same thread. A probe
+ * still in progress at the next interval has timed out.
+ *
+ * A backend goes down after `fall` consecutive failures and back up after
+ * `rise` consecutive successes; all the backends start up. When the state of
+ * at least one backend changes, on_change is called once, after all the
+ * events of the round have been handled.
+ */
+
+#define HEALTH_MAX_EVENTS 64
+#define HEALTH_RESP_LEN 16
+
+enum health_type {
+    HEALTH_NONE,
+    HEALTH_TCP,
+    HEALTH_HTTP,
+};
+
+struct health_checker;
+
+typedef void (*health_change_cb)(struct health_checker *hc, void *ctx);
+
+struct health_target {
+    struct sockaddr_in addr;
+    /* Socket of the probe in progress, -1 if none */
+    int fd;
+    bool up;
+    /* Consecutive results that disagree with up */
+    __u32 streak;
+    bool request_sent;
+    size_t resp_len;
+    char resp[HEALTH_RESP_LEN];
+};
+
+struct health_checker {
+    int epoll_fd;
+    /* The epoll fd is closed by the event loop once added to it */
+    bool epoll_owned;
+    enum health_type type;
+    char request[256];
+    __u32 rise;
+    __u32 fall;
+    struct health_target *targets;
+    __u32 count;
+    bool changed;
+    health_change_cb on_change;
+    void *ctx;
+};
+
+static int health__init(struct health_checker *hc, enum health_type type, const __be32 *ips,
+                        __u32 count, __u16 port, const char *path, __u32 rise, __u32 fall,
+                        health_change_cb on_change, void *ctx) {
+    memset(hc, 0, sizeof(*hc));
+    hc->type = type;
+    hc->rise = rise ? rise : 1;
+    hc->fall = fall ? fall : 1;
+    hc->on_change = on_change;
+    hc->ctx = ctx;
+
+    /* HTTP/1.0, so that the backend closes the connection after answering */
+    snprintf(hc->request, sizeof(hc->request), "GET %s HTTP/1.0\r\nUser-Agent: l4_lb\r\n\r\n",
+             path ? path : "/");
+
+    hc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (hc->epoll_fd < 0) {
+        log_error("Failed to create the epoll instance: %s", strerror(errno));
+        return -errno;
+    }
+
+    hc->targets = calloc(count, sizeof(*hc->targets));
+    if (!hc->targets) {
+        log_error("Cannot allocate the health check targets");
+        return -ENOMEM;
+    }
+    hc->count = count;
+
+    for (__u32 i = 0; i < count; i++) {
+        hc->targets[i].addr.sin_family = AF_INET;
+        hc->targets[i].addr.sin_addr.s_addr = ips[i];
+        hc->targets[i].addr.sin_port = htons(port);
+        hc->targets[i].fd = -1;
+        hc->targets[i].up = true;
+    }
+
+    return 0;
+}
+
+static void health__probe_done(struct health_checker *hc, struct health_target *t, bool ok) {
+    char addr[INET_ADDRSTRLEN];
+
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+
+    if (ok == t->up) {
+        t->streak = 0;
+        return;
+    }
+
+    if (++t->streak < (ok ? hc->rise : hc->fall))
+        return;
+
+    t->up = ok;
+    t->streak = 0;
+    hc->changed = true;
+
+    inet_ntop(AF_INET, &t->addr.sin_addr, addr, sizeof(addr));
+    if (ok)
+        log_info("Backend %s is up", addr);
+    else
+        log_warn("Backend %s is down", addr);
+}
+
+static void health__probe_start(struct health_checker *hc, struct health_target *t) {
+    /* Reset instead of FIN, so that probes do not leave TIME_WAIT sockets */
+    struct linger linger = {.l_onoff = 1, .l_linger = 0};
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = t};
+
+    t->request_sent = false;
+    t->resp_len = 0;
+
+    t->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (t->fd < 0) {
+        log_error("Failed to create the socket of a probe: %s", strerror(errno));
+        return;
+    }
+    setsockopt(t->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+    if (connect(t->fd, (struct sockaddr *)&t->addr, sizeof(t->addr)) && errno != EINPROGRESS) {
+        health__probe_done(hc, t, false);
+        return;
+    }
+
+    if (epoll_ctl(hc->epoll_fd, EPOLL_CTL_ADD, t->fd, &ev)) {
+        log_error("Failed to add a probe to the epoll instance: %s", strerror(errno));
+        close(t->fd);
+        t->fd = -1;
+    }
+}
+
+static void health__notify(struct health_checker *hc) {
+    if (hc->changed && hc->on_change)
+        hc->on_change(hc, hc->ctx);
+    hc->changed = false;
+}
+
+/* The socket of a probe is writable (connected or failed) or readable */
+static void health__probe_event(struct health_checker *hc, struct health_target *t) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = t};
+    socklen_t len = sizeof(int);
+    ssize_t n;
+    int err;
+
+    if (!t->request_sent) {
+        if (getsockopt(t->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            health__probe_done(hc, t, false);
+            return;
+        }
+
+        if (hc->type == HEALTH_TCP) {
+            health__probe_done(hc, t, true);
+            return;
+        }
+
+        n = send(t->fd, hc->request, strlen(hc->request), MSG_NOSIGNAL);
+        if (n != strlen(hc->request) || epoll_ctl(hc->epoll_fd, EPOLL_CTL_MOD, t->fd, &ev)) {
+            health__probe_done(hc, t, false);
+            return;
+        }
+        t->request_sent = true;
+        return;
+    }
+
+    /* Only the status line is needed: "HTTP/1.x 2xx" */
+    n = recv(t->fd, t->resp + t->resp_len, sizeof(t->resp) - t->resp_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0) {
+        health__probe_done(hc, t, false);
+        return;
+    }
+
+    t->resp_len += n;
+    if (t->resp_len < 10)
+        return;
+
+    health__probe_done(hc, t, !strncmp(t->resp, "HTTP/1.", 7) && t->resp[9] == '2');
+}
+
+/* Called by the event loop when the epoll instance of the probes is readable */
+static int health__dispatch(struct event_loop *loop, void *ctx) {
+    struct epoll_event events[HEALTH_MAX_EVENTS];
+    struct health_checker *hc = ctx;
+    int n;
+
+    n = epoll_wait(hc->epoll_fd, events, HEALTH_MAX_EVENTS, 0);
+    for (int i = 0; i < n; i++) {
+        struct health_target *t = events[i].data.ptr;
+
+        /* The probe may have been closed by an earlier event of this round */
+        if (t->fd >= 0)
+            health__probe_event(hc, t);
+    }
+
+    health__notify(hc);
+    return 0;
+}
+
+/* Called by the event loop every interval: time out the probes still in
+ * progress and start new ones
+ */
+static int health__tick(struct event_loop *loop, void *ctx) {
+    struct health_checker *hc = ctx;
+
+    for (__u32 i = 0; i < hc->count; i++) {
+        if (hc->targets[i].fd >= 0)
+            health__probe_done(hc, &hc->targets[i], false);
+        health__probe_start(hc, &hc->targets[i]);
+    }
+
+    health__notify(hc);
+    return 0;
+}
+
+static int health__attach(struct health_checker *hc, struct event_loop *loop,
+                          unsigned int interval_ms) {
+    int err;
+
+    err = event_loop__add_fd(loop, hc->epoll_fd, health__dispatch, hc);
+    if (err)
+        return err;
+    hc->epoll_owned = true;
+
+    return event_loop__add_timer(loop, interval_ms, health__tick, hc);
+}
+
+static void health__destroy(struct health_checker *hc) {
+    for (__u32 i = 0; i < hc->count; i++) {
+        if (hc->targets[i].fd >= 0)
+            close(hc->targets[i].fd);
+    }
+    free(hc->targets);
+    hc->targets = NULL;
+    hc->count = 0;
+
+    if (!hc->epoll_owned && hc->epoll_fd > 0)
+        close(hc->epoll_fd);
+    hc->epoll_fd = -1;
+}
+
+#endif // HEALTH_H_
@@ -0,0 +1,719 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <assert.h>
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_link.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <argparse.h>
+#include <net/if.h>
+
+#include "event_loop.h"
+#include "health.h"
+#include "l4_lb.h"
+#include "log.h"
+#include "maglev.h"
+
+#define DEFAULT_MSS 1460
+#define STATS_INTERVAL_MS 1000
+
+static int ifindex_iface1 = 0;
+static int ifindex_iface2 = 0;
+static __u32 xdp_flags = 0;
+
+static const char *const usages[] = {
+    "l4_lb [options] [[--] args]",
+    "l4_lb [options]",
+    NULL,
+};
+
+static void cleanup_ifaces() {
+    __u32 curr_prog_id = 0;
+
+    if (ifindex_iface1 != 0) {
+        if (!bpf_xdp_query_id(ifindex_iface1, xdp_flags, &curr_prog_id)) {
+            if (curr_prog_id) {
+                bpf_xdp_detach(ifindex_iface1, xdp_flags, NULL);
+                log_trace("Detached XDP program from interface %d", ifindex_iface1);
+            }
+        }
+    }
+
+    if (ifindex_iface2 != 0) {
+        if (!bpf_xdp_query_id(ifindex_iface2, xdp_flags, &curr_prog_id)) {
+            if (curr_prog_id) {
+                bpf_xdp_detach(ifindex_iface2, xdp_flags, NULL);
+                log_trace("Detached XDP program from interface %d", ifindex_iface2);
+            }
+        }
+    }
+}
+
+static int get_iface_ifindex(const char *iface, int *ifindex) {
+    if (iface == NULL) {
+        log_error("Error, you must specify the interfaces where to attach the XDP program");
+        return -1;
+    }
+
+    log_info("XDP program will be attached to %s interface", iface);
+    *ifindex = if_nametoindex(iface);
+    if (!*ifindex) {
+        log_fatal("Error while retrieving the ifindex of %s", iface);
+        return -1;
+    }
+
+    log_info("Got ifindex for iface: %s, which is %d", iface, *ifindex);
+    return 0;
+}
+
+static int parse_config(const char *config_file, struct lb_config **cfg, __be32 *vip) {
+    cyaml_err_t err;
+
+    err = cyaml_load_file(config_file, &config, &lb_config_schema, (void **)cfg, NULL);
+    if (err != CYAML_OK) {
+        log_error("Failed to parse %s: %s", config_file, cyaml_strerror(err));
+        return -1;
+    }
+
+    if (inet_pton(AF_INET, (*cfg)->vip, vip) != 1) {
+        log_error("Invalid VIP %s", (*cfg)->vip);
+        return -1;
+    }
+
+    if (!(*cfg)->gue_port)
+        (*cfg)->gue_port = DEFAULT_GUE_PORT;
+
+    return 0;
+}
+
+struct lb_backends {
+    struct l4_lb_bpf *skel;
+    enum lb_scheduler scheduler;
+    __be32 ips[MAX_BACKENDS];
+    __u32 weights[MAX_BACKENDS];
+    bool up[MAX_BACKENDS];
+    __u32 count;
+    /* Maglev table used by the XDP program, and a copy of its slots */
+    int table_fd;
+    __u32 *table;
+};
+
+static __u32 backend_weight(const struct backend_config *backend) {
+    return backend->weight ? *backend->weight : DEFAULT_WEIGHT;
+}
+
+/* Read the backends of the configuration; their indexes never change, so
+ * conntrack entries keep pointing to the same backend
+ */
+static int parse_backends(const struct lb_config *cfg, struct lb_backends *b) {
+    b->count = cfg->backends_count;
+
+    for (__u32 i = 0; i < cfg->backends_count; i++) {
+        if (inet_pton(AF_INET, cfg->backends[i].ip, &b->ips[i]) != 1) {
+            log_error("Invalid backend IP %s", cfg->backends[i].ip);
+            return -1;
+        }
+
+        b->weights[i] = backend_weight(&cfg->backends[i]);
+        b->up[i] = true;
+        log_info("Backend %u: %s, weight %u", i, cfg->backends[i].ip, b->weights[i]);
+    }
+
+    return 0;
+}
+
+/* Write the slots that differ from the current table in place: each slot is
+ * updated atomically, and both the old and the new backend of a slot are
+ * valid choices, so the table does not need to be swapped
+ */
+static int update_maglev_slots(struct lb_backends *b, const __u32 *table) {
+    __u32 *keys, *values;
+    __u32 changed = 0;
+    int ret = 0;
+
+    keys = malloc(MAGLEV_TABLE_SIZE * sizeof(*keys));
+    values = malloc(MAGLEV_TABLE_SIZE * sizeof(*values));
+    if (!keys || !values) {
+        log_error("Cannot allocate the slots of the Maglev table");
+        ret = -1;
+        goto out;
+    }
+
+    for (__u32 slot = 0; slot < MAGLEV_TABLE_SIZE; slot++) {
+        if (table[slot] == b->table[slot])
+            continue;
+        keys[changed] = slot;
+        values[changed++] = table[slot];
+    }
+
+    if (changed && bpf_map_update_batch(b->table_fd, keys, values, &changed, NULL)) {
+        log_error("Failed to update BPF map: %s", strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    log_info("Updated %u slots of the Maglev table", changed);
+
+out:
+    free(keys);
+    free(values);
+    return ret;
+}
+
+/* Build the Maglev table in a new map, filled with a single syscall, and swap
+ * it with the one used by the XDP program
+ */
+static int swap_maglev_table(struct lb_backends *b, const __u32 *table) {
+    int outer_fd = bpf_map__fd(b->skel->maps.maglev_tables);
+    __u32 count = MAGLEV_TABLE_SIZE;
+    __u32 *keys = NULL;
+    __u32 zero = 0;
+    int table_fd;
+    int ret = -1;
+
+    table_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, "maglev_table", sizeof(__u32), sizeof(__u32),
+                              MAGLEV_TABLE_SIZE, NULL);
+    if (table_fd < 0) {
+        log_error("Failed to create the Maglev table: %s", strerror(errno));
+        return -1;
+    }
+
+    keys = malloc(MAGLEV_TABLE_SIZE * sizeof(*keys));
+    if (!keys) {
+        log_error("Cannot allocate the slots of the Maglev table");
+        goto out;
+    }
+    for (__u32 slot = 0; slot < MAGLEV_TABLE_SIZE; slot++)
+        keys[slot] = slot;
+
+    if (bpf_map_update_batch(table_fd, keys, table, &count, NULL)) {
+        log_error("Failed to update BPF map: %s", strerror(errno));
+        goto out;
+    }
+
+    /* The old table is freed by the kernel when the program stops using it */
+    if (bpf_map_update_elem(outer_fd, &zero, &table_fd, BPF_ANY)) {
+        log_error("Failed to swap the Maglev table: %s", strerror(errno));
+        goto out;
+    }
+
+    if (b->table_fd >= 0)
+        close(b->table_fd);
+    b->table_fd = table_fd;
+    table_fd = -1;
+    ret = 0;
+
+out:
+    if (table_fd >= 0)
+        close(table_fd);
+    free(keys);
+    return ret;
+}
+
+/* Apply the weights and the health of the backends: the weight of the
+ * backends that are down is 0 in the backends map (for least-connections)
+ * and in the Maglev table. The Maglev table is swapped when the set of
+ * healthy backends changes, so that new flows leave the failed ones at once,
+ * and only the changed slots are written when just the weights change.
+ */
+static int apply_backends(struct lb_backends *b, bool incremental) {
+    int backends_fd = bpf_map__fd(b->skel->maps.backends);
+    __u32 weights[MAX_BACKENDS];
+    __u32 *table = NULL;
+    __u32 total = 0;
+    int ret = -1;
+
+    for (__u32 i = 0; i < b->count; i++) {
+        weights[i] = b->up[i] ? b->weights[i] : 0;
+        total += weights[i];
+    }
+
+    /* Without healthy backends, keep balancing on all of them */
+    if (!total) {
+        log_warn("No backend is up, using all of them");
+        memcpy(weights, b->weights, b->count * sizeof(*weights));
+    }
+
+    for (__u32 i = 0; i < b->count; i++) {
+        struct backend backend = {.ip = b->ips[i], .weight = weights[i]};
+
+        if (bpf_map_update_elem(backends_fd, &i, &backend, BPF_ANY)) {
+            log_error("Failed to update BPF map: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (b->scheduler != LB_SCHED_MAGLEV)
+        return 0;
+
+    table = malloc(MAGLEV_TABLE_SIZE * sizeof(*table));
+    if (!table || maglev_build(b->ips, weights, b->count, table)) {
+        log_error("Failed to build the Maglev table");
+        goto out;
+    }
+
+    if (incremental && b->table_fd >= 0)
+        ret = update_maglev_slots(b, table);
+    else
+        ret = swap_maglev_table(b, table);
+    if (ret)
+        goto out;
+
+    free(b->table);
+    b->table = table;
+    table = NULL;
+    log_info("Loaded %u backends in a Maglev table of %d slots", b->count, MAGLEV_TABLE_SIZE);
+
+out:
+    free(table);
+    return ret;
+}
+
+static void on_health_change(struct health_checker *hc, void *ctx) {
+    struct lb_backends *b = ctx;
+
+    for (__u32 i = 0; i < hc->count; i++)
+        b->up[i] = hc->targets[i].up;
+
+    if (apply_backends(b, false))
+        log_error("Error while updating the Maglev table, new flows still use the old one");
+}
+
+struct reload_ctx {
+    const char *config_file;
+    struct lb_backends *backends;
+};
+
+/* Called by the event loop when the configuration file is rewritten: the
+ * weights are applied without restarting, other changes need a restart
+ */
+static int reload_config(struct event_loop *loop, void *ctx) {
+    struct reload_ctx *reload = ctx;
+    struct lb_backends *b = reload->backends;
+    struct lb_config *cfg;
+    cyaml_err_t err;
+    bool changed = false;
+
+    log_info("Configuration file %s changed, reloading the weights", reload->config_file);
+    err = cyaml_load_file(reload->config_file, &config, &lb_config_schema, (void **)&cfg, NULL);
+    if (err != CYAML_OK) {
+        log_error("Failed to parse %s: %s", reload->config_file, cyaml_strerror(err));
+        return 0;
+    }
+
+    if (cfg->backends_count != b->count) {
+        log_error("The list of backends changed, restart l4_lb to apply it");
+        goto out;
+    }
+
+    for (__u32 i = 0; i < b->count; i++) {
+        __be32 ip;
+
+        if (inet_pton(AF_INET, cfg->backends[i].ip, &ip) != 1 || ip != b->ips[i]) {
+            log_error("The list of backends changed, restart l4_lb to apply it");
+            goto out;
+        }
+    }
+
+    for (__u32 i = 0; i < b->count; i++) {
+        __u32 weight = backend_weight(&cfg->backends[i]);
+
+        if (weight == b->weights[i])
+            continue;
+        log_info("Backend %s: weight %u -> %u", cfg->backends[i].ip, b->weights[i], weight);
+        b->weights[i] = weight;
+        changed = true;
+    }
+
+    if (changed && apply_backends(b, true))
+        log_error("Error while applying the new weights");
+
+out:
+    cyaml_free(&config, &lb_config_schema, cfg, 0);
+    return 0;
+}
+
+/* One's complement sum of an IPv4 header */
+static __u16 ipv4_csum(const struct iphdr *ip) {
+    const __u16 *w = (const __u16 *)ip;
+    __u32 csum = 0;
+
+    for (int i = 0; i < sizeof(*ip) / 2; i++)
+        csum += w[i];
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+
+    return ~csum;
+}
+
+/* Precompute the outer headers towards each backend (DSR with IPIP/GUE), so
+ * that the XDP program only has to copy them and add the lengths
+ */
+static int load_encap_hdrs(struct l4_lb_bpf *skel, const struct lb_config *cfg, __be32 vip,
+                           int gue) {
+    int encap_fd = bpf_map__fd(skel->maps.encap_hdrs);
+    __be32 saddr = vip;
+
+    if (cfg->encap_src && inet_pton(AF_INET, cfg->encap_src, &saddr) != 1) {
+        log_error("Invalid encapsulation source %s", cfg->encap_src);
+        return -1;
+    }
+
+    for (__u32 i = 0; i < cfg->backends_count; i++) {
+        struct encap_hdr hdr = {0};
+
+        hdr.ip.version = 4;
+        hdr.ip.ihl = sizeof(hdr.ip) / 4;
+        hdr.ip.ttl = 64;
+        hdr.ip.protocol = gue ? IPPROTO_UDP : IPPROTO_IPIP;
+        hdr.ip.saddr = saddr;
+        inet_pton(AF_INET, cfg->backends[i].ip, &hdr.ip.daddr);
+        /* tot_len is 0 here, the XDP program adds it to the checksum */
+        hdr.ip.check = ipv4_csum(&hdr.ip);
+
+        hdr.udp.dest = htons(cfg->gue_port);
+
+        if (bpf_map_update_elem(encap_fd, &i, &hdr, BPF_ANY)) {
+            log_error("Failed to update BPF map: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    log_info("Loaded the %s headers of %lu backends", gue ? "GUE" : "IPIP",
+             (unsigned long)cfg->backends_count);
+    return 0;
+}
+
+struct stats_ctx {
+    int map_fd;
+    int ncpus;
+    struct lb_stats *percpu;
+    struct lb_stats last;
+    /* least-conn: conntrack is walked to rebuild backend_conns */
+    int ct_fd;
+    int conns_fd;
+    struct ct_key *ct_keys;
+    struct ct_val *ct_vals;
+};
+
+/* Sum the per-CPU counters of the XDP program */
+static int read_stats(struct stats_ctx *ctx, struct lb_stats *total) {
+    __u32 zero = 0;
+
+    if (bpf_map_lookup_elem(ctx->map_fd, &zero, ctx->percpu))
+        return -1;
+
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < ctx->ncpus; i++) {
+        total->packets += ctx->percpu[i].packets;
+        total->new_flows += ctx->percpu[i].new_flows;
+        total->syncookies_sent += ctx->percpu[i].syncookies_sent;
+        total->syncookies_valid += ctx->percpu[i].syncookies_valid;
+        total->syncookies_invalid += ctx->percpu[i].syncookies_invalid;
+        total->synproxy_handshakes += ctx->percpu[i].synproxy_handshakes;
+        total->dropped += ctx->percpu[i].dropped;
+    }
+
+    return 0;
+}
+
+/* Recount the active connections of every backend from the CT_DIR_ORIG
+ * entries of conntrack, the ones whose state tracks the connection: the
+ * XDP program only decrements backend_conns on FIN/RST, so the connections
+ * evicted by LRU (or that time out silently) would stay counted forever.
+ * The whole map is read with bpf_map_lookup_batch() into buffers sized on
+ * CT_MAX_ENTRIES. The changes made by the program between the walk and the
+ * write are lost, but they are fixed by the next walk.
+ */
+static int reconcile_conns(struct stats_ctx *ctx) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    __s64 conns[MAX_BACKENDS] = {0};
+    __u32 count = 0, token, next, fixed = 0;
+    void *in = NULL;
+    int err;
+
+    while (count < CT_MAX_ENTRIES) {
+        __u32 n = CT_MAX_ENTRIES - count;
+
+        err = bpf_map_lookup_batch(ctx->ct_fd, in, &next, ctx->ct_keys + count,
+                                   ctx->ct_vals + count, &n, &opts);
+        count += n;
+        if (err) {
+            if (errno == ENOENT)
+                break;
+            return -errno;
+        }
+        token = next;
+        in = &token;
+    }
+
+    for (__u32 i = 0; i < count; i++) {
+        const struct ct_val *ct = &ctx->ct_vals[i];
+
+        if (ctx->ct_keys[i].proto == IPPROTO_TCP && ct->dir == CT_DIR_ORIG &&
+            ct->state != CT_CLOSING && ct->backend < MAX_BACKENDS)
+            conns[ct->backend]++;
+    }
+
+    for (__u32 i = 0; i < MAX_BACKENDS; i++) {
+        __s64 cur;
+
+        if (bpf_map_lookup_elem(ctx->conns_fd, &i, &cur) || cur == conns[i])
+            continue;
+        if (bpf_map_update_elem(ctx->conns_fd, &i, &conns[i], BPF_ANY))
+            return -errno;
+        fixed++;
+    }
+    if (fixed)
+        log_debug("Recounted the active connections of %u backends", fixed);
+
+    return 0;
+}
+
+/* Print the rates of the last interval: under a SYN flood, SYN-ACKs/s is the
+ * number of SYNs per second the load balancer is able to answer
+ */
+static int print_stats(struct event_loop *loop, void *arg) {
+    struct stats_ctx *ctx = arg;
+    struct lb_stats now;
+
+    if (read_stats(ctx, &now)) {
+        log_error("Failed to read the statistics: %s", strerror(errno));
+        return 0;
+    }
+
+    if (now.packets != ctx->last.packets) {
+        log_info("pkts/s %llu, new flows/s %llu, SYN-ACKs/s %llu, valid ACKs/s %llu, "
+                 "invalid ACKs/s %llu, handshakes/s %llu, drops/s %llu",
+                 now.packets - ctx->last.packets, now.new_flows - ctx->last.new_flows,
+                 now.syncookies_sent - ctx->last.syncookies_sent,
+                 now.syncookies_valid - ctx->last.syncookies_valid,
+                 now.syncookies_invalid - ctx->last.syncookies_invalid,
+                 now.synproxy_handshakes - ctx->last.synproxy_handshakes,
+                 now.dropped - ctx->last.dropped);
+    }
+
+    ctx->last = now;
+
+    if (ctx->ct_keys && reconcile_conns(ctx))
+        log_error("Failed to recount the active connections: %s", strerror(errno));
+
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    struct l4_lb_bpf *skel = NULL;
+    struct event_loop loop = {0};
+    struct stats_ctx stats = {0};
+    struct lb_config *cfg = NULL;
+    struct lb_backends backends = {.table_fd = -1};
+    struct health_checker health = {0};
+    struct reload_ctx reload = {0};
+    int err;
+    int mss = DEFAULT_MSS;
+    int synproxy = 0;
+    __be32 vip;
+    const char *config_file = NULL;
+    const char *iface1 = NULL;
+    const char *iface2 = NULL;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('c', "config", &config_file, "Path to the YAML configuration file", NULL, 0, 0),
+        OPT_STRING('1', "iface1", &iface1, "1st interface where to attach the BPF program", NULL, 0, 0),
+        OPT_STRING('2', "iface2", &iface2, "2nd interface where to attach the BPF program", NULL, 0, 0),
+        OPT_BOOLEAN('s', "synproxy", &synproxy, "Answer the SYNs for the VIP with SYN cookies", NULL, 0, 0),
+        OPT_INTEGER('m', "mss", &mss, "MSS announced to the clients and the backends (SYN-proxy)", NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\n[Project] This software attaches an XDP L4 load balancer to the "
+                      "interfaces specified in the input parameters",
+                      "\nIf '-s' is specified, connections are created only after the client "
+                      "completes the handshake with a valid SYN cookie");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (config_file == NULL) {
+        log_warn("Use default configuration file: %s", "config.yaml");
+        config_file = "config.yaml";
+    }
+
+    /* Check if file exists */
+    if (access(config_file, F_OK) == -1) {
+        log_fatal("Configuration file %s does not exist", config_file);
+        exit(1);
+    }
+
+    if (mss < 536 || mss > 65535) {
+        log_fatal("Invalid MSS %d", mss);
+        exit(1);
+    }
+
+    if (get_iface_ifindex(iface1, &ifindex_iface1) || get_iface_ifindex(iface2, &ifindex_iface2))
+        exit(1);
+
+    if (parse_config(config_file, &cfg, &vip) || parse_backends(cfg, &backends))
+        exit(1);
+
+    /* With DSR the replies of the backends do not go through the XDP program,
+     * so their sequence numbers cannot be translated
+     */
+    if (synproxy && cfg->mode != LB_MODE_NAT) {
+        log_fatal("The SYN-proxy cannot be used with DSR");
+        exit(1);
+    }
+
+    /* Open BPF application */
+    skel = l4_lb_bpf__open();
+    if (!skel) {
+        log_fatal("Error while opening BPF skeleton");
+        exit(1);
+    }
+
+    /* Add the configuration to l4_lb_cfg */
+    skel->rodata->l4_lb_cfg.vip = vip;
+    skel->rodata->l4_lb_cfg.mss = mss;
+    skel->rodata->l4_lb_cfg.synproxy = synproxy;
+    skel->rodata->l4_lb_cfg.mode = cfg->mode;
+    skel->rodata->l4_lb_cfg.scheduler = cfg->scheduler;
+    skel->rodata->l4_lb_cfg.num_backends = backends.count;
+    log_info("Mode %s, scheduler %s, SYN-proxy %s", lb_mode_strings[cfg->mode].str,
+             lb_scheduler_strings[cfg->scheduler].str, synproxy ? "enabled" : "disabled");
+
+    /* Set program type to XDP */
+    bpf_program__set_type(skel->progs.l4_lb, BPF_PROG_TYPE_XDP);
+
+    /* Load and verify BPF programs */
+    if (l4_lb_bpf__load(skel)) {
+        log_fatal("Error while loading BPF skeleton");
+        exit(1);
+    }
+
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
+        goto cleanup;
+    }
+
+    backends.skel = skel;
+    backends.scheduler = cfg->scheduler;
+    err = apply_backends(&backends, false);
+    if (err) {
+        log_fatal("Error while loading the backends");
+        goto cleanup;
+    }
+
+    if (cfg->mode == LB_MODE_DSR_IPIP || cfg->mode == LB_MODE_DSR_GUE) {
+        err = load_encap_hdrs(skel, cfg, vip, cfg->mode == LB_MODE_DSR_GUE);
+        if (err) {
+            log_fatal("Error while loading the encapsulation headers");
+            goto cleanup;
+        }
+    }
+
+    xdp_flags = 0;
+    xdp_flags |= XDP_FLAGS_DRV_MODE;
+
+    /* Attach the XDP program to the interfaces */
+    err = bpf_xdp_attach(ifindex_iface1, bpf_program__fd(skel->progs.l4_lb), xdp_flags, NULL);
+    if (err) {
+        log_fatal("Error while attaching 1st XDP program to the interface");
+        goto cleanup;
+    }
+
+    err = bpf_xdp_attach(ifindex_iface2, bpf_program__fd(skel->progs.l4_lb), xdp_flags, NULL);
+    if (err) {
+        log_fatal("Error while attaching 2nd XDP program to the interface");
+        goto cleanup;
+    }
+
+    log_info("Successfully attached!");
+
+    stats.map_fd = bpf_map__fd(skel->maps.lb_stats_map);
+    stats.ncpus = libbpf_num_possible_cpus();
+    stats.percpu = stats.ncpus > 0 ? calloc(stats.ncpus, sizeof(*stats.percpu)) : NULL;
+    if (!stats.percpu) {
+        log_fatal("Error while allocating memory");
+        err = -ENOMEM;
+        goto cleanup;
+    }
+
+    if (cfg->scheduler == LB_SCHED_LEAST_CONN) {
+        stats.ct_fd = bpf_map__fd(skel->maps.conntrack);
+        stats.conns_fd = bpf_map__fd(skel->maps.backend_conns);
+        stats.ct_keys = calloc(CT_MAX_ENTRIES, sizeof(*stats.ct_keys));
+        stats.ct_vals = calloc(CT_MAX_ENTRIES, sizeof(*stats.ct_vals));
+        if (!stats.ct_keys || !stats.ct_vals) {
+            log_fatal("Error while allocating memory");
+            err = -ENOMEM;
+            goto cleanup;
+        }
+    }
+
+    err = event_loop__add_timer(&loop, STATS_INTERVAL_MS, print_stats, &stats);
+    if (err) {
+        log_fatal("Error while creating the statistics timer");
+        goto cleanup;
+    }
+
+    /* New flows avoid the backends that fail the health checks */
+    if (cfg->health_check && cfg->health_check->type != HEALTH_NONE) {
+        struct health_check_config *hc = cfg->health_check;
+
+        err = health__init(&health, hc->type, backends.ips, backends.count,
+                           hc->port ? hc->port : DEFAULT_HEALTH_PORT, hc->path, hc->rise,
+                           hc->fall, on_health_change, &backends);
+        if (!err)
+            err = health__attach(&health, &loop,
+                                 hc->interval_ms ? hc->interval_ms : DEFAULT_HEALTH_INTERVAL_MS);
+        if (err) {
+            log_fatal("Error while starting the health checks");
+            goto cleanup;
+        }
+    }
+
+    /* Apply the new weights when the file changes */
+    reload.config_file = config_file;
+    reload.backends = &backends;
+    err = event_loop__watch_file(&loop, config_file, reload_config, &reload);
+    if (err) {
+        log_fatal("Error while watching %s", config_file);
+        goto cleanup;
+    }
+
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
+
+cleanup:
+    cleanup_ifaces();
+    health__destroy(&health);
+    if (backends.table_fd >= 0)
+        close(backends.table_fd);
+    free(backends.table);
+    free(stats.percpu);
+    free(stats.ct_keys);
+    free(stats.ct_vals);
+    l4_lb_bpf__destroy(skel);
+    cyaml_free(&config, &lb_config_schema, cfg, 0);
+    event_loop__destroy(&loop);
+    log_info("Program stopped correctly");
+    return -err;
+}
@@ -0,0 +1,116 @@
+#ifndef L4_LB_H_
+#define L4_LB_H_
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <stdint.h>
+
+#include <cyaml/cyaml.h>
+#include <linux/if_link.h>
+
+#include "ebpf/l4_lb_common.h"
+#include "health.h"
+#include "log.h"
+
+// Include skeleton file
+#include "l4_lb.skel.h"
+
+struct backend_config {
+    const char *ip;
+    /* Share of the new flows (1 if missing, 0 to drain the backend) */
+    uint32_t *weight;
+};
+
+#define DEFAULT_GUE_PORT 6080
+#define DEFAULT_WEIGHT 1
+#define DEFAULT_HEALTH_PORT 80
+#define DEFAULT_HEALTH_INTERVAL_MS 250
+
+struct health_check_config {
+    enum health_type type;
+    uint16_t port;
+    /* HTTP checks only */
+    const char *path;
+    uint32_t interval_ms;
+    uint32_t rise;
+    uint32_t fall;
+};
+
+struct lb_config {
+    const char *vip;
+    enum lb_mode mode;
+    enum lb_scheduler scheduler;
+    /* Source address of the outer headers (the VIP by default) */
+    const char *encap_src;
+    uint16_t gue_port;
+    struct health_check_config *health_check;
+    struct backend_config *backends;
+    uint64_t backends_count;
+};
+
+static const cyaml_schema_field_t backend_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("ip", CYAML_FLAG_POINTER, struct backend_config, ip, 0,
+                           CYAML_UNLIMITED),
+    CYAML_FIELD_UINT_PTR("weight", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct backend_config,
+                         weight),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t backend_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct backend_config, backend_field_schema),
+};
+
+static const cyaml_strval_t health_type_strings[] = {
+    {"none", HEALTH_NONE},
+    {"tcp", HEALTH_TCP},
+    {"http", HEALTH_HTTP},
+};
+
+static const cyaml_schema_field_t health_check_field_schema[] = {
+    CYAML_FIELD_ENUM("type", CYAML_FLAG_DEFAULT, struct health_check_config, type,
+                     health_type_strings, CYAML_ARRAY_LEN(health_type_strings)),
+    CYAML_FIELD_UINT("port", CYAML_FLAG_OPTIONAL, struct health_check_config, port),
+    CYAML_FIELD_STRING_PTR("path", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL,
+                           struct health_check_config, path, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_UINT("interval_ms", CYAML_FLAG_OPTIONAL, struct health_check_config, interval_ms),
+    CYAML_FIELD_UINT("rise", CYAML_FLAG_OPTIONAL, struct health_check_config, rise),
+    CYAML_FIELD_UINT("fall", CYAML_FLAG_OPTIONAL, struct health_check_config, fall),
+    CYAML_FIELD_END};
+
+static const cyaml_strval_t lb_scheduler_strings[] = {
+    {"maglev", LB_SCHED_MAGLEV},
+    {"least-conn", LB_SCHED_LEAST_CONN},
+};
+
+static const cyaml_strval_t lb_mode_strings[] = {
+    {"nat", LB_MODE_NAT},
+    {"dsr-l2", LB_MODE_DSR_L2},
+    {"dsr-ipip", LB_MODE_DSR_IPIP},
+    {"dsr-gue", LB_MODE_DSR_GUE},
+};
+
+static const cyaml_schema_field_t lb_config_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("vip", CYAML_FLAG_POINTER, struct lb_config, vip, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_ENUM("mode", CYAML_FLAG_OPTIONAL, struct lb_config, mode, lb_mode_strings,
+                     CYAML_ARRAY_LEN(lb_mode_strings)),
+    CYAML_FIELD_ENUM("scheduler", CYAML_FLAG_OPTIONAL, struct lb_config, scheduler,
+                     lb_scheduler_strings, CYAML_ARRAY_LEN(lb_scheduler_strings)),
+    CYAML_FIELD_STRING_PTR("encap_src", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct lb_config,
+                           encap_src, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_UINT("gue_port", CYAML_FLAG_OPTIONAL, struct lb_config, gue_port),
+    CYAML_FIELD_MAPPING_PTR("health_check", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL,
+                            struct lb_config, health_check, health_check_field_schema),
+    CYAML_FIELD_SEQUENCE("backends", CYAML_FLAG_POINTER, struct lb_config, backends,
+                         &backend_schema, 1, MAX_BACKENDS),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t lb_config_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct lb_config, lb_config_field_schema),
+};
+
+static const cyaml_config_t config = {
+    .log_fn = cyaml_log,            /* Use the default logging function. */
+    .mem_fn = cyaml_mem,            /* Use the default memory allocator. */
+    .log_level = CYAML_LOG_WARNING, /* Logging errors and warnings only. */
+};
+
+#endif // L4_LB_H_
@@ -0,0 +1,91 @@
+#ifndef MAGLEV_H_
+#define MAGLEV_H_
+
+#include <linux/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ebpf/jhash.h"
+#include "ebpf/l4_lb_common.h"
+
+#define MAGLEV_OFFSET_SEED 0x6d61676c
+#define MAGLEV_SKIP_SEED 0x65763031
+
+/* Maglev lookup table (Eisenbud et al., NSDI '16): every backend has its own
+ * permutation of the slots, derived from its address, and the backends take
+ * turns in claiming the next free slot of their permutation. Adding or
+ * removing a backend moves only a small fraction of the slots of the others.
+ *
+ * Weighted version: in each turn, every backend earns its weight as credit,
+ * and claims a slot only when its credit reaches the largest weight, which
+ * is then taken from the credit. Backends get slots proportionally to their
+ * weights, and those with weight 0 get none.
+ *
+ * ips holds the addresses of the backends (network byte order), table gets
+ * the index of the backend of each slot. Returns 0 on success, -1 if no
+ * backend has a weight.
+ */
+static int maglev_build(const __be32 *ips, const __u32 *weights, __u32 count, __u32 *table) {
+    __u32 *offset, *skip, *next;
+    __u64 *credit;
+    __u32 max_weight = 0;
+    __u32 filled = 0;
+    int ret = -1;
+
+    if (!count || count > MAX_BACKENDS)
+        return -1;
+
+    for (__u32 i = 0; i < count; i++) {
+        if (weights[i] > max_weight)
+            max_weight = weights[i];
+    }
+    if (!max_weight)
+        return -1;
+
+    offset = calloc(count, sizeof(*offset));
+    skip = calloc(count, sizeof(*skip));
+    next = calloc(count, sizeof(*next));
+    credit = calloc(count, sizeof(*credit));
+    if (!offset || !skip || !next || !credit)
+        goto out;
+
+    for (__u32 i = 0; i < count; i++) {
+        offset[i] = jhash_1word(ips[i], MAGLEV_OFFSET_SEED) % MAGLEV_TABLE_SIZE;
+        skip[i] = jhash_1word(ips[i], MAGLEV_SKIP_SEED) % (MAGLEV_TABLE_SIZE - 1) + 1;
+    }
+
+    for (__u32 slot = 0; slot < MAGLEV_TABLE_SIZE; slot++)
+        table[slot] = UINT32_MAX;
+
+    while (filled < MAGLEV_TABLE_SIZE) {
+        for (__u32 i = 0; i < count && filled < MAGLEV_TABLE_SIZE; i++) {
+            __u32 slot;
+
+            credit[i] += weights[i];
+            if (credit[i] < max_weight)
+                continue;
+            credit[i] -= max_weight;
+
+            /* Next slot of the permutation of i that is still free; the
+             * table size is a prime, so every permutation covers all slots
+             */
+            do {
+                slot = (offset[i] + (uint64_t)next[i] * skip[i]) % MAGLEV_TABLE_SIZE;
+                next[i]++;
+            } while (table[slot] != UINT32_MAX);
+
+            table[slot] = i;
+            filled++;
+        }
+    }
+    ret = 0;
+
+out:
+    free(offset);
+    free(skip);
+    free(next);
+    free(credit);
+    return ret;
+}
+
+#endif // MAGLEV_H_
@@ -315,10 +315,4 @@ int get_mac_for_every_iface(mac_t *macs, __u32 *ifindexes, int ifindexes_count)
     return 0;
 }
 
-void sigint_handler(int sig_no) {
-    log_debug("Closing program...");
-    cleanup_ifaces();
-    exit(0);
-}
-
 #endif // HHD_V2_H_
@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# include helper.bash file: used to provide some common function across testing scripts
+source "${BASH_SOURCE%/*}/../../libs/helpers.bash"
+
+# function cleanup: is invoked each time script exit (with or without errors)
+function cleanup {
+  set +e
+  delete_veth 1
+}
+trap cleanup ERR
+
+# Enable verbose output
+set -x
+
+cleanup
+# Makes the script exit, at first error
+# Errors are thrown by commands returning not 0 value
+set -e
+
+# Create one network namespace and veth pair (veth1_ in ns1 is h1, veth1 is
+# the port of the switch)
+create_veth 1
+
+# XDP_TX on veth1 delivers the packets to veth1_ only if it has an XDP program
+sudo ip netns exec ns1 ./xdp_loader -i veth1_
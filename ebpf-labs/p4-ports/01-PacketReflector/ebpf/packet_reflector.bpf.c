@@ -0,0 +1,44 @@
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <linux/if_ether.h>
+
+/* XDP version of p4-labs/lab_1/01-PacketReflector: swap the MAC addresses
+ * and send the packet back out of the ingress port.
+ */
+
+/* Swap the destination and source MAC addresses (bytes 0-5 and 6-11) as
+ * three 16-bit words each. The start of the packet is aligned thanks to
+ * XDP_PACKET_HEADROOM, so these are aligned 16-bit loads/stores (struct
+ * ethhdr is packed and a copy through it would be done byte by byte), and
+ * moving whole words does not depend on the byte order of the machine.
+ */
+static __always_inline void swap_mac(void *data) {
+   __u16 *w = data;
+   __u16 tmp;
+
+   tmp = w[0];
+   w[0] = w[3];
+   w[3] = tmp;
+   tmp = w[1];
+   w[1] = w[4];
+   w[4] = tmp;
+   tmp = w[2];
+   w[2] = w[5];
+   w[5] = tmp;
+}
+
+SEC("xdp")
+int xdp_packet_reflector(struct xdp_md *ctx) {
+   void *data_end = (void *)(long)ctx->data_end;
+   void *data = (void *)(long)ctx->data;
+
+   /* As the P4 parser, only frames with a whole Ethernet header */
+   if (data + sizeof(struct ethhdr) > data_end)
+      return XDP_DROP;
+
+   swap_mac(data);
+
+   return XDP_TX;
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
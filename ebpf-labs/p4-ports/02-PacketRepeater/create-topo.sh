@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# include helper.bash file: used to provide some common function across testing scripts
+source "${BASH_SOURCE%/*}/../../libs/helpers.bash"
+
+# function cleanup: is invoked each time script exit (with or without errors)
+function cleanup {
+  set +e
+  delete_veth 2
+}
+trap cleanup ERR
+
+# Enable verbose output
+set -x
+
+cleanup
+# Makes the script exit, at first error
+# Errors are thrown by commands returning not 0 value
+set -e
+
+# Create two network namespaces and veth pairs (veth1_ in ns1 is h1, veth2_
+# in ns2 is h2, veth1 and veth2 are the ports 1 and 2 of the switch)
+create_veth 2
+
+# Get MAC address using ifconfig
+mac1=$(sudo ip netns exec ns1 ifconfig veth1_ | grep ether | awk '{print $2}')
+mac2=$(sudo ip netns exec ns2 ifconfig veth2_ | grep ether | awk '{print $2}')
+
+# Update ARP table
+sudo ip netns exec ns1 arp -s 10.0.0.2 $mac2
+sudo ip netns exec ns2 arp -s 10.0.0.1 $mac1
+
+# Packets redirected to veth1/veth2 are delivered to the peers only if these
+# have an XDP program
+sudo ip netns exec ns1 ./xdp_loader -i veth1_
+sudo ip netns exec ns2 ./xdp_loader -i veth2_
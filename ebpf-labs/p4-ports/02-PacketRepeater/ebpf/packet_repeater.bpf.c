@@ -0,0 +1,28 @@
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+/* XDP version of p4-labs/lab_1/02-PacketRepeater: the repeater table maps
+ * the ingress port to the egress port, and the packet is sent out as is.
+ *
+ * The table is a devmap keyed by the ifindex of the ingress port, whose
+ * values are the egress ports: the loader translates the port numbers of
+ * the entries (as in control_plane.py) to ifindexes. Packets of ports
+ * without an entry are dropped, as with the default NoAction in bmv2.
+ */
+
+#define MAX_PORTS 64
+
+struct {
+   __uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+   __type(key, __u32);
+   __type(value, struct bpf_devmap_val);
+   __uint(max_entries, MAX_PORTS);
+} repeater SEC(".maps");
+
+SEC("xdp")
+int xdp_packet_repeater(struct xdp_md *ctx) {
+   /* The lower bits of the flags are the action if there is no entry */
+   return bpf_redirect_map(&repeater, ctx->ingress_ifindex, XDP_DROP);
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <errno.h>
+#include <linux/if_link.h>
+
+#include <argparse.h>
+#include <net/if.h>
+
+#include "log.h"
+#include "event_loop.h"
+#include "packet_repeater.h"
+
+/* ifindex of every port, port N is ifindexes[N - 1] */
+static int ifindexes[MAX_PORTS];
+static __u32 nports = 0;
+static __u32 xdp_flags = 0;
+
+static const char *const usages[] = {
+    "packet_repeater [options] [[--] args]",
+    "packet_repeater [options]",
+    NULL,
+};
+
+static void cleanup_ifaces() {
+    __u32 curr_prog_id = 0;
+
+    for (__u32 i = 0; i < nports; i++) {
+        if (!bpf_xdp_query_id(ifindexes[i], xdp_flags, &curr_prog_id)) {
+            if (curr_prog_id) {
+                bpf_xdp_detach(ifindexes[i], xdp_flags, NULL);
+                log_trace("Detached XDP program from interface %d", ifindexes[i]);
+            }
+        }
+    }
+}
+
+static int parse_config(const char *config_file, struct repeater_config **cfg) {
+    cyaml_err_t err;
+
+    err = cyaml_load_file(config_file, &config, &repeater_config_schema, (void **)cfg, NULL);
+    if (err != CYAML_OK) {
+        log_error("Failed to parse %s: %s", config_file, cyaml_strerror(err));
+        return -1;
+    }
+
+    for (__u32 i = 0; i < (*cfg)->ports_count; i++) {
+        ifindexes[i] = if_nametoindex((*cfg)->ports[i]);
+        if (!ifindexes[i]) {
+            log_error("Error while retrieving the ifindex of %s", (*cfg)->ports[i]);
+            return -1;
+        }
+        log_info("Port %u is %s (ifindex %d)", i + 1, (*cfg)->ports[i], ifindexes[i]);
+    }
+    nports = (*cfg)->ports_count;
+
+    for (__u32 i = 0; i < (*cfg)->repeater_count; i++) {
+        struct repeater_entry *e = &(*cfg)->repeater[i];
+
+        if (!e->ingress_port || e->ingress_port > nports || !e->egress_port ||
+            e->egress_port > nports) {
+            log_error("Invalid repeater entry %u => %u: ports go from 1 to %u", e->ingress_port,
+                      e->egress_port, nports);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Write the entries of the repeater table, translating the port numbers to
+ * the ifindexes of the devmap
+ */
+static int load_repeater(struct packet_repeater_bpf *skel, const struct repeater_config *cfg) {
+    int map_fd = bpf_map__fd(skel->maps.repeater);
+
+    for (__u32 i = 0; i < cfg->repeater_count; i++) {
+        const struct repeater_entry *e = &cfg->repeater[i];
+        __u32 key = ifindexes[e->ingress_port - 1];
+        struct bpf_devmap_val val = {.ifindex = ifindexes[e->egress_port - 1]};
+
+        if (bpf_map_update_elem(map_fd, &key, &val, BPF_ANY)) {
+            log_error("Failed to add the repeater entry %u => %u: %s", e->ingress_port,
+                      e->egress_port, strerror(errno));
+            return -1;
+        }
+        log_info("Repeater entry: port %u => port %u", e->ingress_port, e->egress_port);
+    }
+
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    struct packet_repeater_bpf *skel = NULL;
+    struct repeater_config *cfg = NULL;
+    struct event_loop loop = {0};
+    const char *config_file = "config.yaml";
+    int err;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('c', "config", &config_file, "Path to the YAML configuration file", NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nXDP version of the P4 packet repeater: the packets received on a port are "
+                      "redirected to the port given by the repeater table of the configuration",
+                      "\nThe peers of veth interfaces need an XDP program too (see xdp_loader)");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (parse_config(config_file, &cfg))
+        exit(1);
+
+    /* Open BPF application */
+    skel = packet_repeater_bpf__open();
+    if (!skel) {
+        log_fatal("Error while opening BPF skeleton");
+        cyaml_free(&config, &repeater_config_schema, cfg, 0);
+        exit(1);
+    }
+
+    /* Set program type to XDP */
+    bpf_program__set_type(skel->progs.xdp_packet_repeater, BPF_PROG_TYPE_XDP);
+
+    /* Load and verify BPF programs */
+    if (packet_repeater_bpf__load(skel)) {
+        log_fatal("Error while loading BPF skeleton");
+        err = -1;
+        goto cleanup;
+    }
+
+    err = load_repeater(skel, cfg);
+    if (err)
+        goto cleanup;
+
+    /* SIGINT/SIGTERM are received by the event loop, so that the cleanup
+     * below runs in the normal flow of the program
+     */
+    err = event_loop__init(&loop);
+    if (err) {
+        log_fatal("Error while creating the event loop");
+        goto cleanup;
+    }
+
+    xdp_flags = 0;
+    xdp_flags |= XDP_FLAGS_DRV_MODE;
+
+    /* Attach the XDP program to every port: as in bmv2, the packets of the
+     * ports without an entry are dropped
+     */
+    for (__u32 i = 0; i < nports; i++) {
+        err = bpf_xdp_attach(ifindexes[i], bpf_program__fd(skel->progs.xdp_packet_repeater),
+                             xdp_flags, NULL);
+        if (err) {
+            log_fatal("Error while attaching the XDP program to port %u", i + 1);
+            goto cleanup;
+        }
+    }
+
+    log_info("Successfully attached!");
+
+    /* Wait until SIGINT/SIGTERM */
+    err = event_loop__run(&loop);
+
+cleanup:
+    cleanup_ifaces();
+    packet_repeater_bpf__destroy(skel);
+    event_loop__destroy(&loop);
+    cyaml_free(&config, &repeater_config_schema, cfg, 0);
+    log_info("Program stopped correctly");
+    return -err;
+}
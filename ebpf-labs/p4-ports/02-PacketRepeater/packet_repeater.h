@@ -0,0 +1,65 @@
+#ifndef PACKET_REPEATER_H_
+#define PACKET_REPEATER_H_
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <stdint.h>
+
+#include <cyaml/cyaml.h>
+#include <linux/if_link.h>
+
+#include "log.h"
+
+// Include skeleton file
+#include "packet_repeater.skel.h"
+
+/* Same as the devmap in the eBPF program */
+#define MAX_PORTS 64
+
+/* Entry of the repeater table, as in control_plane.py:
+ * table_add('repeater', 'forward', [ingress_port], [egress_port])
+ */
+struct repeater_entry {
+    uint32_t ingress_port;
+    uint32_t egress_port;
+};
+
+struct repeater_config {
+    /* Port N is the N-th interface, as with -i N@iface in bmv2 */
+    char **ports;
+    uint64_t ports_count;
+    struct repeater_entry *repeater;
+    uint64_t repeater_count;
+};
+
+static const cyaml_schema_value_t port_schema = {
+    CYAML_VALUE_STRING(CYAML_FLAG_POINTER, char, 0, CYAML_UNLIMITED),
+};
+
+static const cyaml_schema_field_t repeater_entry_field_schema[] = {
+    CYAML_FIELD_UINT("ingress_port", CYAML_FLAG_DEFAULT, struct repeater_entry, ingress_port),
+    CYAML_FIELD_UINT("egress_port", CYAML_FLAG_DEFAULT, struct repeater_entry, egress_port),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t repeater_entry_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct repeater_entry, repeater_entry_field_schema),
+};
+
+static const cyaml_schema_field_t repeater_config_field_schema[] = {
+    CYAML_FIELD_SEQUENCE("ports", CYAML_FLAG_POINTER, struct repeater_config, ports, &port_schema,
+                         1, MAX_PORTS),
+    CYAML_FIELD_SEQUENCE("repeater", CYAML_FLAG_POINTER, struct repeater_config, repeater,
+                         &repeater_entry_schema, 0, MAX_PORTS),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t repeater_config_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct repeater_config, repeater_config_field_schema),
+};
+
+static const cyaml_config_t config = {
+    .log_fn = cyaml_log,            /* Use the default logging function. */
+    .mem_fn = cyaml_mem,            /* Use the default memory allocator. */
+    .log_level = CYAML_LOG_WARNING, /* Logging errors and warnings only. */
+};
+
+#endif // PACKET_REPEATER_H_
@@ -0,0 +1,149 @@
+#!/bin/bash
+
+# Compare bmv2 (simple_switch) and XDP on the same veth topology:
+#
+#   ./bench.sh reflector|repeater [rate in pps, 0 = max] [duration in s]
+#
+# The topology is the one of the create-topo.sh scripts (h1 = veth1_ in ns1,
+# h2 = veth2_ in ns2, veth1/veth2 are the ports 1/2 of the switch). For each
+# target, trafficgen sends from h1 and trafficsink counts the packets that
+# come back to h1 (reflector) or reach h2 (repeater) and checks the MACs.
+#
+# Requires p4c and simple_switch (as in the P4 labs VM), and the programs of
+# ../tools, 01-PacketReflector and 02-PacketRepeater built with make.
+
+# include helper.bash file: used to provide some common function across testing scripts
+source "${BASH_SOURCE%/*}/../libs/helpers.bash"
+
+BENCH_DIR=$(cd "${BASH_SOURCE%/*}" && pwd)
+P4_DIR="$BENCH_DIR/../../p4-labs/lab_1"
+TOOLS_DIR="$BENCH_DIR/../tools"
+OUT_DIR="$BENCH_DIR/.bench"
+
+FUNCTION=${1:-}
+RATE=${2:-0}
+DURATION=${3:-10}
+
+case "$FUNCTION" in
+  reflector)
+    NPORTS=1
+    P4_SRC="$P4_DIR/01-PacketReflector/solution/packet_reflector.p4"
+    XDP_DIR="$BENCH_DIR/01-PacketReflector"
+    ;;
+  repeater)
+    NPORTS=2
+    P4_SRC="$P4_DIR/02-PacketRepeater/solution/packet_repeater.p4"
+    XDP_DIR="$BENCH_DIR/02-PacketRepeater"
+    ;;
+  *)
+    echo "Usage: $0 reflector|repeater [rate] [duration]"
+    exit 1
+    ;;
+esac
+
+SWITCH_PID=
+
+# function cleanup: is invoked each time script exit (with or without errors)
+function cleanup {
+  set +e
+  stop_switch
+  delete_veth $NPORTS
+}
+trap cleanup EXIT
+
+function stop_switch {
+  if [ -n "$SWITCH_PID" ]; then
+    sudo kill $SWITCH_PID
+    wait $SWITCH_PID 2>/dev/null
+    SWITCH_PID=
+  fi
+}
+
+function start_bmv2 {
+  local json="$OUT_DIR/$(basename "$P4_SRC" .p4).json"
+
+  p4c --target bmv2 --arch v1model -o "$OUT_DIR" "$P4_SRC"
+  # Same port numbering as the P4 topologies: port N is vethN
+  sudo simple_switch --log-level off -i 1@veth1 $([ $NPORTS -eq 2 ] && echo "-i 2@veth2") \
+    "$json" > "$OUT_DIR/simple_switch.log" 2>&1 &
+  SWITCH_PID=$!
+  sleep 2
+
+  # Same entries of control_plane.py, through the Thrift CLI
+  if [ "$FUNCTION" = "repeater" ]; then
+    printf "table_add repeater forward 1 => 2\ntable_add repeater forward 2 => 1\n" | \
+      simple_switch_CLI > /dev/null
+  fi
+}
+
+function start_xdp {
+  if [ "$FUNCTION" = "reflector" ]; then
+    sudo "$XDP_DIR/packet_reflector" -i veth1 > "$OUT_DIR/xdp.log" 2>&1 &
+  else
+    sudo "$XDP_DIR/packet_repeater" -c "$XDP_DIR/config.yaml" > "$OUT_DIR/xdp.log" 2>&1 &
+  fi
+  SWITCH_PID=$!
+  sleep 1
+}
+
+# function run_traffic: sends the traffic and prints the packets per second
+# received by the sink
+function run_traffic {
+  local target=$1
+  local log="$OUT_DIR/$FUNCTION-$target.log"
+  local sink_ns sink_if dmac smac expect_dmac received
+
+  if [ "$FUNCTION" = "reflector" ]; then
+    # Back to h1, with the MACs swapped
+    sink_ns=ns1
+    sink_if=veth1_
+    dmac=00:01:02:03:04:05
+    smac=$dmac
+    expect_dmac=$mac1
+  else
+    sink_ns=ns2
+    sink_if=veth2_
+    dmac=$mac2
+    smac=$mac1
+    expect_dmac=$mac2
+  fi
+
+  sudo ip netns exec $sink_ns "$TOOLS_DIR/trafficsink" -c "$BENCH_DIR/bench.yaml" -i $sink_if \
+    -s $smac -m $expect_dmac -d $((DURATION + 2)) > "$log" 2>&1 &
+  local sink_pid=$!
+  sleep 1
+
+  sudo ip netns exec ns1 "$TOOLS_DIR/trafficgen" -c "$BENCH_DIR/bench.yaml" -i veth1_ -m $dmac \
+    -r $RATE -d $DURATION >> "$log" 2>&1
+  wait $sink_pid
+
+  received=$(grep -o "Received [0-9]* packets" "$log" | awk '{print $2}')
+  received=${received:-0}
+  printf "%-6s %-10s %12d pps (%s packets in %d s, see %s)\n" $target $FUNCTION \
+    $((received / DURATION)) "$received" $DURATION "$log"
+}
+
+set -e
+mkdir -p "$OUT_DIR"
+
+delete_veth $NPORTS 2>/dev/null || true
+create_veth $NPORTS
+
+mac1=$(sudo ip netns exec ns1 cat /sys/class/net/veth1_/address)
+if [ $NPORTS -eq 2 ]; then
+  mac2=$(sudo ip netns exec ns2 cat /sys/class/net/veth2_/address)
+fi
+
+# XDP_TX/XDP_REDIRECT on vethN deliver the packets to vethN_ only if it has
+# an XDP program; it does not change anything for bmv2
+for i in $(seq 1 $NPORTS); do
+  sudo ip netns exec ns$i "$XDP_DIR/xdp_loader" -i veth${i}_ > /dev/null
+done
+
+start_bmv2
+run_traffic bmv2
+stop_switch
+
+start_xdp
+run_traffic xdp
+stop_switch
@@ -0,0 +1,549 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/types.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <argparse.h>
+
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <signal.h>
+
+#include "log.h"
+
+#define MAX_THREADS 64
+#define RING_BLOCK_SIZE (1 << 22)
+#define RING_BLOCK_NR 64
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_TIMEOUT_MS 10
+/* Latency histogram with 4 buckets per power of two (~19% resolution) */
+#define LAT_BUCKETS (64 * 4)
+
+/* Same as TYPE_INT and INT_MAX_HOPS in p4-labs/lab_2/05-HHDv2/solution/hdd_v2.p4 */
+#define INT_ETHERTYPE 0x88B5
+#define INT_MAX_HOPS 4
+#define INT_FLAG_OVERFLOW 0x01
+/* Slots of the path table of every thread, open addressing */
+#define MAX_PATHS 256
+
+static const char *const usages[] = {
+    "int_collector [options] [[--] args]",
+    "int_collector [options]",
+    NULL,
+};
+
+static volatile sig_atomic_t exiting = 0;
+
+/* INT header, right after Ethernet: the etherType is the one of the packet */
+struct int_shim {
+    __u8 hop_count;
+    __u8 flags;
+    __be16 ethertype;
+} __attribute__((packed));
+
+/* One per switch, the last switch first; times are in us */
+struct int_hop {
+    __be32 switch_id;
+    __be16 ingress_port;
+    __be16 egress_port;
+    __be32 hop_latency;
+    __be32 enq_qdepth;
+    __be32 deq_timedelta;
+} __attribute__((packed));
+
+/* A path is the sequence of switch ids from the source to the sink; the
+ * reports of a packet that went through more than INT_MAX_HOPS switches only
+ * carry the first ones, so they are kept on a path of their own.
+ */
+struct path_key {
+    __u32 hops;
+    __u32 overflow;
+    __u32 switch_ids[INT_MAX_HOPS];
+};
+
+struct hop_stats {
+    __u64 latency_sum;
+    __u64 qdepth_sum;
+    __u64 qdepth_max;
+    __u64 qtime_sum;
+    __u64 qtime_max;
+};
+
+struct path_stats {
+    int used;
+    struct path_key key;
+    __u64 reports;
+    __u64 lat_sum;
+    __u64 lat_max;
+    __u64 lat_hist[LAT_BUCKETS];
+    struct hop_stats hop[INT_MAX_HOPS];
+};
+
+struct path_table {
+    struct path_stats paths[MAX_PATHS];
+    __u64 rx;
+    __u64 malformed;
+    __u64 full;
+};
+
+struct collector_thread {
+    pthread_t tid;
+    int id;
+    int fd;
+    void *ring;
+    struct path_table *table;
+};
+
+static int ifindex;
+
+static void sigint_handler(int sig_no) {
+    exiting = 1;
+}
+
+static inline __u32 lat_bucket(__u64 us) {
+    __u32 msb;
+
+    if (us < 4)
+        return us;
+    msb = 63 - __builtin_clzll(us);
+    return msb * 4 + ((us >> (msb - 2)) & 3);
+}
+
+static inline __u64 lat_bucket_value(__u32 idx) {
+    __u32 msb = idx / 4;
+
+    if (idx < 4)
+        return idx;
+    return (__u64)(4 | (idx & 3)) << (msb - 2);
+}
+
+static __u64 lat_percentile(const __u64 *hist, __u64 total, double pct) {
+    __u64 target = total * pct / 100.0, acc = 0;
+
+    for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+        acc += hist[i];
+        if (acc > target)
+            return lat_bucket_value(i);
+    }
+    return 0;
+}
+
+static inline __u32 path_hash(const struct path_key *key) {
+    __u32 h = key->hops * 31 + key->overflow;
+
+    for (__u32 i = 0; i < key->hops; i++)
+        h = h * 0x9e3779b1 + key->switch_ids[i];
+    return h ^ (h >> 16);
+}
+
+/* Find the slot of a path, allocating it if it is new. Only the owner of the
+ * table allocates: the main thread may read a slot concurrently, so the key is
+ * written before the slot is published as used.
+ */
+static struct path_stats *path_lookup(struct path_table *table, const struct path_key *key) {
+    __u32 idx = path_hash(key) % MAX_PATHS;
+
+    for (__u32 i = 0; i < MAX_PATHS; i++, idx = (idx + 1) % MAX_PATHS) {
+        struct path_stats *p = &table->paths[idx];
+
+        if (!__atomic_load_n(&p->used, __ATOMIC_ACQUIRE)) {
+            p->key = *key;
+            __atomic_store_n(&p->used, 1, __ATOMIC_RELEASE);
+            return p;
+        }
+        if (!memcmp(&p->key, key, sizeof(*key)))
+            return p;
+    }
+    return NULL;
+}
+
+static int setup_rx_ring(struct collector_thread *t, int fanout_id) {
+    struct tpacket_req3 req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr = RING_BLOCK_NR,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR,
+        .tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MS,
+    };
+    /* The kernel only queues the INT reports to the socket, the data packets
+     * go on to the stack of the host
+     */
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(INT_ETHERTYPE),
+        .sll_ifindex = ifindex,
+    };
+    int version = TPACKET_V3;
+    /* Every thread aggregates in its own table, so the reports can be spread
+     * regardless of the path (they all come from the same switch anyway)
+     */
+    int fanout = fanout_id | (PACKET_FANOUT_LB << 16);
+
+    t->fd = socket(AF_PACKET, SOCK_RAW, htons(INT_ETHERTYPE));
+    if (t->fd < 0) {
+        log_error("Failed to open AF_PACKET socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+        log_error("Failed to set TPACKET_V3: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        log_error("Failed to set up PACKET_RX_RING: %s", strerror(errno));
+        return -1;
+    }
+
+    t->ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_LOCKED, t->fd, 0);
+    if (t->ring == MAP_FAILED) {
+        log_error("Failed to mmap the RX ring: %s", strerror(errno));
+        return -1;
+    }
+
+    if (bind(t->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+        log_error("Failed to bind the socket to ifindex %d: %s", ifindex, strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))) {
+        log_error("Failed to join the fanout group: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void handle_report(struct collector_thread *t, const struct tpacket3_hdr *ppd) {
+    const __u8 *data = (const __u8 *)ppd + ppd->tp_mac;
+    const __u8 *end = data + ppd->tp_snaplen;
+    const struct int_shim *shim = (const struct int_shim *)(data + ETH_HLEN);
+    const struct int_hop *hops = (const struct int_hop *)(shim + 1);
+    struct path_table *table = t->table;
+    struct path_key key = {0};
+    struct path_stats *p;
+    __u64 lat = 0;
+
+    table->rx++;
+
+    if ((const __u8 *)hops > end || shim->hop_count > INT_MAX_HOPS ||
+        (const __u8 *)(hops + shim->hop_count) > end) {
+        table->malformed++;
+        return;
+    }
+
+    /* The records are pushed in front by every switch, the path goes the
+     * other way
+     */
+    key.hops = shim->hop_count;
+    key.overflow = !!(shim->flags & INT_FLAG_OVERFLOW);
+    for (__u32 i = 0; i < key.hops; i++)
+        key.switch_ids[i] = ntohl(hops[key.hops - 1 - i].switch_id);
+
+    p = path_lookup(table, &key);
+    if (!p) {
+        table->full++;
+        return;
+    }
+
+    for (__u32 i = 0; i < key.hops; i++) {
+        const struct int_hop *h = &hops[key.hops - 1 - i];
+        struct hop_stats *hs = &p->hop[i];
+        __u32 latency = ntohl(h->hop_latency);
+        __u32 qdepth = ntohl(h->enq_qdepth);
+        __u32 qtime = ntohl(h->deq_timedelta);
+
+        lat += latency;
+        hs->latency_sum += latency;
+        hs->qdepth_sum += qdepth;
+        hs->qtime_sum += qtime;
+        if (qdepth > hs->qdepth_max)
+            hs->qdepth_max = qdepth;
+        if (qtime > hs->qtime_max)
+            hs->qtime_max = qtime;
+    }
+
+    p->reports++;
+    p->lat_sum += lat;
+    if (lat > p->lat_max)
+        p->lat_max = lat;
+    p->lat_hist[lat_bucket(lat)]++;
+}
+
+static void *collector_thread_run(void *arg) {
+    struct collector_thread *t = arg;
+    struct pollfd pfd = {.fd = t->fd, .events = POLLIN | POLLERR};
+    __u32 block = 0;
+
+    while (!exiting) {
+        struct tpacket_block_desc *bd =
+            (struct tpacket_block_desc *)((__u8 *)t->ring + (size_t)block * RING_BLOCK_SIZE);
+        struct tpacket3_hdr *ppd;
+
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        ppd = (struct tpacket3_hdr *)((__u8 *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (__u32 i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            handle_report(t, ppd);
+            ppd = (struct tpacket3_hdr *)((__u8 *)ppd + ppd->tp_next_offset);
+        }
+
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        block = (block + 1) % RING_BLOCK_NR;
+    }
+
+    return NULL;
+}
+
+/* Merge the tables of all the threads into tot, path by path */
+static void sum_tables(struct collector_thread *threads, int nthreads, struct path_table *tot) {
+    memset(tot, 0, sizeof(*tot));
+    for (int i = 0; i < nthreads; i++) {
+        const struct path_table *table = threads[i].table;
+
+        tot->rx += table->rx;
+        tot->malformed += table->malformed;
+        tot->full += table->full;
+
+        for (int s = 0; s < MAX_PATHS; s++) {
+            const struct path_stats *src = &table->paths[s];
+            struct path_stats *dst;
+
+            if (!__atomic_load_n(&src->used, __ATOMIC_ACQUIRE))
+                continue;
+            dst = path_lookup(tot, &src->key);
+            if (!dst)
+                continue;
+
+            dst->reports += src->reports;
+            dst->lat_sum += src->lat_sum;
+            if (src->lat_max > dst->lat_max)
+                dst->lat_max = src->lat_max;
+            for (int b = 0; b < LAT_BUCKETS; b++)
+                dst->lat_hist[b] += src->lat_hist[b];
+            for (__u32 h = 0; h < src->key.hops; h++) {
+                dst->hop[h].latency_sum += src->hop[h].latency_sum;
+                dst->hop[h].qdepth_sum += src->hop[h].qdepth_sum;
+                dst->hop[h].qtime_sum += src->hop[h].qtime_sum;
+                if (src->hop[h].qdepth_max > dst->hop[h].qdepth_max)
+                    dst->hop[h].qdepth_max = src->hop[h].qdepth_max;
+                if (src->hop[h].qtime_max > dst->hop[h].qtime_max)
+                    dst->hop[h].qtime_max = src->hop[h].qtime_max;
+            }
+        }
+    }
+}
+
+static void format_path(const struct path_key *key, char *buf, size_t len) {
+    int off = 0;
+
+    buf[0] = '\0';
+    for (__u32 i = 0; i < key->hops && off < (int)len; i++)
+        off += snprintf(buf + off, len - off, "%s%u", i ? " -> " : "", key->switch_ids[i]);
+    if (key->overflow && off < (int)len)
+        snprintf(buf + off, len - off, " -> ...");
+}
+
+/* Reports and latency of every path in the last interval, i.e., the
+ * difference between the merged tables now and last
+ */
+static void print_interval(const struct path_table *now, struct path_table *last) {
+    for (int s = 0; s < MAX_PATHS; s++) {
+        const struct path_stats *p = &now->paths[s];
+        const struct path_stats *prev;
+        __u64 hist[LAT_BUCKETS];
+        __u64 reports;
+        char path[INT_MAX_HOPS * 16];
+
+        if (!p->used)
+            continue;
+        prev = path_lookup(last, &p->key);
+        if (!prev)
+            continue;
+        reports = p->reports - prev->reports;
+        if (!reports)
+            continue;
+
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            hist[b] = p->lat_hist[b] - prev->lat_hist[b];
+        format_path(&p->key, path, sizeof(path));
+        log_info("Path %s: %llu reports/s, latency (us) avg %.1f p50 %llu p99 %llu", path, reports,
+                 (double)(p->lat_sum - prev->lat_sum) / reports, lat_percentile(hist, reports, 50),
+                 lat_percentile(hist, reports, 99));
+    }
+}
+
+static void print_summary(const struct path_table *tot) {
+    log_info("Received %llu reports (%llu malformed, %llu beyond %d paths)", tot->rx,
+             tot->malformed, tot->full, MAX_PATHS);
+
+    for (int s = 0; s < MAX_PATHS; s++) {
+        const struct path_stats *p = &tot->paths[s];
+        char path[INT_MAX_HOPS * 16];
+
+        if (!p->used || !p->reports)
+            continue;
+
+        format_path(&p->key, path, sizeof(path));
+        log_info("Path %s: %llu reports", path, p->reports);
+        log_info("  latency (us): avg %.1f p50 %llu p99 %llu p99.9 %llu max %llu",
+                 (double)p->lat_sum / p->reports, lat_percentile(p->lat_hist, p->reports, 50),
+                 lat_percentile(p->lat_hist, p->reports, 99),
+                 lat_percentile(p->lat_hist, p->reports, 99.9), p->lat_max);
+        for (__u32 h = 0; h < p->key.hops; h++) {
+            const struct hop_stats *hs = &p->hop[h];
+
+            log_info("  switch %u: latency avg %.1f us, queue depth avg %.1f max %llu, "
+                     "queue time avg %.1f us max %llu us",
+                     p->key.switch_ids[h], (double)hs->latency_sum / p->reports,
+                     (double)hs->qdepth_sum / p->reports, hs->qdepth_max,
+                     (double)hs->qtime_sum / p->reports, hs->qtime_max);
+        }
+    }
+}
+
+int main(int argc, const char **argv) {
+    struct collector_thread threads[MAX_THREADS] = {0};
+    struct path_table *now = NULL, *last = NULL;
+    const char *iface = NULL;
+    int nthreads = 1, duration = 0, quiet = 0;
+    int err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('i', "iface", &iface, "Interface where to receive the INT reports", NULL, 0, 0),
+        OPT_INTEGER('t', "threads", &nthreads, "Number of RX threads (PACKET_FANOUT_LB)", NULL, 0,
+                    0),
+        OPT_INTEGER('d', "duration", &duration, "Duration in seconds (0 = until Ctrl-C)", NULL, 0,
+                    0),
+        OPT_BOOLEAN('q', "quiet", &quiet, "Only print the summary at the end", NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software receives the INT reports of the P4 switches using "
+                      "TPACKET_V3 RX rings and aggregates per-path latency histograms and "
+                      "per-hop queue statistics",
+                      "\nRun it on the host behind the INT sink, e.g., mx h2 ./int_collector -i "
+                      "h2-eth0");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (iface == NULL) {
+        log_error("Error, you must specify the interface where to receive the reports");
+        exit(1);
+    }
+
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        log_error("Number of threads must be between 1 and %d", MAX_THREADS);
+        exit(1);
+    }
+
+    ifindex = if_nametoindex(iface);
+    if (!ifindex) {
+        log_fatal("Error while retrieving the ifindex of %s", iface);
+        exit(1);
+    }
+
+    now = calloc(1, sizeof(*now));
+    last = calloc(1, sizeof(*last));
+    if (!now || !last) {
+        log_fatal("Error while allocating the path tables");
+        err = -1;
+        goto cleanup;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigint_handler;
+
+    if (sigaction(SIGINT, &action, NULL) == -1 || sigaction(SIGTERM, &action, NULL) == -1) {
+        log_error("sigation failed");
+        err = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        struct collector_thread *t = &threads[i];
+
+        t->id = i;
+        t->table = calloc(1, sizeof(*t->table));
+        if (!t->table || setup_rx_ring(t, getpid() & 0xffff)) {
+            log_fatal("Error while setting up thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+
+        if (pthread_create(&t->tid, NULL, collector_thread_run, t)) {
+            log_fatal("Error while creating thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+    }
+
+    log_info("Receiving INT reports on %s", iface);
+
+    for (int sec = 1; !exiting; sec++) {
+        struct path_table *tmp;
+
+        sleep(1);
+        sum_tables(threads, nthreads, now);
+        if (!quiet) {
+            log_info("RX: %llu reports/s, malformed %llu", now->rx - last->rx,
+                     now->malformed - last->malformed);
+            print_interval(now, last);
+        }
+        tmp = last;
+        last = now;
+        now = tmp;
+
+        if (duration && sec >= duration)
+            exiting = 1;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i].tid)
+            pthread_join(threads[i].tid, NULL);
+    }
+
+    if (!err) {
+        sum_tables(threads, nthreads, now);
+        print_summary(now);
+    }
+
+cleanup:
+    for (int i = 0; i < nthreads; i++) {
+        struct collector_thread *t = &threads[i];
+
+        if (t->ring && t->ring != MAP_FAILED)
+            munmap(t->ring, (size_t)RING_BLOCK_SIZE * RING_BLOCK_NR);
+        if (t->fd > 0)
+            close(t->fd);
+        free(t->table);
+    }
+    free(now);
+    free(last);
+    log_info("Program stopped correctly");
+    return -err;
+}
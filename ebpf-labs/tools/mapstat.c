@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+
+#include <argparse.h>
+
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <signal.h>
+
+#include "log.h"
+
+static const char *const usages[] = {
+    "mapstat [options] [[--] args]",
+    "mapstat [options]",
+    NULL,
+};
+
+static volatile sig_atomic_t exiting = 0;
+
+/* A snapshot of the whole map, read with a single bpf_map_lookup_batch()
+ * call when the buffers are large enough (they are sized on max_entries).
+ * Counters holds the selected field of every entry (summed over the CPUs
+ * for per-CPU maps), order is an index sorted on the keys, used to diff
+ * hash maps, whose iteration order changes between snapshots.
+ */
+struct snapshot {
+    void *keys;
+    void *values;
+    __u64 *counters;
+    __u32 *order;
+    __u32 count;
+};
+
+struct map_desc {
+    int fd;
+    struct bpf_map_info info;
+    __u32 value_stride;
+    __u32 ncpus;
+    __u32 field_off;
+    int percpu;
+    int sorted;
+};
+
+struct rate {
+    __u32 idx;
+    __u64 delta;
+};
+
+static struct map_desc map;
+
+static void sigint_handler(int sig_no) {
+    exiting = 1;
+}
+
+static int find_map_by_name(const char *name, struct map_desc *m) {
+    __u32 id = 0, len;
+
+    while (!bpf_map_get_next_id(id, &id)) {
+        int fd = bpf_map_get_fd_by_id(id);
+
+        if (fd < 0)
+            continue;
+
+        len = sizeof(m->info);
+        memset(&m->info, 0, len);
+        /* Kernel map names are truncated to BPF_OBJ_NAME_LEN - 1 chars */
+        if (!bpf_obj_get_info_by_fd(fd, &m->info, &len) &&
+            !strncmp(m->info.name, name, BPF_OBJ_NAME_LEN - 1)) {
+            m->fd = fd;
+            return 0;
+        }
+        close(fd);
+    }
+
+    return -ENOENT;
+}
+
+static const struct btf_type *skip_mods(const struct btf *btf, const struct btf_type *t) {
+    while (t && (btf_kind(t) == BTF_KIND_TYPEDEF || btf_kind(t) == BTF_KIND_CONST ||
+                 btf_kind(t) == BTF_KIND_VOLATILE))
+        t = btf__type_by_id(btf, t->type);
+    return t;
+}
+
+/* Find the byte offset of the 64-bit counter to watch inside the value */
+static int find_field(struct map_desc *m, const char *field) {
+    const struct btf_type *t;
+    struct btf_member *member;
+    struct btf *btf;
+    int err = -ENOENT;
+
+    if (m->info.value_size == sizeof(__u64)) {
+        m->field_off = 0;
+        return 0;
+    }
+
+    if (!m->info.btf_id || !m->info.btf_value_type_id) {
+        log_error("Map %s has no BTF, cannot find field %s", m->info.name, field);
+        return -EINVAL;
+    }
+
+    btf = btf__load_from_kernel_by_id(m->info.btf_id);
+    if (!btf) {
+        log_error("Failed to load BTF of map %s: %s", m->info.name, strerror(errno));
+        return -errno;
+    }
+
+    t = skip_mods(btf, btf__type_by_id(btf, m->info.btf_value_type_id));
+    if (!t || !btf_is_struct(t)) {
+        log_error("Value of map %s is not a struct", m->info.name);
+        err = -EINVAL;
+        goto out;
+    }
+
+    member = btf_members(t);
+    for (int i = 0; i < btf_vlen(t); i++, member++) {
+        __u32 bit_off = BTF_INFO_KFLAG(t->info) ? BTF_MEMBER_BIT_OFFSET(member->offset)
+                                                 : member->offset;
+
+        if (strcmp(btf__name_by_offset(btf, member->name_off), field))
+            continue;
+
+        if (btf__resolve_size(btf, member->type) != sizeof(__u64) || bit_off % 8) {
+            log_error("Field %s is not a 64-bit counter", field);
+            err = -EINVAL;
+            goto out;
+        }
+        m->field_off = bit_off / 8;
+        err = 0;
+        goto out;
+    }
+
+    log_error("Field %s not found in the value of map %s", field, m->info.name);
+
+out:
+    btf__free(btf);
+    return err;
+}
+
+static int snapshot_alloc(struct snapshot *s, const struct map_desc *m) {
+    __u32 n = m->info.max_entries;
+
+    s->keys = malloc((size_t)n * m->info.key_size);
+    s->values = malloc((size_t)n * m->value_stride);
+    s->counters = malloc((size_t)n * sizeof(*s->counters));
+    s->order = malloc((size_t)n * sizeof(*s->order));
+    s->count = 0;
+    return s->keys && s->values && s->counters && s->order ? 0 : -ENOMEM;
+}
+
+static void snapshot_free(struct snapshot *s) {
+    free(s->keys);
+    free(s->values);
+    free(s->counters);
+    free(s->order);
+}
+
+static const struct snapshot *sort_snap;
+
+static int cmp_keys(const void *a, const void *b) {
+    __u32 ks = map.info.key_size;
+
+    return memcmp((__u8 *)sort_snap->keys + (size_t)*(const __u32 *)a * ks,
+                  (__u8 *)sort_snap->keys + (size_t)*(const __u32 *)b * ks, ks);
+}
+
+/* Read the whole map: with buffers sized on max_entries the kernel fills
+ * them in one call, the loop only matters if the map is modified while
+ * being read (e.g., a hash bucket that does not fit anymore).
+ */
+static int snapshot_take(struct snapshot *s, const struct map_desc *m) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    __u64 token[2], next[2];
+    void *in = NULL;
+    int err;
+
+    s->count = 0;
+    while (s->count < m->info.max_entries) {
+        __u32 n = m->info.max_entries - s->count;
+
+        err = bpf_map_lookup_batch(m->fd, in, next,
+                                   (__u8 *)s->keys + (size_t)s->count * m->info.key_size,
+                                   (__u8 *)s->values + (size_t)s->count * m->value_stride, &n,
+                                   &opts);
+        s->count += n;
+        if (err) {
+            if (errno == ENOENT)
+                break;
+            log_error("bpf_map_lookup_batch failed: %s", strerror(errno));
+            return -errno;
+        }
+        memcpy(token, next, sizeof(token));
+        in = token;
+    }
+
+    for (__u32 i = 0; i < s->count; i++) {
+        const __u8 *val = (const __u8 *)s->values + (size_t)i * m->value_stride;
+        __u64 sum = 0;
+
+        /* Per-CPU values are laid out as ncpus slots of round_up(size, 8) */
+        for (__u32 cpu = 0; cpu < m->ncpus; cpu++) {
+            __u64 c;
+
+            memcpy(&c, val + (size_t)cpu * ((m->info.value_size + 7) & ~7) + m->field_off,
+                   sizeof(c));
+            sum += c;
+        }
+        s->counters[i] = sum;
+        s->order[i] = i;
+    }
+
+    if (m->sorted) {
+        sort_snap = s;
+        qsort(s->order, s->count, sizeof(*s->order), cmp_keys);
+    }
+
+    return 0;
+}
+
+static void format_key(const struct map_desc *m, const void *key, char *buf, size_t len) {
+    if (m->info.key_size == sizeof(__u32) && m->info.type == BPF_MAP_TYPE_ARRAY) {
+        snprintf(buf, len, "[%u]", *(const __u32 *)key);
+    } else if (m->info.key_size == sizeof(__u32)) {
+        inet_ntop(AF_INET, key, buf, len);
+    } else {
+        size_t off = 0;
+
+        for (__u32 i = 0; i < m->info.key_size && off + 3 < len; i++)
+            off += snprintf(buf + off, len - off, "%02x", ((const __u8 *)key)[i]);
+    }
+}
+
+static int cmp_rates(const void *a, const void *b) {
+    const struct rate *ra = a, *rb = b;
+
+    return ra->delta < rb->delta ? 1 : ra->delta > rb->delta ? -1 : 0;
+}
+
+/* Diff two snapshots: arrays keep their index, hash maps are merged on the
+ * sorted keys. Entries that were not in the previous snapshot start from 0.
+ */
+static void print_rates(const struct map_desc *m, const struct snapshot *prev,
+                        const struct snapshot *cur, struct rate *rates, int interval, int top) {
+    __u32 nrates = 0, p = 0;
+    __u64 total = 0;
+    char key[64];
+
+    for (__u32 c = 0; c < cur->count; c++) {
+        __u32 ci = cur->order[c];
+        const void *ck = (const __u8 *)cur->keys + (size_t)ci * m->info.key_size;
+        __u64 before = 0;
+        int cmp = 1;
+
+        while (p < prev->count) {
+            __u32 pi = prev->order[p];
+
+            cmp = m->sorted ? memcmp((const __u8 *)prev->keys + (size_t)pi * m->info.key_size, ck,
+                                     m->info.key_size)
+                            : (int)(pi > ci) - (int)(pi < ci);
+            if (cmp >= 0)
+                break;
+            p++;
+        }
+        if (p < prev->count && cmp == 0)
+            before = prev->counters[prev->order[p]];
+
+        if (cur->counters[ci] > before) {
+            rates[nrates].idx = ci;
+            rates[nrates].delta = cur->counters[ci] - before;
+            total += rates[nrates].delta;
+            nrates++;
+        }
+    }
+
+    qsort(rates, nrates, sizeof(*rates), cmp_rates);
+
+    log_info("%s: %u entries, %u active, %.0f/s total", m->info.name, cur->count, nrates,
+             (double)total / interval);
+    for (__u32 i = 0; i < nrates && i < (__u32)top; i++) {
+        format_key(m, (const __u8 *)cur->keys + (size_t)rates[i].idx * m->info.key_size, key,
+                   sizeof(key));
+        log_info("  %-18s %12.0f/s (total %llu)", key, (double)rates[i].delta / interval,
+                 cur->counters[rates[i].idx]);
+    }
+}
+
+int main(int argc, const char **argv) {
+    struct snapshot snaps[2] = {0};
+    struct rate *rates = NULL;
+    const char *map_name = NULL;
+    const char *field = "packets_rcvd";
+    int interval = 1, top = 10;
+    int cur = 0, err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('m', "map", &map_name, "Name of the map (e.g., threshold_map)", NULL, 0, 0),
+        OPT_STRING('f', "field", &field, "Counter field of the value, if it is a struct", NULL, 0,
+                   0),
+        OPT_INTEGER('i', "interval", &interval, "Polling interval in seconds", NULL, 0, 0),
+        OPT_INTEGER('n', "top", &top, "Number of entries to print", NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software periodically dumps a BPF map with bpf_map_lookup_batch and "
+                      "prints the per-entry rates of one of its counters",
+                      "\nThe map is looked up by name among the ones loaded in the kernel");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (map_name == NULL) {
+        log_error("Error, you must specify the name of the map");
+        exit(1);
+    }
+
+    if (interval < 1) {
+        log_error("The interval must be at least one second");
+        exit(1);
+    }
+
+    if (find_map_by_name(map_name, &map)) {
+        log_fatal("Map %s not found, is the program loaded?", map_name);
+        exit(1);
+    }
+
+    switch (map.info.type) {
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+        map.percpu = 1;
+        break;
+    case BPF_MAP_TYPE_ARRAY:
+    case BPF_MAP_TYPE_HASH:
+    case BPF_MAP_TYPE_LRU_HASH:
+        break;
+    default:
+        log_fatal("Map type %u does not support batch lookups", map.info.type);
+        err = -1;
+        goto cleanup;
+    }
+    map.sorted = map.info.type != BPF_MAP_TYPE_ARRAY && map.info.type != BPF_MAP_TYPE_PERCPU_ARRAY;
+    map.ncpus = map.percpu ? libbpf_num_possible_cpus() : 1;
+    map.value_stride = map.percpu ? ((map.info.value_size + 7) & ~7) * map.ncpus
+                                  : map.info.value_size;
+
+    if (find_field(&map, field)) {
+        err = -1;
+        goto cleanup;
+    }
+
+    rates = malloc((size_t)map.info.max_entries * sizeof(*rates));
+    if (!rates || snapshot_alloc(&snaps[0], &map) || snapshot_alloc(&snaps[1], &map)) {
+        log_fatal("Cannot allocate the buffers for %u entries", map.info.max_entries);
+        err = -1;
+        goto cleanup;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigint_handler;
+
+    if (sigaction(SIGINT, &action, NULL) == -1) {
+        log_error("sigation failed");
+        err = -1;
+        goto cleanup;
+    }
+
+    log_info("Watching map %s (id %u, %u max entries)", map.info.name, map.info.id,
+             map.info.max_entries);
+
+    if (snapshot_take(&snaps[cur], &map)) {
+        err = -1;
+        goto cleanup;
+    }
+
+    while (!exiting) {
+        sleep(interval);
+        if (exiting)
+            break;
+
+        if (snapshot_take(&snaps[!cur], &map)) {
+            err = -1;
+            break;
+        }
+        print_rates(&map, &snaps[cur], &snaps[!cur], rates, interval, top);
+        cur = !cur;
+    }
+
+cleanup:
+    snapshot_free(&snaps[0]);
+    snapshot_free(&snaps[1]);
+    free(rates);
+    if (map.fd > 0)
+        close(map.fd);
+    log_info("Program stopped correctly");
+    return -err;
+}
@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+#
+# Functional equivalence of the P4 and eBPF versions of the same function:
+# the same packets are run through bmv2 (simple_switch with pcap files as
+# ports) and through the XDP program (xdp_replay, i.e., BPF_PROG_TEST_RUN),
+# then the output packets and the verdicts are compared.
+#
+# Every case is a YAML file (see the equiv folder) with the P4 program and its
+# table entries, the BPF object and its configuration, and the input packets,
+# written as scapy expressions with the port where they are received.
+
+import argparse
+import difflib
+import os
+import shutil
+import signal
+import socket
+import string
+import struct
+import subprocess
+import sys
+import time
+
+import yaml
+from scapy.all import *  # noqa: F401,F403 (the packets of the cases are scapy expressions)
+from scapy.all import Ether, NoPayload
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+IFACE_PREFIX = 'p4eq'
+THRIFT_PORT = 9090
+
+PCAP_MAGIC_USEC = 0xa1b2c3d4
+PCAP_MAGIC_NSEC = 0xa1b23c4d
+LINKTYPE_ETHERNET = 1
+
+FORWARDED = ('XDP_PASS', 'XDP_TX', 'XDP_REDIRECT')
+
+
+def write_pcap(path, packets):
+    """packets: list of (timestamp in us, bytes)"""
+    with open(path, 'wb') as f:
+        f.write(struct.pack('=IHHiIII', PCAP_MAGIC_USEC, 2, 4, 0, 0, 65535, LINKTYPE_ETHERNET))
+        for ts, data in packets:
+            f.write(struct.pack('=IIII', ts // 1000000, ts % 1000000, len(data), len(data)))
+            f.write(data)
+
+
+def read_pcap(path):
+    """Returns a list of (timestamp in ns, bytes)"""
+    packets = []
+    with open(path, 'rb') as f:
+        buf = f.read()
+    if len(buf) < 24:
+        return packets
+
+    for endian in ('<', '>'):
+        magic = struct.unpack(endian + 'I', buf[:4])[0]
+        if magic in (PCAP_MAGIC_USEC, PCAP_MAGIC_NSEC):
+            break
+    else:
+        raise ValueError('%s is not a pcap file' % path)
+    unit = 1 if magic == PCAP_MAGIC_NSEC else 1000
+
+    off = 24
+    while off + 16 <= len(buf):
+        sec, frac, caplen, _ = struct.unpack(endian + 'IIII', buf[off:off + 16])
+        off += 16
+        packets.append((sec * 1000000000 + frac * unit, buf[off:off + caplen]))
+        off += caplen
+    return packets
+
+
+def pcapng_block(btype, body):
+    body += b'\x00' * (-len(body) % 4)
+    length = len(body) + 12
+    return struct.pack('=II', btype, length) + body + struct.pack('=I', length)
+
+
+def write_pcapng(path, nports, packets):
+    """packets: list of (port, timestamp in us, bytes); interface N-1 is port N"""
+    with open(path, 'wb') as f:
+        f.write(pcapng_block(0x0a0d0d0a, struct.pack('=IHHq', 0x1a2b3c4d, 1, 0, -1)))
+        for _ in range(nports):
+            f.write(pcapng_block(0x00000001, struct.pack('=HHI', LINKTYPE_ETHERNET, 0, 65535)))
+        for port, ts, data in packets:
+            f.write(pcapng_block(0x00000006, struct.pack('=IIIII', port - 1, ts >> 32,
+                                                         ts & 0xffffffff, len(data), len(data)) +
+                                 data))
+
+
+def build_inputs(case):
+    """Returns the list of (port, bytes) of the case, in order"""
+    inputs = []
+    for entry in case['inputs']:
+        pkt = eval(entry['packet'])
+        inputs += [(entry['port'], bytes(pkt))] * entry.get('count', 1)
+    return inputs
+
+
+def create_ifaces(nports):
+    """Dummy interfaces, only needed for their ifindex (ingress_ifindex and
+    redirect targets of the XDP program)"""
+    ifindexes = {}
+    for port in range(1, nports + 1):
+        name = '%s%d' % (IFACE_PREFIX, port)
+        subprocess.run(['ip', 'link', 'del', name], stderr=subprocess.DEVNULL)
+        subprocess.run(['ip', 'link', 'add', name, 'type', 'dummy'], check=True)
+        subprocess.run(['ip', 'link', 'set', name, 'up'], check=True)
+        with open('/sys/class/net/%s/ifindex' % name) as f:
+            ifindex = int(f.read())
+        # Decimal for globals, raw bytes for map entries (e.g., a devmap)
+        ifindexes['ifindex%d' % port] = ifindex
+        ifindexes['ifindex%d_hex' % port] = struct.pack('=I', ifindex).hex(' ')
+    return ifindexes
+
+
+def delete_ifaces(nports):
+    for port in range(1, nports + 1):
+        subprocess.run(['ip', 'link', 'del', '%s%d' % (IFACE_PREFIX, port)],
+                       stderr=subprocess.DEVNULL)
+
+
+def run_xdp(case, case_dir, work_dir, nports, inputs, ifindexes):
+    """Returns one (verdict, output bytes or None) per input packet"""
+    xdp = case['xdp']
+    trace = os.path.join(work_dir, 'xdp_in.pcapng')
+    out = os.path.join(work_dir, 'xdp_out.pcap')
+    verdicts_file = os.path.join(work_dir, 'xdp_verdicts.txt')
+
+    # One microsecond apart, so that the order is kept by both targets
+    write_pcapng(trace, nports, [(port, i, data) for i, (port, data) in enumerate(inputs)])
+
+    cmd = [os.path.join(TOOLS_DIR, 'xdp_replay'), '-o', os.path.join(case_dir, xdp['obj']),
+           '-r', trace, '-w', out, '-V', verdicts_file,
+           '-I', ','.join('%s%d' % (IFACE_PREFIX, p) for p in range(1, nports + 1))]
+
+    if 'prog' in xdp:
+        cmd += ['-p', xdp['prog']]
+
+    # Configuration of xdp_replay, ${ifindexN} and ${ifindexN_hex} are the
+    # ifindex of port N
+    if 'config' in xdp:
+        config = os.path.join(work_dir, 'replay.yaml')
+        with open(config, 'w') as f:
+            f.write(string.Template(xdp['config']).substitute(ifindexes))
+        cmd += ['-c', config]
+
+    with open(os.path.join(work_dir, 'xdp_replay.log'), 'w') as log:
+        subprocess.run(cmd, stdout=log, stderr=subprocess.STDOUT, check=True)
+
+    outputs = iter(read_pcap(out))
+    results = []
+    with open(verdicts_file) as f:
+        for line in f:
+            _, verdict, _ = line.split()
+            results.append((verdict, next(outputs)[1] if verdict in FORWARDED else None))
+    return results
+
+
+def wait_thrift(timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', THRIFT_PORT), timeout=0.5).close()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def run_bmv2(case, case_dir, work_dir, nports, inputs, wait):
+    """Returns the output packets as a list of (port, bytes), in order"""
+    name = os.path.splitext(os.path.basename(case['p4']))[0]
+    json_file = os.path.join(work_dir, name + '.json')
+
+    subprocess.run(['p4c', '--target', 'bmv2', '--arch', 'v1model', '-o', work_dir,
+                    os.path.join(case_dir, case['p4'])], check=True)
+
+    # Port N reads portN_in.pcap and writes portN_out.pcap; bmv2 reads the
+    # files in the order of the timestamps of the packets
+    for port in range(1, nports + 1):
+        write_pcap(os.path.join(work_dir, 'port%d_in.pcap' % port),
+                   [(i, data) for i, (p, data) in enumerate(inputs) if p == port])
+        out = os.path.join(work_dir, 'port%d_out.pcap' % port)
+        if os.path.exists(out):
+            os.remove(out)
+
+    cmd = ['simple_switch', '--log-level', 'off', '--thrift-port', str(THRIFT_PORT),
+           '--use-files', str(wait)]
+    for port in range(1, nports + 1):
+        cmd += ['-i', '%d@port%d' % (port, port)]
+    cmd.append(json_file)
+
+    log = open(os.path.join(work_dir, 'simple_switch.log'), 'w')
+    switch = subprocess.Popen(cmd, cwd=work_dir, stdout=log, stderr=subprocess.STDOUT)
+    try:
+        # The table entries must be written before the files are read
+        if not wait_thrift(wait):
+            raise RuntimeError('simple_switch did not start, see simple_switch.log')
+        subprocess.run(['simple_switch_CLI', '--thrift-port', str(THRIFT_PORT)],
+                       input=case.get('commands', ''), text=True, stdout=subprocess.DEVNULL,
+                       check=True)
+
+        # Done when the output files stop growing
+        time.sleep(wait)
+        sizes = None
+        while True:
+            time.sleep(1)
+            new_sizes = [os.path.getsize(os.path.join(work_dir, 'port%d_out.pcap' % p))
+                         if os.path.exists(os.path.join(work_dir, 'port%d_out.pcap' % p)) else 0
+                         for p in range(1, nports + 1)]
+            if new_sizes == sizes:
+                break
+            sizes = new_sizes
+    finally:
+        switch.send_signal(signal.SIGTERM)
+        switch.wait()
+        log.close()
+
+    outputs = []
+    for port in range(1, nports + 1):
+        out = os.path.join(work_dir, 'port%d_out.pcap' % port)
+        if os.path.exists(out):
+            outputs += [(ts, port, data) for ts, data in read_pcap(out)]
+    outputs.sort()
+    return [(port, data) for _, port, data in outputs]
+
+
+def field_diff(a, b):
+    """Differences between two packets, field by field"""
+    diffs = []
+    la, lb = Ether(a), Ether(b)
+    while not isinstance(la, NoPayload) and not isinstance(lb, NoPayload):
+        if type(la) is not type(lb):
+            diffs.append('%s != %s' % (la.name, lb.name))
+            return diffs
+        for f in la.fields_desc:
+            va, vb = la.getfieldval(f.name), lb.getfieldval(f.name)
+            if f.name != 'load' and va != vb:
+                diffs.append('%s.%s: %s != %s' % (la.name, f.name, va, vb))
+        la, lb = la.payload, lb.payload
+    if not diffs:
+        diffs.append('payload: %d != %d bytes' % (len(a), len(b)))
+    return diffs
+
+
+def compare(inputs, xdp, bmv2, max_diffs):
+    """Aligns the packets forwarded by XDP (in the order of the inputs) with
+    the ones sent out by bmv2 and returns the number of differences"""
+    xdp_out = [(i, verdict, data) for i, (verdict, data) in enumerate(xdp) if data is not None]
+    matcher = difflib.SequenceMatcher(None, [d for _, _, d in xdp_out], [d for _, d in bmv2],
+                                      autojunk=False)
+    diffs = []
+
+    for tag, i1, i2, j1, j2 in matcher.get_opcodes():
+        if tag == 'equal':
+            for (i, verdict, _), (port, _) in zip(xdp_out[i1:i2], bmv2[j1:j2]):
+                # The egress port is only known for XDP_TX
+                if verdict == 'XDP_TX' and port != inputs[i][0]:
+                    diffs.append('packet %d: XDP_TX on port %d, bmv2 sent it to port %d' %
+                                 (i, inputs[i][0], port))
+            continue
+
+        pairs = list(zip(xdp_out[i1:i2], bmv2[j1:j2]))
+        for (i, verdict, a), (port, b) in pairs:
+            diffs.append('packet %d: %s and bmv2 port %d differ: %s' %
+                         (i, verdict, port, '; '.join(field_diff(a, b))))
+        for i, verdict, _ in xdp_out[i1 + len(pairs):i2]:
+            diffs.append('packet %d: %s, dropped by bmv2' % (i, verdict))
+        for port, b in bmv2[j1 + len(pairs):j2]:
+            diffs.append('bmv2 sent to port %d a packet that XDP dropped: %s' %
+                         (port, Ether(b).summary()))
+
+    for d in diffs[:max_diffs]:
+        print('  ' + d)
+    if len(diffs) > max_diffs:
+        print('  ... %d more' % (len(diffs) - max_diffs))
+    return len(diffs)
+
+
+def run_case(path, args):
+    with open(path) as f:
+        case = yaml.safe_load(f)
+    case_dir = os.path.dirname(os.path.abspath(path))
+    name = case.get('name', os.path.splitext(os.path.basename(path))[0])
+    nports = case['ports']
+    work_dir = os.path.join(args.work_dir, name)
+    os.makedirs(work_dir, exist_ok=True)
+
+    inputs = build_inputs(case)
+    ifindexes = create_ifaces(nports)
+    try:
+        xdp = run_xdp(case, case_dir, work_dir, nports, inputs, ifindexes)
+    finally:
+        delete_ifaces(nports)
+    bmv2 = run_bmv2(case, case_dir, work_dir, nports, inputs, args.wait)
+
+    verdicts = {}
+    for verdict, _ in xdp:
+        verdicts[verdict] = verdicts.get(verdict, 0) + 1
+    ports = {}
+    for port, _ in bmv2:
+        ports[port] = ports.get(port, 0) + 1
+
+    print('[%s] %d packets' % (name, len(inputs)))
+    print('  XDP:  %s' % ', '.join('%s %d' % v for v in sorted(verdicts.items())))
+    print('  bmv2: %s, dropped %d' % (', '.join('port %d %d' % p for p in sorted(ports.items())),
+                                      len(inputs) - len(bmv2)))
+    ndiffs = compare(inputs, xdp, bmv2, args.max_diffs)
+    print('  %s (files in %s)' % ('EQUIVALENT' if not ndiffs else '%d differences' % ndiffs,
+                                  work_dir))
+    return ndiffs == 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the same packets through bmv2 and XDP and '
+                                     'compare the output packets and verdicts')
+    parser.add_argument('cases', nargs='+', help='YAML files of the cases (see equiv/)')
+    parser.add_argument('-w', '--work-dir', default='.p4equiv',
+                        help='Where the traces and logs are written (default: .p4equiv)')
+    parser.add_argument('-t', '--wait', type=int, default=3,
+                        help='Seconds bmv2 waits for the table entries before reading the files')
+    parser.add_argument('-m', '--max-diffs', type=int, default=10,
+                        help='Differences printed for every case')
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        print('BPF_PROG_TEST_RUN and the dummy interfaces need root privileges')
+        sys.exit(1)
+
+    for tool in ('p4c', 'simple_switch', 'simple_switch_CLI'):
+        if not shutil.which(tool):
+            print('%s not found (it is installed in the VM of the P4 labs)' % tool)
+            sys.exit(1)
+
+    ok = True
+    for path in args.cases:
+        ok &= run_case(path, args)
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
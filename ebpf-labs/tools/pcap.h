@@ -0,0 +1,306 @@
+#ifndef PCAP_H_
+#define PCAP_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/* Minimal streaming reader for pcap and pcapng traces. The file is mmap'd
+ * (with MADV_SEQUENTIAL, so that the kernel reads ahead) and the packets are
+ * returned as pointers into the mapping: nothing is copied. A writer of
+ * (nanosecond, Ethernet) pcap files is also provided.
+ */
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_HDR_LEN 24
+#define PCAP_REC_HDR_LEN 16
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_MAX_IFACES 32
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+#define PCAP_LINKTYPE_ETHERNET 1
+
+enum pcap_format {
+    PCAP_FORMAT_PCAP,
+    PCAP_FORMAT_PCAPNG,
+};
+
+struct pcap_file {
+    int fd;
+    const __u8 *map;
+    size_t size;
+    size_t off;
+    enum pcap_format format;
+    bool swap;
+    /* pcap: one link type and timestamp unit for the whole file */
+    __u32 linktype;
+    __u64 ts_unit_ns;
+    /* pcapng: per-interface link type and timestamp resolution */
+    __u32 nifaces;
+    __u32 if_linktype[PCAPNG_MAX_IFACES];
+    __u64 if_tsresol[PCAPNG_MAX_IFACES]; /* units per second */
+};
+
+struct pcap_pkt {
+    const __u8 *data;
+    __u32 caplen;
+    __u32 len;
+    __u32 linktype;
+    __u64 ts_ns;
+    /* pcapng: interface of the packet (0 for pcap) */
+    __u32 ifid;
+};
+
+static inline __u32 pcap_u32(const struct pcap_file *f, const __u8 *p) {
+    __u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return f->swap ? __builtin_bswap32(v) : v;
+}
+
+static inline __u16 pcap_u16(const struct pcap_file *f, const __u8 *p) {
+    __u16 v;
+
+    memcpy(&v, p, sizeof(v));
+    return f->swap ? __builtin_bswap16(v) : v;
+}
+
+static inline void pcap_close(struct pcap_file *f) {
+    if (f->map && f->map != MAP_FAILED)
+        munmap((void *)f->map, f->size);
+    if (f->fd > 0)
+        close(f->fd);
+    memset(f, 0, sizeof(*f));
+}
+
+static inline int pcap_open(struct pcap_file *f, const char *path) {
+    struct stat st;
+    __u32 magic;
+
+    memset(f, 0, sizeof(*f));
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    if (fstat(f->fd, &st) || st.st_size < PCAP_HDR_LEN) {
+        log_error("%s is not a valid trace", path);
+        pcap_close(f);
+        return -EINVAL;
+    }
+
+    f->size = st.st_size;
+    f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+    if (f->map == MAP_FAILED) {
+        log_error("Failed to mmap %s: %s", path, strerror(errno));
+        pcap_close(f);
+        return -errno;
+    }
+    madvise((void *)f->map, f->size, MADV_SEQUENTIAL);
+
+    memcpy(&magic, f->map, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        /* Byte order and interfaces are read from the blocks */
+        f->format = PCAP_FORMAT_PCAPNG;
+        return 0;
+    }
+
+    f->format = PCAP_FORMAT_PCAP;
+    if (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        f->swap = true;
+        magic = __builtin_bswap32(magic);
+    }
+
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+        log_error("%s is neither a pcap nor a pcapng file", path);
+        pcap_close(f);
+        return -EINVAL;
+    }
+
+    f->ts_unit_ns = magic == PCAP_MAGIC_NSEC ? 1 : 1000;
+    f->linktype = pcap_u32(f, f->map + 20) & 0x0fffffff;
+    f->off = PCAP_HDR_LEN;
+    return 0;
+}
+
+static inline int pcap_next_pcap(struct pcap_file *f, struct pcap_pkt *pkt) {
+    const __u8 *rec = f->map + f->off;
+
+    if (f->off + PCAP_REC_HDR_LEN > f->size)
+        return 0;
+
+    pkt->caplen = pcap_u32(f, rec + 8);
+    pkt->len = pcap_u32(f, rec + 12);
+    if (f->off + PCAP_REC_HDR_LEN + pkt->caplen > f->size) {
+        log_warn("Truncated record at offset %zu", f->off);
+        return 0;
+    }
+
+    pkt->ts_ns = (__u64)pcap_u32(f, rec) * 1000000000ULL + pcap_u32(f, rec + 4) * f->ts_unit_ns;
+    pkt->data = rec + PCAP_REC_HDR_LEN;
+    pkt->linktype = f->linktype;
+    pkt->ifid = 0;
+    f->off += PCAP_REC_HDR_LEN + pkt->caplen;
+    return 1;
+}
+
+/* Read the if_tsresol option of an IDB (default: microseconds) */
+static inline __u64 pcapng_tsresol(const struct pcap_file *f, const __u8 *opt, const __u8 *end) {
+    while (opt + 4 <= end) {
+        __u16 code = pcap_u16(f, opt), len = pcap_u16(f, opt + 2);
+
+        if (code == 0)
+            break;
+        if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1 && opt + 5 <= end) {
+            __u8 v = opt[4];
+            __u64 res = 1;
+
+            /* MSB set: power of two, otherwise power of ten */
+            for (int i = 0; i < (v & 0x7f) && i < 19; i++)
+                res *= (v & 0x80) ? 2 : 10;
+            return res;
+        }
+        opt += 4 + ((len + 3) & ~3);
+    }
+
+    return 1000000;
+}
+
+static inline int pcap_next_pcapng(struct pcap_file *f, struct pcap_pkt *pkt) {
+    while (f->off + 12 <= f->size) {
+        const __u8 *blk = f->map + f->off;
+        __u32 type, blen;
+
+        if (pcap_u32(f, blk) == PCAPNG_SHB) {
+            __u32 bom;
+
+            /* Every section can have its own byte order */
+            memcpy(&bom, blk + 8, sizeof(bom));
+            f->swap = bom != PCAPNG_BYTE_ORDER_MAGIC;
+            f->nifaces = 0;
+        }
+
+        type = pcap_u32(f, blk);
+        blen = pcap_u32(f, blk + 4);
+        if (blen < 12 || (blen & 3) || f->off + blen > f->size) {
+            log_warn("Invalid block at offset %zu", f->off);
+            return 0;
+        }
+        f->off += blen;
+
+        switch (type) {
+        case PCAPNG_IDB:
+            if (f->nifaces < PCAPNG_MAX_IFACES && blen >= 20) {
+                f->if_linktype[f->nifaces] = pcap_u16(f, blk + 8);
+                f->if_tsresol[f->nifaces] = pcapng_tsresol(f, blk + 16, blk + blen - 4);
+                f->nifaces++;
+            }
+            break;
+        case PCAPNG_EPB: {
+            __u32 ifid = pcap_u32(f, blk + 8);
+            __u64 ts, res;
+
+            if (blen < 32 || ifid >= f->nifaces)
+                break;
+
+            ts = ((__u64)pcap_u32(f, blk + 12) << 32) | pcap_u32(f, blk + 16);
+            res = f->if_tsresol[ifid];
+            pkt->ts_ns = ts / res * 1000000000ULL + ts % res * 1000000000ULL / res;
+            pkt->caplen = pcap_u32(f, blk + 20);
+            pkt->len = pcap_u32(f, blk + 24);
+            if (pkt->caplen > blen - 32)
+                break;
+            pkt->data = blk + 28;
+            pkt->linktype = f->if_linktype[ifid];
+            pkt->ifid = ifid;
+            return 1;
+        }
+        case PCAPNG_SPB:
+            if (blen < 16 || !f->nifaces)
+                break;
+
+            pkt->ts_ns = 0;
+            pkt->len = pcap_u32(f, blk + 8);
+            pkt->caplen = pkt->len < blen - 16 ? pkt->len : blen - 16;
+            pkt->data = blk + 12;
+            pkt->linktype = f->if_linktype[0];
+            pkt->ifid = 0;
+            return 1;
+        default:
+            /* SHB, statistics, name resolution, ... */
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Return 1 and fill pkt with the next packet, 0 at the end of the trace */
+static inline int pcap_next(struct pcap_file *f, struct pcap_pkt *pkt) {
+    if (f->format == PCAP_FORMAT_PCAPNG)
+        return pcap_next_pcapng(f, pkt);
+    return pcap_next_pcap(f, pkt);
+}
+
+struct pcap_writer {
+    FILE *fp;
+};
+
+static inline int pcap_writer_open(struct pcap_writer *w, const char *path) {
+    /* Written in host byte order, readers detect it from the magic */
+    struct {
+        __u32 magic;
+        __u16 version_major;
+        __u16 version_minor;
+        __s32 thiszone;
+        __u32 sigfigs;
+        __u32 snaplen;
+        __u32 linktype;
+    } hdr = {PCAP_MAGIC_NSEC, 2, 4, 0, 0, 65535, PCAP_LINKTYPE_ETHERNET};
+
+    w->fp = fopen(path, "w");
+    if (!w->fp) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, w->fp) != 1) {
+        log_error("Failed to write the header of %s", path);
+        fclose(w->fp);
+        w->fp = NULL;
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static inline int pcap_write(struct pcap_writer *w, const void *data, __u32 len, __u64 ts_ns) {
+    __u32 rec[4] = {ts_ns / 1000000000ULL, ts_ns % 1000000000ULL, len, len};
+
+    if (fwrite(rec, sizeof(rec), 1, w->fp) != 1 || fwrite(data, len, 1, w->fp) != 1)
+        return -EIO;
+    return 0;
+}
+
+static inline void pcap_writer_close(struct pcap_writer *w) {
+    if (w->fp)
+        fclose(w->fp);
+    w->fp = NULL;
+}
+
+#endif // PCAP_H_
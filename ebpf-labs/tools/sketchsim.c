@@ -0,0 +1,634 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/types.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <argparse.h>
+
+#include "fasthash.h"
+#include "jhash.h"
+#include "log.h"
+#include "pcap.h"
+#include "sketch_hash_batch.h"
+
+/* Same seeds of the HHDv2 XDP program */
+#define FASTHASH_SEED 0xdeadbeef
+#define JHASH_SEED 0x2d31e867
+
+#define MAX_THREADS 64
+#define MAX_CANDIDATES 32
+#define VLAN_HLEN 4
+/* As parse_ipv6hdr() of the XDP program */
+#define IPV6_EXT_MAX_CHAIN 6
+#define IPV6_FRAG_HDR_LEN 8
+#define IPV6_FRAG_OFFSET 0xfff8
+
+static const char *const usages[] = {
+    "sketchsim [options] [[--] args]",
+    "sketchsim [options]",
+    NULL,
+};
+
+enum sketch_mode {
+    /* jhash + fasthash64 modulo the number of entries, as in the HHDv2 lab */
+    SKETCH_MODE_CLASSIC,
+    /* one fasthash64 and k rows with double hashing (sketch_hash.h) */
+    SKETCH_MODE_KM,
+};
+
+/* IPv4 flows are stored with IPv4-mapped addresses, to tell them apart
+ * from the IPv6 ones; they are still hashed as struct sketch_flow_key
+ */
+struct flow_entry {
+    struct sketch_flow_key_v6 key;
+    __u64 fh;
+    __u64 count;
+    __u32 jh;
+    __u32 used;
+};
+
+struct flow_table {
+    struct flow_entry *entries;
+    size_t mask;
+    size_t used;
+};
+
+struct candidate {
+    __u32 entries;
+    __u64 threshold;
+    __u64 heavy;
+    __u64 detected;
+    __u64 fp;
+    __u64 fn;
+    __u64 fp_pkts;
+};
+
+struct sim {
+    enum sketch_mode mode;
+    __u32 rows;
+    int nthreads;
+    /* Per-packet data, filled by the reader: the npkts4 IPv4 packets come
+     * first, then the npkts6 IPv6 ones (the order of the packets does not
+     * matter, see evaluate())
+     */
+    struct sketch_flow_key *keys;
+    struct sketch_flow_key_v6 *keys6;
+    __u64 *fh;
+    __u32 *jh;
+    size_t npkts4;
+    size_t npkts6;
+    size_t npkts;
+    /* Exact per-flow counts, one table per thread (flows are partitioned) */
+    struct flow_table tables[MAX_THREADS];
+    struct candidate candidates[MAX_CANDIDATES * MAX_CANDIDATES];
+    int ncandidates;
+};
+
+static struct sim sim;
+
+typedef void (*stage_fn)(int id);
+
+struct stage_arg {
+    stage_fn fn;
+    int id;
+};
+
+static void *stage_thread(void *arg) {
+    struct stage_arg *a = arg;
+
+    a->fn(a->id);
+    return NULL;
+}
+
+static void run_stage(stage_fn fn) {
+    pthread_t tids[MAX_THREADS];
+    struct stage_arg args[MAX_THREADS];
+
+    for (int i = 0; i < sim.nthreads; i++) {
+        args[i].fn = fn;
+        args[i].id = i;
+        if (pthread_create(&tids[i], NULL, stage_thread, &args[i])) {
+            /* Run it inline, the result is the same */
+            tids[i] = 0;
+            fn(i);
+        }
+    }
+
+    for (int i = 0; i < sim.nthreads; i++) {
+        if (tids[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+static inline void thread_slice(int id, size_t n, size_t *start, size_t *end) {
+    size_t chunk = (n + sim.nthreads - 1) / sim.nthreads;
+
+    *start = chunk * id < n ? chunk * id : n;
+    *end = *start + chunk < n ? *start + chunk : n;
+}
+
+/* Upper-layer protocol of an IPv6 packet, skipping the extension headers
+ * as the XDP program does (non-first fragments have none), or -1. *p then
+ * points to the upper-layer header.
+ */
+static int skip_ipv6_ext(const __u8 **p, const __u8 *end, __u8 nexthdr) {
+    for (int i = 0; i < IPV6_EXT_MAX_CHAIN; i++) {
+        const __u8 *opt = *p;
+        __be16 frag_off;
+
+        switch (nexthdr) {
+        case IPPROTO_HOPOPTS:
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+            if (opt + 2 > end)
+                return -1;
+            *p += (opt[1] + 1) * 8;
+            break;
+        case IPPROTO_FRAGMENT:
+            if (opt + IPV6_FRAG_HDR_LEN > end)
+                return -1;
+            memcpy(&frag_off, opt + 2, sizeof(frag_off));
+            if (frag_off & htons(IPV6_FRAG_OFFSET))
+                return IPPROTO_FRAGMENT;
+            *p += IPV6_FRAG_HDR_LEN;
+            break;
+        case IPPROTO_AH:
+            if (opt + 2 > end)
+                return -1;
+            *p += (opt[1] + 2) * 4;
+            break;
+        default:
+            return nexthdr;
+        }
+
+        nexthdr = opt[0];
+    }
+
+    return -1;
+}
+
+/* Extract the 5-tuple the way the XDP program does: only TCP and UDP over
+ * IPv4 or IPv6 are counted in the sketch. Returns 4 if key is filled, 6 if
+ * key6 is, or -1.
+ */
+static int extract_key(const struct pcap_pkt *pkt, struct sketch_flow_key *key,
+                       struct sketch_flow_key_v6 *key6) {
+    const __u8 *p = pkt->data, *end = pkt->data + pkt->caplen;
+    const struct ipv6hdr *ip6h;
+    const struct iphdr *iph;
+    __be16 proto;
+    int l4;
+
+    if (pkt->linktype != PCAP_LINKTYPE_ETHERNET || pkt->caplen < ETH_HLEN)
+        return -1;
+
+    memcpy(&proto, p + 12, sizeof(proto));
+    p += ETH_HLEN;
+    if (proto == htons(ETH_P_8021Q) || proto == htons(ETH_P_8021AD)) {
+        if (p + VLAN_HLEN > end)
+            return -1;
+        memcpy(&proto, p + 2, sizeof(proto));
+        p += VLAN_HLEN;
+    }
+
+    if (proto == htons(ETH_P_IP)) {
+        if (p + sizeof(*iph) > end)
+            return -1;
+
+        iph = (const struct iphdr *)p;
+        if (iph->ihl < 5 || (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP))
+            return -1;
+
+        p += iph->ihl * 4;
+        if (p + 4 > end)
+            return -1;
+
+        memset(key, 0, sizeof(*key));
+        key->saddr = iph->saddr;
+        key->daddr = iph->daddr;
+        memcpy(&key->sport, p, sizeof(key->sport));
+        memcpy(&key->dport, p + 2, sizeof(key->dport));
+        key->proto = iph->protocol;
+        return 4;
+    }
+
+    if (proto != htons(ETH_P_IPV6) || p + sizeof(*ip6h) > end)
+        return -1;
+
+    ip6h = (const struct ipv6hdr *)p;
+    p += sizeof(*ip6h);
+    l4 = skip_ipv6_ext(&p, end, ip6h->nexthdr);
+    if ((l4 != IPPROTO_TCP && l4 != IPPROTO_UDP) || p + 4 > end)
+        return -1;
+
+    memset(key6, 0, sizeof(*key6));
+    memcpy(key6->saddr, &ip6h->saddr, sizeof(key6->saddr));
+    memcpy(key6->daddr, &ip6h->daddr, sizeof(key6->daddr));
+    memcpy(&key6->sport, p, sizeof(key6->sport));
+    memcpy(&key6->dport, p + 2, sizeof(key6->dport));
+    key6->proto = l4;
+    return 6;
+}
+
+/* Make room for one more element in an array of *cap elements */
+static int grow(void **array, size_t *cap, size_t used, size_t size) {
+    void *tmp;
+
+    if (used < *cap)
+        return 0;
+
+    tmp = realloc(*array, 2 * *cap * size);
+    if (!tmp)
+        return -1;
+    *array = tmp;
+    *cap *= 2;
+    return 0;
+}
+
+static int read_trace(const char *path, size_t *skipped) {
+    struct sketch_flow_key_v6 *keys6 = NULL;
+    size_t cap = 1 << 20, cap6 = 1 << 10;
+    struct pcap_file f;
+    struct pcap_pkt pkt;
+
+    if (pcap_open(&f, path))
+        return -1;
+
+    sim.keys = malloc(cap * sizeof(*sim.keys));
+    keys6 = malloc(cap6 * sizeof(*keys6));
+    if (!sim.keys || !keys6)
+        goto err;
+
+    *skipped = 0;
+    while (pcap_next(&f, &pkt) > 0) {
+        if (grow((void **)&sim.keys, &cap, sim.npkts4, sizeof(*sim.keys)) ||
+            grow((void **)&keys6, &cap6, sim.npkts6, sizeof(*keys6)))
+            goto err;
+
+        switch (extract_key(&pkt, &sim.keys[sim.npkts4], &keys6[sim.npkts6])) {
+        case 4:
+            sim.npkts4++;
+            break;
+        case 6:
+            sim.npkts6++;
+            break;
+        default:
+            (*skipped)++;
+        }
+    }
+    pcap_close(&f);
+
+    sim.keys6 = keys6;
+    sim.npkts = sim.npkts4 + sim.npkts6;
+    return 0;
+
+err:
+    log_error("Cannot allocate memory for the packets of the trace");
+    free(keys6);
+    pcap_close(&f);
+    return -1;
+}
+
+/* Key of the flow of packet i, with IPv4-mapped addresses for IPv4 */
+static inline void packet_key(size_t i, struct sketch_flow_key_v6 *key) {
+    const struct sketch_flow_key *k4;
+
+    if (i >= sim.npkts4) {
+        *key = sim.keys6[i - sim.npkts4];
+        return;
+    }
+
+    k4 = &sim.keys[i];
+    memset(key, 0, sizeof(*key));
+    key->saddr[2] = key->daddr[2] = htonl(0xffff);
+    key->saddr[3] = k4->saddr;
+    key->daddr[3] = k4->daddr;
+    key->sport = k4->sport;
+    key->dport = k4->dport;
+    key->proto = k4->proto;
+}
+
+static void stage_hash(int id) {
+    size_t start, end;
+
+    /* sketch_hash() is fasthash64 with the same seed of the classic sketch.
+     * IPv4 and IPv6 keys have different sizes, so they are hashed apart.
+     */
+    thread_slice(id, sim.npkts4, &start, &end);
+    sketch_hash_batch(&sim.keys[start], end - start, &sim.fh[start]);
+    if (sim.mode == SKETCH_MODE_CLASSIC) {
+        for (size_t i = start; i < end; i++)
+            sim.jh[i] = jhash(&sim.keys[i], sizeof(sim.keys[i]), JHASH_SEED);
+    }
+
+    thread_slice(id, sim.npkts6, &start, &end);
+    sketch_hash_batch_v6(&sim.keys6[start], end - start, &sim.fh[sim.npkts4 + start]);
+    if (sim.mode == SKETCH_MODE_CLASSIC) {
+        for (size_t i = start; i < end; i++)
+            sim.jh[sim.npkts4 + i] = jhash(&sim.keys6[i], sizeof(sim.keys6[i]), JHASH_SEED);
+    }
+}
+
+static int table_grow(struct flow_table *t) {
+    size_t cap = t->entries ? 2 * (t->mask + 1) : 1 << 16;
+    struct flow_entry *entries = calloc(cap, sizeof(*entries));
+
+    if (!entries)
+        return -1;
+
+    for (size_t i = 0; t->entries && i <= t->mask; i++) {
+        struct flow_entry *e = &t->entries[i];
+        size_t pos;
+
+        if (!e->used)
+            continue;
+        for (pos = (e->fh >> 16) & (cap - 1); entries[pos].used; pos = (pos + 1) & (cap - 1))
+            ;
+        entries[pos] = *e;
+    }
+
+    free(t->entries);
+    t->entries = entries;
+    t->mask = cap - 1;
+    return 0;
+}
+
+/* Exact counts: thread id owns the flows with fh % nthreads == id, so that
+ * every table is private and no locking is needed.
+ */
+static void stage_count(int id) {
+    struct flow_table *t = &sim.tables[id];
+
+    if (table_grow(t))
+        return;
+
+    for (size_t i = 0; i < sim.npkts; i++) {
+        struct sketch_flow_key_v6 key;
+        struct flow_entry *e;
+        size_t pos;
+
+        if (sim.fh[i] % sim.nthreads != (__u64)id)
+            continue;
+
+        packet_key(i, &key);
+        for (pos = (sim.fh[i] >> 16) & t->mask;; pos = (pos + 1) & t->mask) {
+            e = &t->entries[pos];
+            if (!e->used || (e->fh == sim.fh[i] && !memcmp(&e->key, &key, sizeof(key))))
+                break;
+        }
+
+        if (!e->used) {
+            e->used = 1;
+            e->key = key;
+            e->fh = sim.fh[i];
+            e->jh = sim.mode == SKETCH_MODE_CLASSIC ? sim.jh[i] : 0;
+            e->count = 1;
+            /* Growing moves the entries, e is not valid after this */
+            if (++t->used * 10 > (t->mask + 1) * 7 && table_grow(t))
+                return;
+            continue;
+        }
+        e->count++;
+    }
+}
+
+static inline __u32 flow_index(const struct flow_entry *e, __u32 row, __u32 entries) {
+    if (sim.mode == SKETCH_MODE_CLASSIC)
+        return row == 0 ? e->jh % entries : e->fh % entries;
+    return sketch_index(e->fh, row, entries);
+}
+
+/* The sketch only depends on the per-flow counts (the counters are never
+ * reset), so each candidate is evaluated on the state at the end of the trace.
+ */
+static void evaluate(struct candidate *c, __u64 *counters) {
+    memset(counters, 0, c->entries * sizeof(*counters));
+
+    for (int t = 0; t < sim.nthreads; t++) {
+        const struct flow_table *tbl = &sim.tables[t];
+
+        for (size_t i = 0; tbl->entries && i <= tbl->mask; i++) {
+            if (!tbl->entries[i].used)
+                continue;
+            for (__u32 r = 0; r < sim.rows; r++)
+                counters[flow_index(&tbl->entries[i], r, c->entries)] += tbl->entries[i].count;
+        }
+    }
+
+    for (int t = 0; t < sim.nthreads; t++) {
+        const struct flow_table *tbl = &sim.tables[t];
+
+        for (size_t i = 0; tbl->entries && i <= tbl->mask; i++) {
+            const struct flow_entry *e = &tbl->entries[i];
+            __u64 est = UINT64_MAX;
+            bool heavy, detected;
+
+            if (!e->used)
+                continue;
+
+            for (__u32 r = 0; r < sim.rows; r++) {
+                __u64 v = counters[flow_index(e, r, c->entries)];
+
+                est = v < est ? v : est;
+            }
+
+            heavy = e->count > c->threshold;
+            detected = est > c->threshold;
+            c->heavy += heavy;
+            c->detected += detected;
+            if (detected && !heavy) {
+                c->fp++;
+                c->fp_pkts += e->count;
+            }
+            c->fn += heavy && !detected;
+        }
+    }
+}
+
+static void stage_sweep(int id) {
+    __u64 *counters = NULL;
+    __u32 max_entries = 0;
+
+    for (int i = id; i < sim.ncandidates; i += sim.nthreads) {
+        if (sim.candidates[i].entries > max_entries) {
+            max_entries = sim.candidates[i].entries;
+            free(counters);
+            counters = malloc(max_entries * sizeof(*counters));
+            if (!counters)
+                return;
+        }
+        evaluate(&sim.candidates[i], counters);
+    }
+
+    free(counters);
+}
+
+static int parse_list(const char *str, __u64 *values, int max) {
+    char *copy = strdup(str), *tok, *save = NULL;
+    int n = 0;
+
+    if (!copy)
+        return -1;
+
+    for (tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save))
+        values[n++] = strtoull(tok, NULL, 0);
+
+    free(copy);
+    return n;
+}
+
+static double elapsed(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, const char **argv) {
+    const char *trace = NULL;
+    const char *entries_str = "1024,2048,4096,8192,16384,32768,65536";
+    const char *thresholds_str = "50";
+    const char *mode_str = "classic";
+    __u64 entries[MAX_CANDIDATES], thresholds[MAX_CANDIDATES];
+    int nentries, nthresholds, rows = 2;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct timespec start;
+    size_t skipped, nflows = 0;
+    int err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('r', "read", &trace, "pcap or pcapng trace to replay", NULL, 0, 0),
+        OPT_STRING('e', "entries", &entries_str,
+                   "Comma-separated sketch sizes to evaluate (powers of two)", NULL, 0, 0),
+        OPT_STRING('t', "threshold", &thresholds_str, "Comma-separated thresholds to evaluate",
+                   NULL, 0, 0),
+        OPT_STRING('m', "mode", &mode_str, "classic (jhash + fasthash64) or km (double hashing)",
+                   NULL, 0, 0),
+        OPT_INTEGER('k', "rows", &rows, "Number of rows of the km sketch", NULL, 0, 0),
+        OPT_INTEGER('j', "threads", &nthreads, "Number of threads", NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software replays a trace through the HHDv2 sketch for several sizes "
+                      "and thresholds, and reports the errors against the exact per-flow counts",
+                      "\nOnly TCP and UDP over IPv4 and IPv6 are counted, as in the XDP program");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (trace == NULL) {
+        log_error("Error, you must specify the trace to replay");
+        exit(1);
+    }
+
+    if (!strcmp(mode_str, "classic")) {
+        sim.mode = SKETCH_MODE_CLASSIC;
+        rows = 2;
+    } else if (!strcmp(mode_str, "km")) {
+        sim.mode = SKETCH_MODE_KM;
+    } else {
+        log_error("Unknown mode %s", mode_str);
+        exit(1);
+    }
+
+    if (rows < 1 || rows > SKETCH_MAX_ROWS) {
+        log_error("The number of rows must be between 1 and %d", SKETCH_MAX_ROWS);
+        exit(1);
+    }
+    sim.rows = rows;
+
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        log_error("Number of threads must be between 1 and %d", MAX_THREADS);
+        exit(1);
+    }
+    sim.nthreads = nthreads;
+
+    nentries = parse_list(entries_str, entries, MAX_CANDIDATES);
+    nthresholds = parse_list(thresholds_str, thresholds, MAX_CANDIDATES);
+    if (nentries <= 0 || nthresholds <= 0) {
+        log_error("Invalid list of sizes or thresholds");
+        exit(1);
+    }
+
+    for (int i = 0; i < nentries; i++) {
+        if (!entries[i] || (entries[i] & (entries[i] - 1)) || entries[i] > (1ULL << 31)) {
+            log_error("Sketch size %llu is not a power of two", entries[i]);
+            exit(1);
+        }
+        for (int j = 0; j < nthresholds; j++) {
+            struct candidate *c = &sim.candidates[sim.ncandidates++];
+
+            c->entries = entries[i];
+            c->threshold = thresholds[j];
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (read_trace(trace, &skipped)) {
+        err = -1;
+        goto cleanup;
+    }
+    log_info("Read %zu packets (%zu IPv6, %zu not TCP/UDP over IP) in %.2fs", sim.npkts,
+             sim.npkts6, skipped, elapsed(&start));
+
+    sim.fh = malloc(sim.npkts * sizeof(*sim.fh) + 1);
+    sim.jh = malloc(sim.npkts * sizeof(*sim.jh) + 1);
+    if (!sim.fh || !sim.jh) {
+        log_error("Cannot allocate memory for the hashes");
+        err = -1;
+        goto cleanup;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_stage(stage_hash);
+    log_info("Hashed %zu packets in %.2fs", sim.npkts, elapsed(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_stage(stage_count);
+    for (int t = 0; t < sim.nthreads; t++) {
+        if (!sim.tables[t].entries) {
+            log_error("Cannot allocate memory for the flow tables");
+            err = -1;
+            goto cleanup;
+        }
+        nflows += sim.tables[t].used;
+    }
+    log_info("Counted %zu flows in %.2fs", nflows, elapsed(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_stage(stage_sweep);
+    log_info("Evaluated %d configurations in %.2fs", sim.ncandidates, elapsed(&start));
+
+    printf("%10s %10s %10s %10s %10s %10s %10s %12s\n", "entries", "threshold", "heavy",
+           "detected", "FP", "FN", "FP rate", "FP packets");
+    for (int i = 0; i < sim.ncandidates; i++) {
+        const struct candidate *c = &sim.candidates[i];
+        __u64 light = nflows - c->heavy;
+
+        printf("%10u %10llu %10llu %10llu %10llu %10llu %9.4f%% %12llu\n", c->entries,
+               c->threshold, c->heavy, c->detected, c->fp, c->fn,
+               light ? 100.0 * c->fp / light : 0.0, c->fp_pkts);
+    }
+
+cleanup:
+    for (int t = 0; t < MAX_THREADS; t++)
+        free(sim.tables[t].entries);
+    free(sim.keys);
+    free(sim.keys6);
+    free(sim.fh);
+    free(sim.jh);
+    return -err;
+}
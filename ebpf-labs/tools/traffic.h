@@ -0,0 +1,396 @@
+#ifndef TRAFFIC_H_
+#define TRAFFIC_H_
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/types.h>
+#include <linux/udp.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cyaml/cyaml.h>
+
+#include "log.h"
+
+/* Every generated packet carries a probe right after the L4 header, so that
+ * the receiver can tell which flow it belongs to, detect losses/reordering
+ * from the sequence number and compute the one-way latency (generator and
+ * receiver run on the same host, so they share CLOCK_REALTIME).
+ */
+#define PROBE_MAGIC 0x4e435047 /* "NCPG" */
+
+struct probe_hdr {
+    __be32 magic;
+    __be32 flow_id;
+    __be64 seq;
+    __be64 tx_ns;
+} __attribute__((packed));
+
+#define VLAN_HLEN 4
+#define MIN_FRAME_LEN 64
+#define MAX_FRAME_LEN 1514
+
+enum flow_proto { FLOW_PROTO_UDP, FLOW_PROTO_TCP };
+enum flow_dist { FLOW_DIST_UNIFORM, FLOW_DIST_ZIPF };
+
+/* Same entry used by the lab config.yaml files, so that the destinations of
+ * the traffic can be taken straight from the configuration of the program
+ * under test.
+ */
+struct ip {
+    const char *ip;
+    uint8_t port;
+    const char *mac;
+    const char *gw;
+};
+
+/* A group of flows sharing the same source prefix, protocol and popularity
+ * distribution. Groups share the packet budget according to their weight;
+ * a group with burst_on/burst_off set is only active during the "on" period
+ * (e.g., to model an attack that comes and goes).
+ */
+struct flow_group {
+    const char *name;
+    const char *src;
+    uint32_t count;
+    enum flow_proto proto;
+    uint16_t sport;
+    uint16_t dport;
+    const char *flags;
+    enum flow_dist distribution;
+    double skew;
+    uint32_t weight;
+    uint32_t burst_on;
+    uint32_t burst_off;
+    uint16_t vlan;
+};
+
+struct traffic {
+    struct ip *ips;
+    uint64_t ips_count;
+    struct flow_group *flows;
+    uint64_t flows_count;
+};
+
+static const cyaml_strval_t flow_proto_strings[] = {
+    {"udp", FLOW_PROTO_UDP},
+    {"tcp", FLOW_PROTO_TCP},
+};
+
+static const cyaml_strval_t flow_dist_strings[] = {
+    {"uniform", FLOW_DIST_UNIFORM},
+    {"zipf", FLOW_DIST_ZIPF},
+};
+
+static const cyaml_schema_field_t ip_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("ip", CYAML_FLAG_POINTER, struct ip, ip, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_STRING_PTR("mac", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct ip, mac, 0, 18),
+    CYAML_FIELD_STRING_PTR("gw", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct ip, gw, 0,
+                           CYAML_UNLIMITED),
+    CYAML_FIELD_UINT("port", CYAML_FLAG_OPTIONAL, struct ip, port), CYAML_FIELD_END};
+
+static const cyaml_schema_value_t ip_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct ip, ip_field_schema),
+};
+
+static const cyaml_schema_field_t flow_group_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("name", CYAML_FLAG_POINTER, struct flow_group, name, 0,
+                           CYAML_UNLIMITED),
+    CYAML_FIELD_STRING_PTR("src", CYAML_FLAG_POINTER, struct flow_group, src, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_UINT("count", CYAML_FLAG_DEFAULT, struct flow_group, count),
+    CYAML_FIELD_ENUM("proto", CYAML_FLAG_OPTIONAL, struct flow_group, proto, flow_proto_strings,
+                     CYAML_ARRAY_LEN(flow_proto_strings)),
+    CYAML_FIELD_UINT("sport", CYAML_FLAG_OPTIONAL, struct flow_group, sport),
+    CYAML_FIELD_UINT("dport", CYAML_FLAG_OPTIONAL, struct flow_group, dport),
+    CYAML_FIELD_STRING_PTR("flags", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct flow_group,
+                           flags, 0, 8),
+    CYAML_FIELD_ENUM("distribution", CYAML_FLAG_OPTIONAL, struct flow_group, distribution,
+                     flow_dist_strings, CYAML_ARRAY_LEN(flow_dist_strings)),
+    CYAML_FIELD_FLOAT("skew", CYAML_FLAG_OPTIONAL, struct flow_group, skew),
+    CYAML_FIELD_UINT("weight", CYAML_FLAG_OPTIONAL, struct flow_group, weight),
+    CYAML_FIELD_UINT("burst_on", CYAML_FLAG_OPTIONAL, struct flow_group, burst_on),
+    CYAML_FIELD_UINT("burst_off", CYAML_FLAG_OPTIONAL, struct flow_group, burst_off),
+    CYAML_FIELD_UINT("vlan", CYAML_FLAG_OPTIONAL, struct flow_group, vlan),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t flow_group_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct flow_group, flow_group_field_schema),
+};
+
+static const cyaml_schema_field_t traffic_field_schema[] = {
+    CYAML_FIELD_SEQUENCE("ips", CYAML_FLAG_POINTER, struct traffic, ips, &ip_schema, 1,
+                         CYAML_UNLIMITED),
+    CYAML_FIELD_SEQUENCE("flows", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct traffic, flows,
+                         &flow_group_schema, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t traffic_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct traffic, traffic_field_schema),
+};
+
+static const cyaml_config_t config = {
+    .log_fn = cyaml_log,            /* Use the default logging function. */
+    .mem_fn = cyaml_mem,            /* Use the default memory allocator. */
+    .log_level = CYAML_LOG_WARNING, /* Logging errors and warnings only. */
+    /* Lab config files may carry keys we don't care about (e.g., vip) */
+    .flags = CYAML_CFG_IGNORE_UNKNOWN_KEYS,
+};
+
+/* One entry per generated flow, fully resolved from the YAML description */
+struct flow {
+    __be32 saddr;
+    __be32 daddr;
+    __be16 sport;
+    __be16 dport;
+    __u8 proto;
+    __u8 tcp_flags;
+    __u16 vlan;
+    __u8 dmac[ETH_ALEN];
+    __u32 group;
+};
+
+static int parse_mac(const char *str, __u8 mac[ETH_ALEN]) {
+    int ret = sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3],
+                     &mac[4], &mac[5]);
+    return ret == 6 ? 0 : -1;
+}
+
+static int parse_cidr(const char *str, __u32 *net, __u32 *len) {
+    char buf[INET_ADDRSTRLEN + 4];
+    struct in_addr addr;
+    char *slash;
+
+    snprintf(buf, sizeof(buf), "%s", str);
+    slash = strchr(buf, '/');
+    *len = 32;
+    if (slash) {
+        *slash = '\0';
+        *len = atoi(slash + 1);
+        if (*len > 32)
+            return -1;
+    }
+
+    if (inet_pton(AF_INET, buf, &addr) != 1)
+        return -1;
+
+    *net = ntohl(addr.s_addr) & (*len ? ~0U << (32 - *len) : 0);
+    return 0;
+}
+
+static __u8 parse_tcp_flags(const char *str) {
+    __u8 flags = 0;
+
+    /* Default to a plain ACK, i.e., a packet of an established connection */
+    if (!str)
+        return 0x10;
+
+    for (; *str; str++) {
+        switch (*str) {
+        case 'F':
+            flags |= 0x01;
+            break;
+        case 'S':
+            flags |= 0x02;
+            break;
+        case 'R':
+            flags |= 0x04;
+            break;
+        case 'P':
+            flags |= 0x08;
+            break;
+        case 'A':
+            flags |= 0x10;
+            break;
+        default:
+            log_warn("Ignoring unknown TCP flag '%c'", *str);
+        }
+    }
+    return flags;
+}
+
+/* Expand every flow group into its flows. Flow j of a group takes the j-th
+ * host of the source prefix; once the hosts are exhausted the source port is
+ * incremented, so any number of distinct 5-tuples can be generated from a
+ * small prefix. Destinations are assigned round-robin from the ips list.
+ */
+static int build_flows(const struct traffic *cfg, struct flow **flows_out, __u32 *nflows_out) {
+    struct flow *flows;
+    __u64 nflows = 0;
+    __u32 id = 0;
+
+    for (int g = 0; g < cfg->flows_count; g++)
+        nflows += cfg->flows[g].count ? cfg->flows[g].count : 1;
+
+    if (nflows == 0 || nflows > UINT32_MAX) {
+        log_error("Invalid number of flows: %llu", (unsigned long long)nflows);
+        return -1;
+    }
+
+    flows = calloc(nflows, sizeof(*flows));
+    if (!flows) {
+        log_error("Failed to allocate %llu flows", (unsigned long long)nflows);
+        return -1;
+    }
+
+    for (int g = 0; g < cfg->flows_count; g++) {
+        const struct flow_group *grp = &cfg->flows[g];
+        __u32 net, len, span;
+        __u32 count = grp->count ? grp->count : 1;
+
+        if (parse_cidr(grp->src, &net, &len)) {
+            log_error("Invalid source prefix %s in flow group %s", grp->src, grp->name);
+            goto err;
+        }
+
+        /* Skip network and broadcast addresses on prefixes that have them
+         * (a /0 has 2^32 - 2 hosts, which don't fit the shift)
+         */
+        if (!len)
+            span = UINT32_MAX - 1;
+        else
+            span = len >= 31 ? (1U << (32 - len)) : (1U << (32 - len)) - 2;
+
+        for (__u32 j = 0; j < count; j++, id++) {
+            struct flow *f = &flows[id];
+            const struct ip *dst = &cfg->ips[id % cfg->ips_count];
+            struct in_addr daddr;
+            __u32 host = len >= 31 ? j % span : (j % span) + 1;
+
+            if (inet_pton(AF_INET, dst->ip, &daddr) != 1) {
+                log_error("Invalid destination IP %s", dst->ip);
+                goto err;
+            }
+
+            f->saddr = htonl(net + host);
+            f->daddr = daddr.s_addr;
+            f->sport = htons((grp->sport ? grp->sport : 10000) + j / span);
+            f->dport = htons(grp->dport ? grp->dport : 5000);
+            f->proto = grp->proto == FLOW_PROTO_TCP ? IPPROTO_TCP : IPPROTO_UDP;
+            f->tcp_flags = parse_tcp_flags(grp->flags);
+            f->vlan = grp->vlan;
+            f->group = g;
+
+            if (dst->mac && parse_mac(dst->mac, f->dmac)) {
+                log_error("Invalid destination MAC %s", dst->mac);
+                goto err;
+            }
+        }
+    }
+
+    *flows_out = flows;
+    *nflows_out = id;
+    return 0;
+
+err:
+    free(flows);
+    return -1;
+}
+
+static inline __u32 csum_add(__u32 sum, const void *buf, size_t len) {
+    const __u16 *p = buf;
+
+    while (len > 1) {
+        sum += *p++;
+        len -= 2;
+    }
+    if (len)
+        sum += *(const __u8 *)p;
+    return sum;
+}
+
+static inline __u16 csum_fold(__u32 sum) {
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+/* Size of the L2-L4 headers of a flow, i.e., offset of the probe */
+static inline size_t flow_hdr_len(const struct flow *f) {
+    return sizeof(struct ethhdr) + (f->vlan ? VLAN_HLEN : 0) + sizeof(struct iphdr) +
+           (f->proto == IPPROTO_TCP ? sizeof(struct tcphdr) : sizeof(struct udphdr));
+}
+
+/* Write the headers of flow f in buf for a frame of frame_len bytes. The
+ * payload (probe + zero padding) is left to the caller; for TCP the partial
+ * checksum of everything but the probe is returned in *l4_csum, so that the
+ * per-packet checksum only needs to add the probe words.
+ */
+static size_t build_frame_headers(const struct flow *f, const __u8 smac[ETH_ALEN], size_t frame_len,
+                                  void *buf, __u32 *l4_csum) {
+    struct ethhdr *eth = buf;
+    struct iphdr *iph;
+    size_t off = sizeof(*eth);
+    size_t l4_len;
+
+    memset(buf, 0, frame_len);
+    memcpy(eth->h_dest, f->dmac, ETH_ALEN);
+    memcpy(eth->h_source, smac, ETH_ALEN);
+
+    if (f->vlan) {
+        __be16 *tag = (__be16 *)((__u8 *)buf + off);
+
+        eth->h_proto = htons(ETH_P_8021Q);
+        tag[0] = htons(f->vlan & 0x0fff);
+        tag[1] = htons(ETH_P_IP);
+        off += VLAN_HLEN;
+    } else {
+        eth->h_proto = htons(ETH_P_IP);
+    }
+
+    iph = (struct iphdr *)((__u8 *)buf + off);
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->ttl = 64;
+    iph->protocol = f->proto;
+    iph->tot_len = htons(frame_len - off);
+    iph->saddr = f->saddr;
+    iph->daddr = f->daddr;
+    iph->check = csum_fold(csum_add(0, iph, sizeof(*iph)));
+    off += sizeof(*iph);
+
+    l4_len = frame_len - off;
+    if (f->proto == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)((__u8 *)buf + off);
+        __u32 sum = 0;
+
+        tcp->source = f->sport;
+        tcp->dest = f->dport;
+        tcp->doff = sizeof(*tcp) / 4;
+        ((__u8 *)tcp)[13] = f->tcp_flags;
+        tcp->window = htons(65535);
+
+        /* Pseudo-header + TCP header; the padding is all zeroes */
+        sum = csum_add(sum, &iph->saddr, 2 * sizeof(__be32));
+        sum += htons(IPPROTO_TCP);
+        sum += htons(l4_len);
+        sum = csum_add(sum, tcp, sizeof(*tcp));
+        *l4_csum = sum;
+        off += sizeof(*tcp);
+    } else {
+        struct udphdr *udp = (struct udphdr *)((__u8 *)buf + off);
+
+        udp->source = f->sport;
+        udp->dest = f->dport;
+        udp->len = htons(l4_len);
+        /* A zero checksum is valid for UDP over IPv4 */
+        udp->check = 0;
+        *l4_csum = 0;
+        off += sizeof(*udp);
+    }
+
+    return off;
+}
+
+static inline __u64 timespec_to_ns(const struct timespec *ts) {
+    return (__u64)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+#endif // TRAFFIC_H_
@@ -0,0 +1,716 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <argparse.h>
+
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <signal.h>
+
+#include "log.h"
+#include "traffic.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define MAX_THREADS 64
+#define TX_BATCH 64
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_SIZE (1 << 16)
+#define RING_BLOCK_NR 64
+/* Headers of a flow never exceed Ethernet + VLAN + IPv4 + TCP (58 bytes) */
+#define TMPL_STRIDE 64
+
+static const char *const usages[] = {
+    "trafficgen [options] [[--] args]",
+    "trafficgen [options]",
+    NULL,
+};
+
+static volatile sig_atomic_t exiting = 0;
+
+/* Walker's alias table: O(1) sampling from an arbitrary discrete distribution */
+struct alias_table {
+    __u32 n;
+    float *prob;
+    __u32 *alias;
+};
+
+/* Flows of a group owned by a single thread: flow k of the thread is the
+ * global flow first + k * stride.
+ */
+struct thread_group {
+    __u32 first;
+    __u32 stride;
+    __u32 count;
+    double weight;
+    struct alias_table flows;
+};
+
+struct gen_thread {
+    pthread_t tid;
+    int id;
+    int fd;
+    void *ring;
+    __u32 frame_nr;
+    __u32 ring_idx;
+    double rate;
+    __u64 limit;
+    struct thread_group *groups;
+    __u64 *seq;
+    __u64 sent;
+    __u64 bytes;
+    __u64 seed;
+    int done;
+};
+
+struct gen_ctx {
+    const struct traffic *cfg;
+    struct flow *flows;
+    __u32 nflows;
+    __u8 *tmpl;
+    __u32 *tmpl_csum;
+    __u16 *tmpl_len;
+    size_t frame_len;
+    int ifindex;
+    __u8 smac[ETH_ALEN];
+    struct timespec start;
+    int nthreads;
+    __u64 rate;
+};
+
+static struct gen_ctx ctx;
+
+static void sigint_handler(int sig_no) {
+    exiting = 1;
+}
+
+static inline __u64 xorshift64star(__u64 *state) {
+    __u64 x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static int alias_init(struct alias_table *t, const double *w, __u32 n) {
+    __u32 *small, *large;
+    __u32 ns = 0, nl = 0;
+    double *p, sum = 0;
+
+    t->n = n;
+    t->prob = calloc(n, sizeof(*t->prob));
+    t->alias = calloc(n, sizeof(*t->alias));
+    p = calloc(n, sizeof(*p));
+    small = calloc(n, sizeof(*small));
+    large = calloc(n, sizeof(*large));
+    if (!t->prob || !t->alias || !p || !small || !large) {
+        free(p);
+        free(small);
+        free(large);
+        return -1;
+    }
+
+    for (__u32 i = 0; i < n; i++)
+        sum += w[i];
+
+    for (__u32 i = 0; i < n; i++) {
+        p[i] = sum > 0 ? w[i] * n / sum : 1.0;
+        if (p[i] < 1.0)
+            small[ns++] = i;
+        else
+            large[nl++] = i;
+    }
+
+    while (ns && nl) {
+        __u32 s = small[--ns];
+        __u32 l = large[--nl];
+
+        t->prob[s] = p[s];
+        t->alias[s] = l;
+        p[l] = (p[l] + p[s]) - 1.0;
+        if (p[l] < 1.0)
+            small[ns++] = l;
+        else
+            large[nl++] = l;
+    }
+
+    /* Leftovers are 1.0 up to rounding errors */
+    while (nl)
+        t->prob[large[--nl]] = 1.0;
+    while (ns)
+        t->prob[small[--ns]] = 1.0;
+
+    free(p);
+    free(small);
+    free(large);
+    return 0;
+}
+
+static inline __u32 alias_sample(const struct alias_table *t, __u64 r) {
+    __u32 i = ((r >> 32) * t->n) >> 32;
+    float u = (float)(r & 0xffffffff) / 4294967296.0f;
+
+    return u < t->prob[i] ? i : t->alias[i];
+}
+
+static void alias_free(struct alias_table *t) {
+    free(t->prob);
+    free(t->alias);
+}
+
+/* Split every flow group among the threads, keeping the overall popularity
+ * distribution: each thread gets the flows whose rank is congruent to its id
+ * and the group weight is scaled by the share of popularity it got.
+ */
+static int setup_thread_groups(struct gen_thread *t) {
+    const struct traffic *cfg = ctx.cfg;
+    __u32 first = 0;
+
+    t->groups = calloc(cfg->flows_count, sizeof(*t->groups));
+    if (!t->groups)
+        return -1;
+
+    for (int g = 0; g < cfg->flows_count; g++) {
+        const struct flow_group *grp = &cfg->flows[g];
+        struct thread_group *tg = &t->groups[g];
+        __u32 count = grp->count ? grp->count : 1;
+        double total = 0, mine = 0;
+        double *w;
+
+        tg->first = first + t->id;
+        tg->stride = ctx.nthreads;
+        tg->count = t->id < count ? (count - t->id + ctx.nthreads - 1) / ctx.nthreads : 0;
+
+        w = calloc(count, sizeof(*w));
+        if (!w)
+            return -1;
+
+        for (__u32 j = 0; j < count; j++) {
+            w[j] = grp->distribution == FLOW_DIST_ZIPF ? 1.0 / pow(j + 1, grp->skew) : 1.0;
+            total += w[j];
+        }
+
+        /* Local weights are the global ones of the flows owned by this thread */
+        for (__u32 k = 0; k < tg->count; k++) {
+            w[k] = w[t->id + k * tg->stride];
+            mine += w[k];
+        }
+
+        tg->weight = tg->count ? (grp->weight ? grp->weight : 1) * mine / total : 0;
+        if (tg->count && alias_init(&tg->flows, w, tg->count)) {
+            free(w);
+            return -1;
+        }
+
+        free(w);
+        first += count;
+    }
+
+    t->seq = calloc(ctx.nflows, sizeof(*t->seq));
+    return t->seq ? 0 : -1;
+}
+
+/* Rebuild the group selection table whenever the set of active (non-bursting
+ * or in "on" period) groups changes. The thread then sends its share of the
+ * weight of the active groups, so that the global mix matches the configured
+ * weights even for groups with fewer flows than threads. Returns 1 if the
+ * set changed.
+ */
+static int update_active_groups(struct gen_thread *t, struct alias_table *sel, __u64 *mask,
+                                __u64 now_ms) {
+    const struct traffic *cfg = ctx.cfg;
+    double w[64] = {0};
+    double total = 0, mine = 0;
+    __u64 on = 0;
+
+    for (int g = 0; g < cfg->flows_count && g < 64; g++) {
+        const struct flow_group *grp = &cfg->flows[g];
+        __u32 period = grp->burst_on + grp->burst_off;
+
+        if (period == 0 || grp->burst_on == 0 || (now_ms % period) < grp->burst_on) {
+            on |= 1ULL << g;
+            total += grp->weight ? grp->weight : 1;
+            w[g] = t->groups[g].weight;
+            mine += w[g];
+        }
+    }
+
+    if (*mask == on && (sel->n || !mine))
+        return 0;
+
+    alias_free(sel);
+    memset(sel, 0, sizeof(*sel));
+    *mask = on;
+    t->rate = total ? (double)ctx.rate * mine / total : 0;
+    if (!mine)
+        return 1;
+
+    return alias_init(sel, w, cfg->flows_count < 64 ? cfg->flows_count : 64) ? -1 : 1;
+}
+
+static int setup_tx_ring(struct gen_thread *t) {
+    struct tpacket_req req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr = RING_BLOCK_NR,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = RING_BLOCK_NR * (RING_BLOCK_SIZE / RING_FRAME_SIZE),
+    };
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = 0, /* TX only: don't get a copy of the received traffic */
+        .sll_ifindex = ctx.ifindex,
+    };
+    int version = TPACKET_V2;
+    int one = 1;
+
+    t->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (t->fd < 0) {
+        log_error("Failed to open AF_PACKET socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+        log_error("Failed to set TPACKET_V2: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Skip the qdisc layer, frames go straight to the driver */
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)))
+        log_warn("PACKET_QDISC_BYPASS not supported: %s", strerror(errno));
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+        log_error("Failed to set up PACKET_TX_RING: %s", strerror(errno));
+        return -1;
+    }
+
+    t->ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, t->fd, 0);
+    if (t->ring == MAP_FAILED) {
+        log_error("Failed to mmap the TX ring: %s", strerror(errno));
+        return -1;
+    }
+    t->frame_nr = req.tp_frame_nr;
+
+    if (bind(t->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+        log_error("Failed to bind the socket to ifindex %d: %s", ctx.ifindex, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void fill_frame(struct gen_thread *t, void *data, __u32 flow_id, __u64 seq) {
+    const __u8 *tmpl = ctx.tmpl + (size_t)flow_id * TMPL_STRIDE;
+    __u16 hdr_len = ctx.tmpl_len[flow_id];
+    struct probe_hdr *probe = (struct probe_hdr *)((__u8 *)data + hdr_len);
+    struct timespec ts;
+
+    memcpy(data, tmpl, hdr_len);
+    memset((__u8 *)probe + sizeof(*probe), 0, ctx.frame_len - hdr_len - sizeof(*probe));
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    probe->magic = htonl(PROBE_MAGIC);
+    probe->flow_id = htonl(flow_id);
+    probe->seq = htobe64(seq);
+    probe->tx_ns = htobe64(timespec_to_ns(&ts));
+
+    if (ctx.flows[flow_id].proto == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)((__u8 *)probe - sizeof(*tcp));
+        tcp->check = csum_fold(csum_add(ctx.tmpl_csum[flow_id], probe, sizeof(*probe)));
+    }
+}
+
+static void *gen_thread_run(void *arg) {
+    struct gen_thread *t = arg;
+    struct alias_table sel = {0};
+    __u64 mask = 0;
+    struct timespec start, now;
+    __u64 elapsed_ns;
+    /* Start of the current rate period: the rate changes with the active groups */
+    __u64 rate_ns = 0, rate_sent = 0;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!exiting && (!t->limit || t->sent < t->limit)) {
+        __u32 budget = TX_BATCH, n = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ns = timespec_to_ns(&now) - timespec_to_ns(&start);
+
+        ret = update_active_groups(t, &sel, &mask, elapsed_ns / 1000000);
+        if (ret < 0) {
+            log_error("Thread %d: failed to update the group table", t->id);
+            break;
+        }
+        if (ret) {
+            rate_ns = elapsed_ns;
+            rate_sent = t->sent;
+        }
+
+        if (!sel.n) {
+            /* Every group of the thread is in its "off" period */
+            usleep(100);
+            continue;
+        }
+
+        if (t->rate) {
+            __u64 allowed = rate_sent + (__u64)(t->rate * (elapsed_ns - rate_ns) / 1e9);
+
+            if (allowed <= t->sent) {
+                usleep(10);
+                continue;
+            }
+            if (allowed - t->sent < budget)
+                budget = allowed - t->sent;
+        }
+
+        if (t->limit && t->limit - t->sent < budget)
+            budget = t->limit - t->sent;
+
+        while (n < budget) {
+            struct tpacket2_hdr *hdr =
+                (struct tpacket2_hdr *)((__u8 *)t->ring + (size_t)t->ring_idx * RING_FRAME_SIZE);
+            void *data = (__u8 *)hdr + TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+            struct thread_group *tg;
+            __u32 g, k, flow_id;
+
+            if (hdr->tp_status != TP_STATUS_AVAILABLE)
+                break;
+
+            g = alias_sample(&sel, xorshift64star(&t->seed));
+            tg = &t->groups[g];
+            k = alias_sample(&tg->flows, xorshift64star(&t->seed));
+            flow_id = tg->first + k * tg->stride;
+
+            fill_frame(t, data, flow_id, t->seq[flow_id]++);
+            hdr->tp_len = ctx.frame_len;
+            __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+            t->ring_idx = (t->ring_idx + 1) % t->frame_nr;
+            n++;
+        }
+
+        if (n == 0) {
+            /* Ring is full: block until the kernel has drained it */
+            if (send(t->fd, NULL, 0, 0) < 0 && errno != ENOBUFS && errno != EAGAIN) {
+                log_error("Thread %d: send failed: %s", t->id, strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        if (send(t->fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != ENOBUFS && errno != EAGAIN) {
+            log_error("Thread %d: send failed: %s", t->id, strerror(errno));
+            break;
+        }
+
+        __atomic_add_fetch(&t->sent, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&t->bytes, (__u64)n * ctx.frame_len, __ATOMIC_RELAXED);
+    }
+
+    /* Wait for the frames still in the ring to be sent */
+    send(t->fd, NULL, 0, 0);
+    alias_free(&sel);
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int get_iface_mac(const char *iface, __u8 mac[ETH_ALEN]) {
+    struct ifreq ifr = {0};
+    int fd, ret;
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (fd < 0)
+        return -1;
+
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", iface);
+    ret = ioctl(fd, SIOCGIFHWADDR, &ifr);
+    close(fd);
+    if (ret < 0)
+        return -1;
+
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    return 0;
+}
+
+static int build_templates(const char *dmac_override) {
+    __u8 dmac[ETH_ALEN];
+
+    if (dmac_override && parse_mac(dmac_override, dmac)) {
+        log_error("Invalid destination MAC %s", dmac_override);
+        return -1;
+    }
+
+    ctx.tmpl = calloc(ctx.nflows, TMPL_STRIDE);
+    ctx.tmpl_csum = calloc(ctx.nflows, sizeof(*ctx.tmpl_csum));
+    ctx.tmpl_len = calloc(ctx.nflows, sizeof(*ctx.tmpl_len));
+    if (!ctx.tmpl || !ctx.tmpl_csum || !ctx.tmpl_len) {
+        log_error("Failed to allocate the packet templates");
+        return -1;
+    }
+
+    for (__u32 i = 0; i < ctx.nflows; i++) {
+        struct flow *f = &ctx.flows[i];
+        __u8 frame[MAX_FRAME_LEN];
+
+        if (dmac_override)
+            memcpy(f->dmac, dmac, ETH_ALEN);
+
+        if (flow_hdr_len(f) + sizeof(struct probe_hdr) > ctx.frame_len) {
+            log_error("Frame size %zu too small for flow %u", ctx.frame_len, i);
+            return -1;
+        }
+
+        ctx.tmpl_len[i] = build_frame_headers(f, ctx.smac, ctx.frame_len, frame, &ctx.tmpl_csum[i]);
+        memcpy(ctx.tmpl + (size_t)i * TMPL_STRIDE, frame, ctx.tmpl_len[i]);
+    }
+
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    struct gen_thread threads[MAX_THREADS] = {0};
+    struct traffic *cfg = NULL;
+    const char *config_file = NULL;
+    const char *iface = NULL;
+    const char *dmac = NULL;
+    int rate = 0, count = 0, duration = 0, size = 0, nthreads = 1;
+    __u64 last_sent = 0, last_bytes = 0;
+    cyaml_err_t cyaml_err;
+    int err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('c', "config", &config_file, "Path to the YAML traffic configuration file", NULL,
+                   0, 0),
+        OPT_STRING('i', "iface", &iface, "Interface used to send the traffic", NULL, 0, 0),
+        OPT_STRING('m', "dmac", &dmac, "Destination MAC (overrides the ips[].mac values)", NULL, 0,
+                   0),
+        OPT_INTEGER('r', "rate", &rate, "Packets per second (0 = as fast as possible)", NULL, 0, 0),
+        OPT_INTEGER('n', "count", &count, "Number of packets to send (0 = unlimited)", NULL, 0, 0),
+        OPT_INTEGER('d', "duration", &duration, "Duration in seconds (0 = unlimited)", NULL, 0, 0),
+        OPT_INTEGER('s', "size", &size, "Frame size in bytes, without FCS (0 = smallest possible)",
+                    NULL, 0, 0),
+        OPT_INTEGER('t', "threads", &nthreads, "Number of TX threads (one TX ring each)", NULL, 0,
+                    0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software generates traffic using AF_PACKET TX rings, following the "
+                      "flow mix described in the YAML configuration file",
+                      "\nThe 'ips' section has the same format of the labs config.yaml; "
+                      "the 'flows' section describes the flow groups");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (config_file == NULL) {
+        log_warn("Use default configuration file: %s", "traffic.yaml");
+        config_file = "traffic.yaml";
+    }
+
+    if (iface == NULL) {
+        log_error("Error, you must specify the interface where to send the traffic");
+        exit(1);
+    }
+
+    if (size && (size < MIN_FRAME_LEN || size > MAX_FRAME_LEN)) {
+        log_error("Frame size must be between %d and %d", MIN_FRAME_LEN, MAX_FRAME_LEN);
+        exit(1);
+    }
+
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        log_error("Number of threads must be between 1 and %d", MAX_THREADS);
+        exit(1);
+    }
+
+    ctx.ifindex = if_nametoindex(iface);
+    if (!ctx.ifindex) {
+        log_fatal("Error while retrieving the ifindex of %s", iface);
+        exit(1);
+    }
+
+    if (get_iface_mac(iface, ctx.smac)) {
+        log_fatal("Error while retrieving the MAC address of %s", iface);
+        exit(1);
+    }
+
+    cyaml_err = cyaml_load_file(config_file, &config, &traffic_schema, (void **)&cfg, NULL);
+    if (cyaml_err != CYAML_OK) {
+        log_fatal("Error while loading %s: %s", config_file, cyaml_strerror(cyaml_err));
+        exit(1);
+    }
+
+    if (cfg->flows_count == 0 || cfg->flows_count > 64) {
+        log_fatal("The configuration must define between 1 and 64 flow groups");
+        err = -1;
+        goto cleanup;
+    }
+
+    /* Thread i sends the flows j = i (mod nthreads) of every group: a thread
+     * beyond the largest group would own no flow and never send anything
+     */
+    __u32 max_count = 0;
+    for (int g = 0; g < cfg->flows_count; g++) {
+        __u32 count = cfg->flows[g].count ? cfg->flows[g].count : 1;
+        if (count > max_count)
+            max_count = count;
+    }
+    if ((__u32)nthreads > max_count) {
+        log_warn("Using %u threads, as many as the flows of the largest group", max_count);
+        nthreads = max_count;
+    }
+
+    ctx.cfg = cfg;
+    ctx.nthreads = nthreads;
+
+    if (build_flows(cfg, &ctx.flows, &ctx.nflows)) {
+        err = -1;
+        goto cleanup;
+    }
+
+    /* All frames have the same size, so that the pps/bps figures are easy to
+     * reason about: by default use the smallest one that fits every flow.
+     */
+    ctx.frame_len = size;
+    if (!ctx.frame_len) {
+        ctx.frame_len = MIN_FRAME_LEN;
+        for (__u32 i = 0; i < ctx.nflows; i++) {
+            size_t len = flow_hdr_len(&ctx.flows[i]) + sizeof(struct probe_hdr);
+            if (len > ctx.frame_len)
+                ctx.frame_len = len;
+        }
+    }
+
+    if (build_templates(dmac)) {
+        err = -1;
+        goto cleanup;
+    }
+
+    log_info("Generating %u flows in %llu groups on %s (%zu bytes frames)", ctx.nflows,
+             (unsigned long long)cfg->flows_count, iface, ctx.frame_len);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigint_handler;
+
+    if (sigaction(SIGINT, &action, NULL) == -1 || sigaction(SIGTERM, &action, NULL) == -1) {
+        log_error("sigation failed");
+        err = -1;
+        goto cleanup;
+    }
+
+    ctx.rate = rate;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].id = i;
+        threads[i].fd = -1;
+        threads[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        if (setup_thread_groups(&threads[i])) {
+            log_fatal("Error while setting up thread %d", i);
+            err = -1;
+            goto cleanup;
+        }
+    }
+
+    /* The packets to send are split by the share of the group weights of every
+     * thread, the same that sets its rate (see update_active_groups())
+     */
+    double total_weight = 0, cum_weight = 0;
+    __u64 assigned = 0;
+    for (int g = 0; g < cfg->flows_count; g++)
+        total_weight += cfg->flows[g].weight ? cfg->flows[g].weight : 1;
+
+    for (int i = 0; i < nthreads; i++) {
+        struct gen_thread *t = &threads[i];
+
+        for (int g = 0; g < cfg->flows_count; g++)
+            cum_weight += t->groups[g].weight;
+        t->limit = (__u64)llround(count * cum_weight / total_weight) - assigned;
+        assigned += t->limit;
+
+        if (count && !t->limit)
+            continue;
+
+        if (setup_tx_ring(t)) {
+            log_fatal("Error while setting up thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+
+        if (pthread_create(&t->tid, NULL, gen_thread_run, t)) {
+            log_fatal("Error while creating thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ctx.start);
+    for (int sec = 1; !exiting; sec++) {
+        __u64 sent = 0, bytes = 0;
+        int running = 0;
+
+        sleep(1);
+
+        for (int i = 0; i < nthreads; i++) {
+            sent += __atomic_load_n(&threads[i].sent, __ATOMIC_RELAXED);
+            bytes += __atomic_load_n(&threads[i].bytes, __ATOMIC_RELAXED);
+            running += threads[i].tid && !__atomic_load_n(&threads[i].done, __ATOMIC_ACQUIRE);
+        }
+
+        log_info("TX: %llu pps, %.3f Gbps (total %llu packets)", sent - last_sent,
+                 (bytes - last_bytes) * 8 / 1e9, sent);
+        last_sent = sent;
+        last_bytes = bytes;
+
+        if (!running || (duration && sec >= duration))
+            exiting = 1;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i].tid)
+            pthread_join(threads[i].tid, NULL);
+    }
+
+cleanup:
+    for (int i = 0; i < nthreads; i++) {
+        struct gen_thread *t = &threads[i];
+
+        if (t->ring && t->ring != MAP_FAILED)
+            munmap(t->ring, (size_t)RING_BLOCK_SIZE * RING_BLOCK_NR);
+        if (t->fd > 0)
+            close(t->fd);
+        if (t->groups) {
+            for (int g = 0; g < cfg->flows_count; g++)
+                alias_free(&t->groups[g].flows);
+            free(t->groups);
+        }
+        free(t->seq);
+    }
+    free(ctx.tmpl);
+    free(ctx.tmpl_csum);
+    free(ctx.tmpl_len);
+    free(ctx.flows);
+    cyaml_free(&config, &traffic_schema, cfg, 0);
+    log_info("Program stopped correctly");
+    return -err;
+}
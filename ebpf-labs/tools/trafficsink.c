@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <argparse.h>
+
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <signal.h>
+
+#include "log.h"
+#include "traffic.h"
+
+#define MAX_THREADS 64
+#define RING_BLOCK_SIZE (1 << 22)
+#define RING_BLOCK_NR 64
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_TIMEOUT_MS 10
+/* Latency histogram with 4 buckets per power of two (~19% resolution) */
+#define LAT_BUCKETS (64 * 4)
+
+static const char *const usages[] = {
+    "trafficsink [options] [[--] args]",
+    "trafficsink [options]",
+    NULL,
+};
+
+static volatile sig_atomic_t exiting = 0;
+
+struct flow_stats {
+    __u64 rx;
+    __u64 next_seq;
+    __u64 lost;
+    __u64 reordered;
+};
+
+struct sink_counters {
+    __u64 rx;
+    __u64 bytes;
+    __u64 other;
+    __u64 lost;
+    __u64 reordered;
+    __u64 bad_vlan;
+    __u64 bad_mac;
+    __u64 bad_tuple;
+    __u64 lat_sum;
+    __u64 lat_min;
+    __u64 lat_max;
+    __u64 lat_hist[LAT_BUCKETS];
+};
+
+struct sink_thread {
+    pthread_t tid;
+    int id;
+    int fd;
+    void *ring;
+    struct flow_stats *flows;
+    struct sink_counters cnt;
+};
+
+/* What the device under test is supposed to do to the packets; a negative
+ * value (or a NULL pointer) means that the field is not checked.
+ */
+struct expectations {
+    int vlan;
+    int dport;
+    int any_daddr;
+    const __u8 *smac;
+    const __u8 *dmac;
+};
+
+struct sink_ctx {
+    struct flow *flows;
+    __u32 nflows;
+    int ifindex;
+    struct expectations exp;
+};
+
+static struct sink_ctx ctx;
+
+static void sigint_handler(int sig_no) {
+    exiting = 1;
+}
+
+static inline __u32 lat_bucket(__u64 ns) {
+    __u32 msb;
+
+    if (ns < 4)
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return msb * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+static inline __u64 lat_bucket_value(__u32 idx) {
+    __u32 msb = idx / 4;
+
+    if (idx < 4)
+        return idx;
+    return (__u64)(4 | (idx & 3)) << (msb - 2);
+}
+
+static __u64 lat_percentile(const __u64 *hist, __u64 total, double pct) {
+    __u64 target = total * pct / 100.0, acc = 0;
+
+    for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+        acc += hist[i];
+        if (acc > target)
+            return lat_bucket_value(i);
+    }
+    return 0;
+}
+
+static int setup_rx_ring(struct sink_thread *t, int fanout_id) {
+    struct tpacket_req3 req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr = RING_BLOCK_NR,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR,
+        .tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MS,
+    };
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = ctx.ifindex,
+    };
+    int version = TPACKET_V3;
+    /* Hash fanout keeps every flow on one thread, so that per-flow ordering
+     * is preserved and the sequence checks are meaningful.
+     */
+    int fanout = fanout_id | (PACKET_FANOUT_HASH << 16);
+    int one = 1;
+
+    t->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (t->fd < 0) {
+        log_error("Failed to open AF_PACKET socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+        log_error("Failed to set TPACKET_V3: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        log_error("Failed to set up PACKET_RX_RING: %s", strerror(errno));
+        return -1;
+    }
+
+    t->ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_LOCKED, t->fd, 0);
+    if (t->ring == MAP_FAILED) {
+        log_error("Failed to mmap the RX ring: %s", strerror(errno));
+        return -1;
+    }
+
+    if (bind(t->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+        log_error("Failed to bind the socket to ifindex %d: %s", ctx.ifindex, strerror(errno));
+        return -1;
+    }
+
+    /* Don't count the packets we may be sending from the same interface */
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)))
+        log_warn("PACKET_IGNORE_OUTGOING not supported: %s", strerror(errno));
+
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))) {
+        log_error("Failed to join the fanout group: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void handle_packet(struct sink_thread *t, const struct tpacket3_hdr *ppd) {
+    const __u8 *data = (const __u8 *)ppd + ppd->tp_mac;
+    const __u8 *end = data + ppd->tp_snaplen;
+    const struct ethhdr *eth = (const struct ethhdr *)data;
+    const struct probe_hdr *probe;
+    const struct iphdr *iph;
+    const struct flow *f;
+    struct flow_stats *fs;
+    __u16 proto;
+    int vlan = -1;
+    __u32 flow_id;
+    __u64 seq, tx_ns, rx_ns, lat;
+    size_t off = sizeof(*eth);
+
+    t->cnt.rx++;
+    t->cnt.bytes += ppd->tp_len;
+
+    if (data + off > end)
+        goto other;
+    proto = eth->h_proto;
+
+    /* The tag may have been stripped by the kernel and reported aside */
+    if (ppd->tp_status & TP_STATUS_VLAN_VALID)
+        vlan = ppd->hv1.tp_vlan_tci & 0x0fff;
+
+    if (proto == htons(ETH_P_8021Q) || proto == htons(ETH_P_8021AD)) {
+        const __be16 *tag = (const __be16 *)(data + off);
+
+        if (data + off + VLAN_HLEN > end)
+            goto other;
+        vlan = ntohs(tag[0]) & 0x0fff;
+        proto = tag[1];
+        off += VLAN_HLEN;
+    }
+
+    if (proto != htons(ETH_P_IP))
+        goto other;
+
+    iph = (const struct iphdr *)(data + off);
+    if (data + off + sizeof(*iph) > end || iph->ihl < 5)
+        goto other;
+    off += iph->ihl * 4;
+
+    if (iph->protocol == IPPROTO_TCP) {
+        const struct tcphdr *tcp = (const struct tcphdr *)(data + off);
+
+        if (data + off + sizeof(*tcp) > end)
+            goto other;
+        off += tcp->doff * 4;
+    } else if (iph->protocol == IPPROTO_UDP) {
+        off += sizeof(struct udphdr);
+    } else {
+        goto other;
+    }
+
+    probe = (const struct probe_hdr *)(data + off);
+    if (data + off + sizeof(*probe) > end || probe->magic != htonl(PROBE_MAGIC))
+        goto other;
+
+    flow_id = ntohl(probe->flow_id);
+    if (flow_id >= ctx.nflows)
+        goto other;
+
+    f = &ctx.flows[flow_id];
+    fs = &t->flows[flow_id];
+    seq = be64toh(probe->seq);
+    tx_ns = be64toh(probe->tx_ns);
+
+    /* Sequence checks: a gap is counted as loss, a late packet fills a gap */
+    if (seq >= fs->next_seq) {
+        fs->lost += seq - fs->next_seq;
+        t->cnt.lost += seq - fs->next_seq;
+        fs->next_seq = seq + 1;
+    } else {
+        fs->reordered++;
+        t->cnt.reordered++;
+        if (fs->lost) {
+            fs->lost--;
+            t->cnt.lost--;
+        }
+    }
+    fs->rx++;
+
+    /* Rewrite checks */
+    if (ctx.exp.vlan >= 0 && vlan != (ctx.exp.vlan ? ctx.exp.vlan : -1))
+        t->cnt.bad_vlan++;
+
+    if ((ctx.exp.dmac && memcmp(eth->h_dest, ctx.exp.dmac, ETH_ALEN)) ||
+        (ctx.exp.smac && memcmp(eth->h_source, ctx.exp.smac, ETH_ALEN)))
+        t->cnt.bad_mac++;
+
+    {
+        const __be16 *ports = (const __be16 *)((const __u8 *)iph + iph->ihl * 4);
+        __be16 dport = ctx.exp.dport >= 0 ? htons(ctx.exp.dport) : f->dport;
+
+        if (iph->saddr != f->saddr || (!ctx.exp.any_daddr && iph->daddr != f->daddr) ||
+            iph->protocol != f->proto || ports[0] != f->sport || ports[1] != dport)
+            t->cnt.bad_tuple++;
+    }
+
+    /* One-way latency: both timestamps come from CLOCK_REALTIME */
+    rx_ns = (__u64)ppd->tp_sec * 1000000000ULL + ppd->tp_nsec;
+    lat = rx_ns > tx_ns ? rx_ns - tx_ns : 0;
+    t->cnt.lat_sum += lat;
+    if (!t->cnt.lat_min || lat < t->cnt.lat_min)
+        t->cnt.lat_min = lat;
+    if (lat > t->cnt.lat_max)
+        t->cnt.lat_max = lat;
+    t->cnt.lat_hist[lat_bucket(lat)]++;
+    return;
+
+other:
+    t->cnt.other++;
+}
+
+static void *sink_thread_run(void *arg) {
+    struct sink_thread *t = arg;
+    struct pollfd pfd = {.fd = t->fd, .events = POLLIN | POLLERR};
+    __u32 block = 0;
+
+    while (!exiting) {
+        struct tpacket_block_desc *bd =
+            (struct tpacket_block_desc *)((__u8 *)t->ring + (size_t)block * RING_BLOCK_SIZE);
+        struct tpacket3_hdr *ppd;
+
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        ppd = (struct tpacket3_hdr *)((__u8 *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (__u32 i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            handle_packet(t, ppd);
+            ppd = (struct tpacket3_hdr *)((__u8 *)ppd + ppd->tp_next_offset);
+        }
+
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        block = (block + 1) % RING_BLOCK_NR;
+    }
+
+    return NULL;
+}
+
+static void sum_counters(struct sink_thread *threads, int nthreads, struct sink_counters *tot) {
+    memset(tot, 0, sizeof(*tot));
+    for (int i = 0; i < nthreads; i++) {
+        const struct sink_counters *c = &threads[i].cnt;
+
+        tot->rx += c->rx;
+        tot->bytes += c->bytes;
+        tot->other += c->other;
+        tot->lost += c->lost;
+        tot->reordered += c->reordered;
+        tot->bad_vlan += c->bad_vlan;
+        tot->bad_mac += c->bad_mac;
+        tot->bad_tuple += c->bad_tuple;
+        tot->lat_sum += c->lat_sum;
+        if (c->lat_min && (!tot->lat_min || c->lat_min < tot->lat_min))
+            tot->lat_min = c->lat_min;
+        if (c->lat_max > tot->lat_max)
+            tot->lat_max = c->lat_max;
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            tot->lat_hist[b] += c->lat_hist[b];
+    }
+}
+
+static void print_summary(const struct traffic *cfg, struct sink_thread *threads, int nthreads) {
+    struct sink_counters tot;
+    __u32 id = 0;
+    __u64 probes;
+
+    sum_counters(threads, nthreads, &tot);
+    probes = tot.rx - tot.other;
+
+    log_info("Received %llu packets (%llu without probe)", tot.rx, tot.other);
+    log_info("Lost: %llu, reordered: %llu (losses after the last received packet of a flow "
+             "cannot be detected)",
+             tot.lost, tot.reordered);
+    log_info("Wrong rewrites: vlan %llu, mac %llu, 5-tuple %llu", tot.bad_vlan, tot.bad_mac,
+             tot.bad_tuple);
+    if (probes)
+        log_info("Latency (us): min %.1f avg %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f",
+                 tot.lat_min / 1e3, tot.lat_sum / 1e3 / probes,
+                 lat_percentile(tot.lat_hist, probes, 50) / 1e3,
+                 lat_percentile(tot.lat_hist, probes, 99) / 1e3,
+                 lat_percentile(tot.lat_hist, probes, 99.9) / 1e3, tot.lat_max / 1e3);
+
+    for (int g = 0; g < cfg->flows_count; g++) {
+        __u32 count = cfg->flows[g].count ? cfg->flows[g].count : 1;
+        __u64 rx = 0, lost = 0, reordered = 0;
+        __u32 seen = 0;
+
+        for (__u32 j = 0; j < count; j++, id++) {
+            __u64 flow_rx = 0;
+
+            for (int i = 0; i < nthreads; i++) {
+                flow_rx += threads[i].flows[id].rx;
+                lost += threads[i].flows[id].lost;
+                reordered += threads[i].flows[id].reordered;
+            }
+            rx += flow_rx;
+            seen += flow_rx > 0;
+        }
+
+        log_info("Group %s: %u/%u flows seen, %llu packets, %llu lost, %llu reordered",
+                 cfg->flows[g].name, seen, count, rx, lost, reordered);
+    }
+}
+
+int main(int argc, const char **argv) {
+    struct sink_thread threads[MAX_THREADS] = {0};
+    struct traffic *cfg = NULL;
+    const char *config_file = NULL;
+    const char *iface = NULL;
+    const char *smac_str = NULL, *dmac_str = NULL;
+    __u8 smac[ETH_ALEN], dmac[ETH_ALEN];
+    int nthreads = 1, duration = 0, any_daddr = 0;
+    int exp_vlan = -1, exp_dport = -1;
+    struct sink_counters last = {0};
+    cyaml_err_t cyaml_err;
+    int err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('c', "config", &config_file, "Path to the YAML traffic configuration file", NULL,
+                   0, 0),
+        OPT_STRING('i', "iface", &iface, "Interface where to receive the traffic", NULL, 0, 0),
+        OPT_INTEGER('t', "threads", &nthreads, "Number of RX threads (PACKET_FANOUT_HASH)", NULL, 0,
+                    0),
+        OPT_INTEGER('d', "duration", &duration, "Duration in seconds (0 = until Ctrl-C)", NULL, 0,
+                    0),
+        OPT_GROUP("Expected rewrites"),
+        OPT_INTEGER('v', "expect-vlan", &exp_vlan, "Expected VLAN id (0 = untagged)", NULL, 0, 0),
+        OPT_STRING('s', "expect-smac", &smac_str, "Expected source MAC", NULL, 0, 0),
+        OPT_STRING('m', "expect-dmac", &dmac_str, "Expected destination MAC", NULL, 0, 0),
+        OPT_INTEGER('p', "expect-dport", &exp_dport, "Expected L4 destination port", NULL, 0, 0),
+        OPT_BOOLEAN('a', "any-daddr", &any_daddr, "Don't check the destination IP (e.g., LB)",
+                    NULL, 0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software receives the traffic of trafficgen using TPACKET_V3 RX "
+                      "rings and checks losses, reordering, rewrites and latency",
+                      "\nUse the same YAML file given to trafficgen, it is used to know the "
+                      "5-tuple of every flow");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (config_file == NULL) {
+        log_warn("Use default configuration file: %s", "traffic.yaml");
+        config_file = "traffic.yaml";
+    }
+
+    if (iface == NULL) {
+        log_error("Error, you must specify the interface where to receive the traffic");
+        exit(1);
+    }
+
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        log_error("Number of threads must be between 1 and %d", MAX_THREADS);
+        exit(1);
+    }
+
+    ctx.ifindex = if_nametoindex(iface);
+    if (!ctx.ifindex) {
+        log_fatal("Error while retrieving the ifindex of %s", iface);
+        exit(1);
+    }
+
+    ctx.exp.vlan = exp_vlan;
+    ctx.exp.dport = exp_dport;
+    ctx.exp.any_daddr = any_daddr;
+    if (smac_str) {
+        if (parse_mac(smac_str, smac)) {
+            log_fatal("Invalid MAC %s", smac_str);
+            exit(1);
+        }
+        ctx.exp.smac = smac;
+    }
+    if (dmac_str) {
+        if (parse_mac(dmac_str, dmac)) {
+            log_fatal("Invalid MAC %s", dmac_str);
+            exit(1);
+        }
+        ctx.exp.dmac = dmac;
+    }
+
+    cyaml_err = cyaml_load_file(config_file, &config, &traffic_schema, (void **)&cfg, NULL);
+    if (cyaml_err != CYAML_OK) {
+        log_fatal("Error while loading %s: %s", config_file, cyaml_strerror(cyaml_err));
+        exit(1);
+    }
+
+    if (build_flows(cfg, &ctx.flows, &ctx.nflows)) {
+        err = -1;
+        goto cleanup;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigint_handler;
+
+    if (sigaction(SIGINT, &action, NULL) == -1 || sigaction(SIGTERM, &action, NULL) == -1) {
+        log_error("sigation failed");
+        err = -1;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        struct sink_thread *t = &threads[i];
+
+        t->id = i;
+        t->flows = calloc(ctx.nflows, sizeof(*t->flows));
+        if (!t->flows || setup_rx_ring(t, getpid() & 0xffff)) {
+            log_fatal("Error while setting up thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+
+        if (pthread_create(&t->tid, NULL, sink_thread_run, t)) {
+            log_fatal("Error while creating thread %d", i);
+            exiting = 1;
+            err = -1;
+            break;
+        }
+    }
+
+    log_info("Receiving on %s, tracking %u flows", iface, ctx.nflows);
+
+    for (int sec = 1; !exiting; sec++) {
+        struct sink_counters now;
+
+        sleep(1);
+        sum_counters(threads, nthreads, &now);
+        log_info("RX: %llu pps, %.3f Gbps, lost %llu, reordered %llu, bad rewrites %llu",
+                 now.rx - last.rx, (now.bytes - last.bytes) * 8 / 1e9, now.lost - last.lost,
+                 now.reordered - last.reordered,
+                 (now.bad_vlan + now.bad_mac + now.bad_tuple) -
+                     (last.bad_vlan + last.bad_mac + last.bad_tuple));
+        last = now;
+
+        if (duration && sec >= duration)
+            exiting = 1;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i].tid)
+            pthread_join(threads[i].tid, NULL);
+    }
+
+    if (!err)
+        print_summary(cfg, threads, nthreads);
+
+cleanup:
+    for (int i = 0; i < nthreads; i++) {
+        struct sink_thread *t = &threads[i];
+
+        if (t->ring && t->ring != MAP_FAILED)
+            munmap(t->ring, (size_t)RING_BLOCK_SIZE * RING_BLOCK_NR);
+        if (t->fd > 0)
+            close(t->fd);
+        free(t->flows);
+    }
+    free(ctx.flows);
+    cyaml_free(&config, &traffic_schema, cfg, 0);
+    log_info("Program stopped correctly");
+    return -err;
+}
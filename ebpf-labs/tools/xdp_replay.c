@@ -0,0 +1,777 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <ctype.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+
+#include <argparse.h>
+#include <cyaml/cyaml.h>
+
+#ifndef __USE_POSIX
+#define __USE_POSIX
+#endif
+#include <signal.h>
+
+#include "log.h"
+#include "pcap.h"
+
+#ifndef BPF_F_TEST_XDP_LIVE_FRAMES
+#define BPF_F_TEST_XDP_LIVE_FRAMES (1U << 1)
+#endif
+
+#define XDP_VERDICTS (XDP_REDIRECT + 1)
+#define MAX_PKT_SIZE 65536
+
+static const char *const usages[] = {
+    "xdp_replay [options] [[--] args]",
+    "xdp_replay [options]",
+    NULL,
+};
+
+static const char *const verdict_names[XDP_VERDICTS] = {
+    [XDP_ABORTED] = "XDP_ABORTED", [XDP_DROP] = "XDP_DROP",         [XDP_PASS] = "XDP_PASS",
+    [XDP_TX] = "XDP_TX",           [XDP_REDIRECT] = "XDP_REDIRECT",
+};
+
+static volatile sig_atomic_t exiting = 0;
+
+/* State of the program before the replay, i.e., what the loader of the lab
+ * would configure: global variables (e.g., hhd_v2_cfg.threshold) are set
+ * before loading the object, map entries after.
+ */
+struct global_init {
+    char *name;
+    unsigned long long value;
+};
+
+struct entry_init {
+    char *map;
+    char *key;
+    char *value;
+};
+
+struct replay_init {
+    struct global_init *globals;
+    unsigned globals_count;
+    struct entry_init *entries;
+    unsigned entries_count;
+};
+
+static const cyaml_schema_field_t global_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("name", CYAML_FLAG_POINTER, struct global_init, name, 0,
+                           CYAML_UNLIMITED),
+    CYAML_FIELD_UINT("value", CYAML_FLAG_DEFAULT, struct global_init, value), CYAML_FIELD_END};
+
+static const cyaml_schema_value_t global_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct global_init, global_field_schema),
+};
+
+static const cyaml_schema_field_t entry_field_schema[] = {
+    CYAML_FIELD_STRING_PTR("map", CYAML_FLAG_POINTER, struct entry_init, map, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_STRING_PTR("key", CYAML_FLAG_POINTER, struct entry_init, key, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_STRING_PTR("value", CYAML_FLAG_POINTER, struct entry_init, value, 0,
+                           CYAML_UNLIMITED),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t entry_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct entry_init, entry_field_schema),
+};
+
+static const cyaml_schema_field_t replay_init_field_schema[] = {
+    CYAML_FIELD_SEQUENCE("globals", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct replay_init,
+                         globals, &global_schema, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_SEQUENCE("entries", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, struct replay_init,
+                         entries, &entry_schema, 0, CYAML_UNLIMITED),
+    CYAML_FIELD_END};
+
+static const cyaml_schema_value_t replay_init_schema = {
+    CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct replay_init, replay_init_field_schema),
+};
+
+static const cyaml_config_t config = {
+    .log_fn = cyaml_log,            /* Use the default logging function. */
+    .mem_fn = cyaml_mem,            /* Use the default memory allocator. */
+    .log_level = CYAML_LOG_WARNING, /* Logging errors and warnings only. */
+};
+
+struct replay_cfg {
+    int ifindex;
+    /* Ingress interface of each interface of a pcapng trace, if given */
+    int ifindexes[PCAPNG_MAX_IFACES];
+    __u32 nifindexes;
+    int repeat;
+    int batch_size;
+    bool live;
+    struct pcap_writer *writer;
+    FILE *verdicts;
+};
+
+struct replay_stats {
+    __u64 pkts;
+    __u64 runs;
+    __u64 skipped;
+    __u64 errors;
+    __u64 verdicts[XDP_VERDICTS];
+    __u64 unknown;
+    __u64 run_ns;
+};
+
+static void sigint_handler(int sig_no) {
+    exiting = 1;
+}
+
+static const struct btf_type *skip_mods(const struct btf *btf, const struct btf_type *t) {
+    while (t && (btf_kind(t) == BTF_KIND_TYPEDEF || btf_kind(t) == BTF_KIND_CONST ||
+                 btf_kind(t) == BTF_KIND_VOLATILE || btf_kind(t) == BTF_KIND_RESTRICT))
+        t = btf__type_by_id(btf, t->type);
+    return t;
+}
+
+static bool is_percpu(enum bpf_map_type type) {
+    return type == BPF_MAP_TYPE_PERCPU_ARRAY || type == BPF_MAP_TYPE_PERCPU_HASH ||
+           type == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+}
+
+/* Write value in the integer member (e.g., "threshold") of a global
+ * variable, whose type is type_id and which starts at off in the data of map
+ */
+static int write_global(const struct btf *btf, struct bpf_map *map, __u32 type_id, __u32 off,
+                        char *member, const char *path, __u64 value) {
+    const struct btf_type *t = skip_mods(btf, btf__type_by_id(btf, type_id));
+    size_t size;
+    __u8 *data;
+
+    while (member) {
+        const struct btf_member *m;
+        char *next = strchr(member, '.');
+        int i;
+
+        if (next)
+            *next++ = '\0';
+
+        if (!btf_is_struct(t) && !btf_is_union(t)) {
+            log_error("Cannot set %s: %s is not in a struct", path, member);
+            return -EINVAL;
+        }
+
+        m = btf_members(t);
+        for (i = 0; i < btf_vlen(t); i++, m++) {
+            if (!strcmp(btf__name_by_offset(btf, m->name_off), member))
+                break;
+        }
+
+        if (i == btf_vlen(t)) {
+            log_error("Cannot set %s: no member named %s", path, member);
+            return -ENOENT;
+        }
+
+        if (btf_member_bitfield_size(t, i) || btf_member_bit_offset(t, i) % 8) {
+            log_error("Cannot set %s: bitfields are not supported", path);
+            return -EINVAL;
+        }
+
+        off += btf_member_bit_offset(t, i) / 8;
+        t = skip_mods(btf, btf__type_by_id(btf, m->type));
+        member = next;
+    }
+
+    if (!t || (!btf_is_int(t) && !btf_is_enum(t))) {
+        log_error("Cannot set %s: it is not an integer", path);
+        return -EINVAL;
+    }
+
+    data = bpf_map__initial_value(map, &size);
+    if (!data || off + t->size > size) {
+        log_error("Cannot set %s: %s is not writable", path, bpf_map__name(map));
+        return -EINVAL;
+    }
+
+    /* Host byte order, like skel->rodata->... in the loaders */
+    switch (t->size) {
+    case 1:
+        *(__u8 *)(data + off) = value;
+        break;
+    case 2:
+        *(__u16 *)(data + off) = value;
+        break;
+    case 4:
+        *(__u32 *)(data + off) = value;
+        break;
+    case 8:
+        *(__u64 *)(data + off) = value;
+        break;
+    default:
+        log_error("Cannot set %s: unsupported size %u", path, t->size);
+        return -EINVAL;
+    }
+
+    log_info("Set %s = %llu", path, (unsigned long long)value);
+    return 0;
+}
+
+/* Set a global variable, or one of its members (e.g., hhd_v2_cfg.threshold),
+ * in the .rodata/.data/.bss of the object. The variable is found through the
+ * BTF of the sections, so this must be done before the object is loaded.
+ */
+static int set_global(struct bpf_object *obj, const char *path, __u64 value) {
+    struct btf *btf = bpf_object__btf(obj);
+    struct bpf_map *map;
+    char var[128];
+    char *member;
+
+    if (!btf) {
+        log_error("The object has no BTF, cannot resolve %s", path);
+        return -ENOENT;
+    }
+
+    snprintf(var, sizeof(var), "%s", path);
+    member = strchr(var, '.');
+    if (member)
+        *member++ = '\0';
+
+    bpf_object__for_each_map(map, obj) {
+        /* Internal maps are named <object prefix>.<section> */
+        const char *sec = strchr(bpf_map__name(map), '.');
+        const struct btf_var_secinfo *vsi;
+        const struct btf_type *t;
+        int id;
+
+        if (!sec || !bpf_map__is_internal(map))
+            continue;
+
+        id = btf__find_by_name_kind(btf, sec, BTF_KIND_DATASEC);
+        if (id < 0)
+            continue;
+
+        t = btf__type_by_id(btf, id);
+        vsi = btf_var_secinfos(t);
+        for (int i = 0; i < btf_vlen(t); i++, vsi++) {
+            const struct btf_type *v = btf__type_by_id(btf, vsi->type);
+
+            if (strcmp(btf__name_by_offset(btf, v->name_off), var))
+                continue;
+            return write_global(btf, map, v->type, vsi->offset, member, path, value);
+        }
+    }
+
+    log_error("Global variable %s not found", var);
+    return -ENOENT;
+}
+
+/* Parse exactly size bytes, written as "0a000001" or "0a 00 00 01" (the
+ * same format of bpftool)
+ */
+static int parse_hex(const char *str, __u8 *buf, __u32 size) {
+    __u32 n = 0;
+
+    while (*str) {
+        unsigned int byte;
+
+        if (isspace((unsigned char)*str) || *str == ':') {
+            str++;
+            continue;
+        }
+
+        if (n == size || !isxdigit((unsigned char)str[0]) || !isxdigit((unsigned char)str[1]) ||
+            sscanf(str, "%2x", &byte) != 1)
+            return -EINVAL;
+
+        buf[n++] = byte;
+        str += 2;
+    }
+
+    return n == size ? 0 : -EINVAL;
+}
+
+static int load_entries(struct bpf_object *obj, const struct replay_init *init) {
+    int ncpus = libbpf_num_possible_cpus();
+    int err = 0;
+
+    for (unsigned i = 0; i < init->entries_count && !err; i++) {
+        const struct entry_init *e = &init->entries[i];
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, e->map);
+        __u32 key_size, value_size, stride;
+        __u8 *key = NULL, *value = NULL;
+        int percpu;
+
+        if (!map) {
+            log_error("Map %s not found in the object", e->map);
+            return -ENOENT;
+        }
+
+        key_size = bpf_map__key_size(map);
+        value_size = bpf_map__value_size(map);
+        percpu = is_percpu(bpf_map__type(map));
+        /* Per-CPU values are 8-byte aligned, one per possible CPU */
+        stride = percpu ? (value_size + 7) & ~7 : value_size;
+
+        key = calloc(1, key_size);
+        value = calloc(percpu ? ncpus : 1, stride);
+        if (!key || !value) {
+            log_error("Cannot allocate the entry of %s", e->map);
+            err = -ENOMEM;
+            goto next;
+        }
+
+        if (parse_hex(e->key, key, key_size) || parse_hex(e->value, value, value_size)) {
+            log_error("Invalid entry of %s: key must be %u bytes and value %u bytes", e->map,
+                      key_size, value_size);
+            err = -EINVAL;
+            goto next;
+        }
+
+        /* The same value on every CPU */
+        for (int cpu = 1; percpu && cpu < ncpus; cpu++)
+            memcpy(value + cpu * stride, value, value_size);
+
+        err = bpf_map_update_elem(bpf_map__fd(map), key, value, BPF_ANY);
+        if (err)
+            log_error("Failed to update BPF map %s: %s", e->map, strerror(errno));
+
+    next:
+        free(key);
+        free(value);
+    }
+
+    return err;
+}
+
+/* One line per packet of the trace: its index, the verdict of the last run
+ * and the length of the output packet (0 if it is not passed/forwarded)
+ */
+static void write_verdict(struct replay_cfg *cfg, __u64 idx, const char *verdict, __u32 len) {
+    if (cfg->verdicts)
+        fprintf(cfg->verdicts, "%llu %s %u\n", (unsigned long long)idx, verdict, len);
+}
+
+static int replay(int prog_fd, struct pcap_file *trace, struct replay_cfg *cfg,
+                  struct replay_stats *stats) {
+    static __u8 out[MAX_PKT_SIZE];
+    struct xdp_md ctx_in = {.ingress_ifindex = cfg->ifindex};
+    struct pcap_pkt pkt;
+    __u64 idx = 0;
+    int err;
+
+    for (; !exiting && pcap_next(trace, &pkt); idx++) {
+        if (pkt.linktype != PCAP_LINKTYPE_ETHERNET || pkt.caplen < ETH_HLEN ||
+            (cfg->nifindexes && pkt.ifid >= cfg->nifindexes)) {
+            stats->skipped++;
+            write_verdict(cfg, idx, "SKIPPED", 0);
+            continue;
+        }
+
+        if (cfg->nifindexes)
+            ctx_in.ingress_ifindex = cfg->ifindexes[pkt.ifid];
+
+    retry:;
+        LIBBPF_OPTS(bpf_test_run_opts, opts, .data_in = pkt.data, .data_size_in = pkt.caplen,
+                    .repeat = cfg->repeat);
+
+        if (ctx_in.ingress_ifindex) {
+            opts.ctx_in = &ctx_in;
+            opts.ctx_size_in = sizeof(ctx_in);
+        }
+
+        if (cfg->live) {
+            /* Frames go through the real XDP datapath (XDP_TX and
+             * XDP_REDIRECT are executed), batch_size at a time
+             */
+            opts.flags = BPF_F_TEST_XDP_LIVE_FRAMES;
+            opts.batch_size = cfg->batch_size;
+        } else {
+            opts.data_out = out;
+            opts.data_size_out = sizeof(out);
+        }
+
+        err = bpf_prog_test_run_opts(prog_fd, &opts);
+        if (err) {
+            err = -errno;
+            if (cfg->live && !stats->runs && (err == -EINVAL || err == -EOPNOTSUPP)) {
+                log_warn("Live frames are not supported, falling back to BPF_PROG_TEST_RUN "
+                         "without them");
+                cfg->live = false;
+                goto retry;
+            }
+
+            if (!stats->errors)
+                log_warn("BPF_PROG_TEST_RUN failed: %s (e.g., packet too large?)",
+                         strerror(-err));
+            stats->errors++;
+            write_verdict(cfg, idx, "ERROR", 0);
+            continue;
+        }
+
+        stats->runs++;
+        stats->pkts += cfg->repeat;
+        /* duration is the average time of one repetition */
+        stats->run_ns += (__u64)opts.duration * cfg->repeat;
+
+        /* The verdict is only returned without live frames */
+        if (cfg->live)
+            continue;
+
+        if (opts.retval < XDP_VERDICTS)
+            stats->verdicts[opts.retval] += cfg->repeat;
+        else
+            stats->unknown += cfg->repeat;
+
+        if (opts.retval == XDP_PASS || opts.retval == XDP_TX || opts.retval == XDP_REDIRECT) {
+            write_verdict(cfg, idx, verdict_names[opts.retval], opts.data_size_out);
+            if (cfg->writer && pcap_write(cfg->writer, out, opts.data_size_out, pkt.ts_ns)) {
+                log_error("Failed to write the output trace");
+                return -EIO;
+            }
+        } else {
+            write_verdict(cfg, idx,
+                          opts.retval < XDP_VERDICTS ? verdict_names[opts.retval] : "UNKNOWN", 0);
+        }
+    }
+
+    return 0;
+}
+
+static void dump_printf_cb(void *ctx, const char *fmt, va_list args) {
+    vprintf(fmt, args);
+}
+
+static void print_data(struct btf_dump *d, __u32 type_id, const void *data, __u32 size) {
+    LIBBPF_OPTS(btf_dump_type_data_opts, opts, .compact = true);
+
+    if (d && type_id && btf_dump__dump_type_data(d, type_id, data, size, &opts) >= 0)
+        return;
+
+    for (__u32 i = 0; i < size; i++)
+        printf("%02x%s", ((const __u8 *)data)[i], i + 1 < size ? " " : "");
+}
+
+static bool is_zero(const __u8 *data, __u32 size) {
+    for (__u32 i = 0; i < size; i++) {
+        if (data[i])
+            return false;
+    }
+    return true;
+}
+
+/* Print the non-zero entries of a map after the replay, formatted with the
+ * BTF of the object when available
+ */
+static int dump_map(struct bpf_object *obj, const char *name) {
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, name);
+    struct btf *btf = bpf_object__btf(obj);
+    struct btf_dump *d = NULL;
+    __u32 key_size, value_size, stride, ncpus, count = 0, zero = 0;
+    __u8 *key = NULL, *next = NULL, *value = NULL;
+    void *prev = NULL;
+    int fd, err = 0;
+
+    if (!map) {
+        log_error("Map %s not found in the object", name);
+        return -ENOENT;
+    }
+
+    fd = bpf_map__fd(map);
+    key_size = bpf_map__key_size(map);
+    value_size = bpf_map__value_size(map);
+    ncpus = is_percpu(bpf_map__type(map)) ? libbpf_num_possible_cpus() : 1;
+    stride = ncpus > 1 ? (value_size + 7) & ~7 : value_size;
+
+    key = malloc(key_size);
+    next = malloc(key_size);
+    value = malloc((size_t)stride * ncpus);
+    if (!key || !next || !value) {
+        log_error("Cannot allocate the buffers for %s", name);
+        err = -ENOMEM;
+        goto cleanup;
+    }
+
+    if (btf)
+        d = btf_dump__new(btf, dump_printf_cb, NULL, NULL);
+
+    printf("%s:\n", name);
+    while (!bpf_map_get_next_key(fd, prev, next)) {
+        __u8 *tmp;
+
+        if (!bpf_map_lookup_elem(fd, next, value)) {
+            if (is_zero(value, stride * ncpus)) {
+                zero++;
+            } else {
+                printf("  ");
+                print_data(d, bpf_map__btf_key_type_id(map), next, key_size);
+                printf(" =>");
+                for (__u32 cpu = 0; cpu < ncpus; cpu++) {
+                    if (ncpus > 1 && is_zero(value + cpu * stride, value_size))
+                        continue;
+                    if (ncpus > 1)
+                        printf(" cpu%u:", cpu);
+                    printf(" ");
+                    print_data(d, bpf_map__btf_value_type_id(map), value + cpu * stride,
+                               value_size);
+                }
+                printf("\n");
+                count++;
+            }
+        }
+
+        tmp = key;
+        key = next;
+        next = tmp;
+        prev = key;
+    }
+    printf("  %u entries (%u zero-valued not shown)\n", count, zero);
+
+cleanup:
+    btf_dump__free(d);
+    free(key);
+    free(next);
+    free(value);
+    return err;
+}
+
+static void print_stats(const struct replay_stats *stats, bool live, double elapsed) {
+    log_info("Replayed %llu packets (%llu runs, %llu skipped, %llu errors) in %.2fs",
+             (unsigned long long)stats->pkts, (unsigned long long)stats->runs,
+             (unsigned long long)stats->skipped, (unsigned long long)stats->errors, elapsed);
+
+    if (stats->pkts && stats->run_ns)
+        log_info("In-program rate: %.2f Mpps (%.1f ns/pkt), wall-clock rate: %.2f Mpps",
+                 stats->pkts * 1e3 / stats->run_ns, (double)stats->run_ns / stats->pkts,
+                 elapsed > 0 ? stats->pkts / elapsed / 1e6 : 0);
+
+    if (live) {
+        log_info("Verdicts are not reported with live frames, check the maps");
+        return;
+    }
+
+    printf("%14s %14s %8s\n", "verdict", "packets", "share");
+    for (int i = 0; i < XDP_VERDICTS; i++)
+        printf("%14s %14llu %7.2f%%\n", verdict_names[i], (unsigned long long)stats->verdicts[i],
+               stats->pkts ? 100.0 * stats->verdicts[i] / stats->pkts : 0);
+    if (stats->unknown)
+        printf("%14s %14llu %7.2f%%\n", "unknown", (unsigned long long)stats->unknown,
+               100.0 * stats->unknown / stats->pkts);
+}
+
+int main(int argc, const char **argv) {
+    struct replay_stats stats = {0};
+    struct replay_cfg cfg = {.repeat = 1};
+    struct replay_init *init = NULL;
+    struct pcap_writer writer = {0};
+    struct pcap_file trace = {0};
+    struct bpf_object *obj = NULL;
+    struct bpf_program *prog = NULL;
+    struct timespec start, end;
+    const char *obj_file = NULL;
+    const char *prog_name = NULL;
+    const char *trace_file = NULL;
+    const char *init_file = NULL;
+    const char *out_file = NULL;
+    const char *iface = NULL;
+    const char *ifaces_str = NULL;
+    const char *verdicts_file = NULL;
+    const char *dump_str = NULL;
+    int live = 0, batch_size = 0;
+    int err = 0;
+
+    struct argparse_option options[] = {
+        OPT_HELP(),
+        OPT_GROUP("Basic options"),
+        OPT_STRING('o', "obj", &obj_file, "BPF object (e.g., .output/hhd_v2.bpf.o)", NULL, 0, 0),
+        OPT_STRING('p', "prog", &prog_name, "Name of the XDP program (default: the first one)",
+                   NULL, 0, 0),
+        OPT_STRING('r', "read", &trace_file, "pcap or pcapng trace to replay", NULL, 0, 0),
+        OPT_STRING('c', "config", &init_file, "YAML file with the globals and map entries to set",
+                   NULL, 0, 0),
+        OPT_STRING('i', "iface", &iface, "Ingress interface seen by the program", NULL, 0, 0),
+        OPT_STRING('I', "ifaces", &ifaces_str,
+                   "Comma-separated ingress interfaces of the interfaces of a pcapng trace", NULL,
+                   0, 0),
+        OPT_INTEGER('n', "repeat", &cfg.repeat, "Number of runs of every packet", NULL, 0, 0),
+        OPT_BOOLEAN('l', "live", &live, "Use live frames (XDP_TX/XDP_REDIRECT are executed)",
+                    NULL, 0, 0),
+        OPT_INTEGER('b', "batch", &batch_size, "Batch size of live frames (default: kernel's)",
+                    NULL, 0, 0),
+        OPT_STRING('w', "write", &out_file, "Write the passed/forwarded packets to a pcap file",
+                   NULL, 0, 0),
+        OPT_STRING('V', "verdicts", &verdicts_file, "Write the verdict of every packet to a file",
+                   NULL, 0, 0),
+        OPT_STRING('d', "dump", &dump_str, "Comma-separated maps to print after the replay", NULL,
+                   0, 0),
+        OPT_END(),
+    };
+
+    struct argparse argparse;
+    argparse_init(&argparse, options, usages, 0);
+    argparse_describe(&argparse,
+                      "\nThis software replays a pcap trace through an XDP program with "
+                      "BPF_PROG_TEST_RUN, without attaching it to any interface",
+                      "\nIt prints the histogram of the verdicts and, with '-d', the content of "
+                      "the maps at the end of the trace");
+    argc = argparse_parse(&argparse, argc, argv);
+
+    if (obj_file == NULL || trace_file == NULL) {
+        log_error("Error, you must specify the BPF object and the trace");
+        exit(1);
+    }
+
+    if (cfg.repeat < 1) {
+        log_error("The number of runs must be at least 1");
+        exit(1);
+    }
+
+    if (live && (out_file || verdicts_file)) {
+        log_error("Packets and verdicts cannot be written with live frames");
+        exit(1);
+    }
+
+    if (ifaces_str) {
+        char *ifaces = strdup(ifaces_str), *saveptr = NULL;
+
+        for (char *tok = strtok_r(ifaces, ",", &saveptr); tok;
+             tok = strtok_r(NULL, ",", &saveptr)) {
+            if (cfg.nifindexes == PCAPNG_MAX_IFACES) {
+                log_fatal("At most %d interfaces can be given", PCAPNG_MAX_IFACES);
+                exit(1);
+            }
+
+            cfg.ifindexes[cfg.nifindexes] = if_nametoindex(tok);
+            if (!cfg.ifindexes[cfg.nifindexes]) {
+                log_fatal("Error while retrieving the ifindex of %s", tok);
+                exit(1);
+            }
+            cfg.nifindexes++;
+        }
+        free(ifaces);
+    }
+
+    if (iface) {
+        cfg.ifindex = if_nametoindex(iface);
+        if (!cfg.ifindex) {
+            log_fatal("Error while retrieving the ifindex of %s", iface);
+            exit(1);
+        }
+    } else if (live) {
+        log_warn("Live frames are sent out of the loopback if no interface is given");
+    }
+
+    cfg.live = live;
+    cfg.batch_size = batch_size;
+
+    if (init_file) {
+        cyaml_err_t cerr = cyaml_load_file(init_file, &config, &replay_init_schema,
+                                           (void **)&init, NULL);
+        if (cerr != CYAML_OK) {
+            log_fatal("Error while loading %s: %s", init_file, cyaml_strerror(cerr));
+            exit(1);
+        }
+    }
+
+    obj = bpf_object__open_file(obj_file, NULL);
+    if (libbpf_get_error(obj)) {
+        log_fatal("Error while opening BPF object %s", obj_file);
+        obj = NULL;
+        err = -1;
+        goto cleanup;
+    }
+
+    if (prog_name)
+        prog = bpf_object__find_program_by_name(obj, prog_name);
+    else
+        prog = bpf_object__next_program(obj, NULL);
+
+    if (!prog) {
+        log_fatal("XDP program %s not found in %s", prog_name ? prog_name : "", obj_file);
+        err = -1;
+        goto cleanup;
+    }
+
+    /* Set program type to XDP, sections like "xdp_pass" are not recognized */
+    bpf_program__set_type(prog, BPF_PROG_TYPE_XDP);
+
+    for (unsigned i = 0; init && i < init->globals_count; i++) {
+        err = set_global(obj, init->globals[i].name, init->globals[i].value);
+        if (err)
+            goto cleanup;
+    }
+
+    /* Load and verify BPF programs */
+    if (bpf_object__load(obj)) {
+        log_fatal("Error while loading BPF object");
+        err = -1;
+        goto cleanup;
+    }
+
+    if (init) {
+        err = load_entries(obj, init);
+        if (err)
+            goto cleanup;
+    }
+
+    err = pcap_open(&trace, trace_file);
+    if (err)
+        goto cleanup;
+
+    if (out_file) {
+        err = pcap_writer_open(&writer, out_file);
+        if (err)
+            goto cleanup;
+        cfg.writer = &writer;
+    }
+
+    if (verdicts_file) {
+        cfg.verdicts = fopen(verdicts_file, "w");
+        if (!cfg.verdicts) {
+            log_error("Failed to open %s: %s", verdicts_file, strerror(errno));
+            err = -errno;
+            goto cleanup;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigint_handler;
+
+    if (sigaction(SIGINT, &action, NULL) == -1) {
+        log_error("sigation failed");
+        err = -1;
+        goto cleanup;
+    }
+
+    log_info("Replaying %s through %s%s", trace_file, bpf_program__name(prog),
+             cfg.live ? " with live frames" : "");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = replay(bpf_program__fd(prog), &trace, &cfg, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    print_stats(&stats, cfg.live,
+                (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    if (dump_str) {
+        char *maps = strdup(dump_str), *saveptr = NULL;
+
+        for (char *tok = strtok_r(maps, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+            dump_map(obj, tok);
+        free(maps);
+    }
+
+cleanup:
+    if (cfg.verdicts)
+        fclose(cfg.verdicts);
+    pcap_writer_close(&writer);
+    pcap_close(&trace);
+    bpf_object__close(obj);
+    if (init)
+        cyaml_free(&config, &replay_init_schema, init, 0);
+    log_info("Program stopped correctly");
+    return -err;
+}
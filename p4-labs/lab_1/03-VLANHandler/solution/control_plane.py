@@ -1,8 +1,24 @@
 #!/usr/bin/env python3
 
+import os
+import sys
+
+import yaml
 from p4utils.utils.helper import load_topo
 from p4utils.utils.sswitch_p4runtime_API import SimpleSwitchP4RuntimeAPI
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../../tools'))
+from p4rt_bulk import P4UTILS_ELECTION_ID, BulkWriter, P4Info  # noqa: E402
+
+# Action of vlan_translation and its parameters for the actions of vlans.yaml
+ACTIONS = {
+    'forward': ('forward', ['egress_port']),
+    'push': ('vlan_push', ['egress_port', 'new_vid']),
+    'pop': ('vlan_pop', ['egress_port']),
+    'swap': ('vlan_swap', ['egress_port', 'new_vid']),
+    'drop': ('drop', []),
+}
+
 
 topo = load_topo('topology.json')
 controllers = {}
@@ -14,16 +30,34 @@ for switch, data in topo.get_p4rtswitches().items():
 
 controller = controllers['s1']     
 
-controller.table_clear('vlan_table')
-
-controller.table_add('vlan_table', 'forward', ['2'], ['2'])
-controller.table_add('vlan_table', 'forward', ['20'], ['2'])
-controller.table_add('vlan_table', 'forward', ['3'], ['3'])
-controller.table_add('vlan_table', 'forward', ['30'], ['3'])
-controller.table_add('vlan_table', 'forward', ['4'], ['4'])
-controller.table_add('vlan_table', 'forward', ['40'], ['4'])
-
-controller.table_clear('port_to_vlan')
-controller.table_add('port_to_vlan', 'add_vlan_hdr', ['2'], ['2'])
-controller.table_add('port_to_vlan', 'add_vlan_hdr', ['3'], ['3'])
-controller.table_add('port_to_vlan', 'add_vlan_hdr', ['4'], ['4'])
+controller.table_clear('vlan_translation')
+controller.table_clear('vlan_default')
+
+# A whole trunk can have thousands of entries: they are written in a few
+# batched requests instead of one table_add each
+with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'vlans.yaml')) as f:
+    config = yaml.safe_load(f)
+vlans = config['vlans']
+
+data = topo.get_p4rtswitches()['s1']
+p4info = P4Info(data['p4rt_path'])
+table = p4info.table('vlan_translation')
+entries = []
+for vlan in vlans:
+    action, params = ACTIONS[vlan['action']]
+    entries.append(p4info.table_entry(table, p4info.action(action), [vlan['port'], vlan['vid']],
+                                      [vlan[p] for p in params]))
+
+default_table = p4info.table('vlan_default')
+for default in config.get('defaults', []):
+    action, params = ACTIONS[default['action']]
+    entries.append(p4info.table_entry(default_table, p4info.action(action), [default['port']],
+                                      [default[p] for p in params]))
+
+writer = BulkWriter('localhost:{}'.format(data['grpc_port']), data['device_id'],
+                    P4UTILS_ELECTION_ID, arbitrate=False)
+try:
+    failed = writer.write(entries)
+finally:
+    writer.close()
+print('{} VLAN translations installed ({} failed)'.format(len(entries) - failed, failed))
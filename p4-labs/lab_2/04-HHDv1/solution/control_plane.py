@@ -1,8 +1,25 @@
 #!/usr/bin/env python3
 
+import os
+import sys
+
 from p4utils.utils.helper import load_topo
 from p4utils.utils.sswitch_p4runtime_API import SimpleSwitchP4RuntimeAPI
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../../tools'))
+from p4rt_bulk import P4UTILS_ELECTION_ID, BulkWriter, P4Info  # noqa: E402
+from p4.v1 import p4runtime_pb2  # noqa: E402
+
+# Meter of every source: committed rate and burst, peak rate and burst
+# (packets/s and packets). Above the committed rate the packets are marked
+# with DSCP AF13, above the peak rate they are dropped.
+SOURCES = [
+    # prefix, meter index, cir, cburst, pir, pburst
+    ('10.0.0.1/32', 0, 100, 10, 200, 20),
+    ('10.0.0.2/32', 1, 1000, 100, 2000, 200),
+    ('10.0.0.3/32', 2, 300, 30, 600, 60),
+]
+
 
 topo = load_topo('topology.json')
 controllers = {}
@@ -14,8 +31,20 @@ for switch, data in topo.get_p4rtswitches().items():
 
 controller = controllers['s1']                        
 
-controller.table_clear('hhd_threshold')
+controller.table_clear('hhd_meter_index')
+
+for prefix, index, _, _, _, _ in SOURCES:
+    controller.table_add('hhd_meter_index', 'set_hhd_meter', [prefix], [str(index)])
 
-controller.table_add('hhd_threshold', 'set_hhd_threshold', ['10.0.0.1/32'], ['100'])
-controller.table_add('hhd_threshold', 'set_hhd_threshold', ['10.0.0.2/32'], ['1000'])
-controller.table_add('hhd_threshold', 'set_hhd_threshold', ['10.0.0.3/32'], ['300'])
\ No newline at end of file
+# The meters are not supported by the P4Runtime API of p4utils
+data = topo.get_p4rtswitches()['s1']
+p4info = P4Info(data['p4rt_path'])
+meter = p4info.meter('hhd_meter')
+writer = BulkWriter('localhost:{}'.format(data['grpc_port']), data['device_id'],
+                    P4UTILS_ELECTION_ID, arbitrate=False)
+try:
+    writer.write([p4info.meter_entry(meter, index, cir, cburst, pir, pburst)
+                  for _, index, cir, cburst, pir, pburst in SOURCES],
+                 update_type=p4runtime_pb2.Update.MODIFY)
+finally:
+    writer.close()
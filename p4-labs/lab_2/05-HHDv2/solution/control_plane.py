@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+
+from p4utils.utils.helper import load_topo
+from p4utils.utils.sswitch_p4runtime_API import SimpleSwitchP4RuntimeAPI
+
+
+# Packets per flow and epoch (about 1 s) above which the flow is dropped
+THRESHOLD = 1000
+
+# In-band telemetry: id of every switch in the INT records and port of its
+# host, where INT is added and removed. The reports go to the host as well,
+# through the clone session of the sink (INT_REPORT_SESSION in hdd_v2.p4)
+INT_SWITCH_IDS = {'s1': 1, 's2': 2}
+INT_HOST_PORT = 1
+INT_REPORT_SESSION = 100
+
+topo = load_topo('topology.json')
+controllers = {}
+
+for switch, data in topo.get_p4rtswitches().items():
+    controllers[switch] = SimpleSwitchP4RuntimeAPI(data['device_id'], data['grpc_port'],
+                                                  p4rt_path=data['p4rt_path'],
+                                                  json_path=data['json_path'])
+
+controller = controllers['s1']     
+
+controller.table_clear('ipv4_lpm')
+
+controller.table_add('ipv4_lpm', 'ipv4_forward', ['10.0.1.1/32'], ['00:00:0a:00:01:01', '1'])
+controller.table_add('ipv4_lpm', 'ipv4_forward', ['10.0.2.2/32'], ['00:00:00:02:01:00', '2'])
+
+controller.table_set_default('ipv4_lpm', 'drop')
+
+controller.table_set_default('hhd_threshold', 'set_hhd_threshold', [str(THRESHOLD)])
+
+controller.table_set_default('int_switch', 'int_set_switch_id', [str(INT_SWITCH_IDS['s1'])])
+controller.table_clear('int_source')
+controller.table_clear('int_sink')
+controller.table_add('int_source', 'NoAction', [str(INT_HOST_PORT)])
+controller.table_add('int_sink', 'NoAction', [str(INT_HOST_PORT)])
+controller.cs_create(INT_REPORT_SESSION, [INT_HOST_PORT])
+
+controller = controllers['s2']     
+
+controller.table_clear('ipv4_lpm')
+
+controller.table_add('ipv4_lpm', 'ipv4_forward', ['10.0.2.2/32'], ['00:00:0a:00:02:02', '1'])
+controller.table_add('ipv4_lpm', 'ipv4_forward', ['10.0.1.1/32'], ['00:00:00:02:01:00', '2'])
+
+controller.table_set_default('ipv4_lpm', 'drop')
+
+controller.table_set_default('hhd_threshold', 'set_hhd_threshold', [str(THRESHOLD)])
+
+controller.table_set_default('int_switch', 'int_set_switch_id', [str(INT_SWITCH_IDS['s2'])])
+controller.table_clear('int_source')
+controller.table_clear('int_sink')
+controller.table_add('int_source', 'NoAction', [str(INT_HOST_PORT)])
+controller.table_add('int_sink', 'NoAction', [str(INT_HOST_PORT)])
+controller.cs_create(INT_REPORT_SESSION, [INT_HOST_PORT])
+
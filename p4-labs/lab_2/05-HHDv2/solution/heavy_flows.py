@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+
+"""Block the heavy flows reported by the switches of HHDv2.
+
+Unlike control_plane.py, which configures the switches and exits, this
+listener runs until it is killed: it receives the heavy_flow_t digests of
+every switch and installs a drop entry in its heavy_flows table. The
+entries are removed after BLOCK_TIMEOUT_S: a flow that is still heavy is
+reported again by the sketch and blocked for another period.
+"""
+
+import ipaddress
+import threading
+import time
+
+from p4utils.utils.helper import load_topo
+from p4utils.utils.sswitch_p4runtime_API import SimpleSwitchP4RuntimeAPI
+
+
+# The switch sends the heavy_flow_t digests in lists of up to
+# DIGEST_LIST_SIZE flows, or after DIGEST_TIMEOUT_NS if fewer
+DIGEST_LIST_SIZE = 16
+DIGEST_TIMEOUT_NS = 100 * 1000 * 1000
+
+# A heavy flow is dropped for BLOCK_TIMEOUT_S (a few epochs of the sketch).
+# The table holds HEAVY_FLOWS_ENTRIES flows (as in hdd_v2.p4): when it is
+# full, the oldest entry is removed to make room for a new one.
+BLOCK_TIMEOUT_S = 5
+HEAVY_FLOWS_ENTRIES = 1024
+
+
+def parse_heavy_flow(member):
+    """Decode a heavy_flow_t digest into the key of the heavy_flows table."""
+    fields = [int.from_bytes(m.bitstring, byteorder='big') for m in member.struct.members]
+    src_addr, dst_addr, src_port, dst_port, protocol = fields
+    return (str(ipaddress.IPv4Address(src_addr)), str(ipaddress.IPv4Address(dst_addr)),
+            str(src_port), str(dst_port), str(protocol))
+
+
+def unblock(switch, controller, blocked, flow):
+    """Remove the drop entry of a flow."""
+    try:
+        controller.table_delete_match('heavy_flows', list(flow))
+    except Exception as e:
+        print('{}: cannot unblock {}: {}'.format(switch, flow, e))
+    del blocked[flow]
+    print('{}: unblocked flow {}'.format(switch, flow))
+
+
+def block_heavy_flows(switch, controller):
+    """Install a drop entry for every heavy flow reported by the switch, so
+    that its next packets skip the sketch, and remove the expired ones."""
+    # Flow -> time of its block, oldest first
+    blocked = {}
+
+    controller.table_clear('heavy_flows')
+    controller.digest_enable('heavy_flow_t', max_timeout_ns=DIGEST_TIMEOUT_NS,
+                             max_list_size=DIGEST_LIST_SIZE, ack_timeout_ns=DIGEST_TIMEOUT_NS)
+
+    while True:
+        # Wake up at least every second to remove the expired entries
+        digest_list = controller.get_digest_list(timeout=1)
+
+        now = time.monotonic()
+        while blocked and now - next(iter(blocked.values())) >= BLOCK_TIMEOUT_S:
+            unblock(switch, controller, blocked, next(iter(blocked)))
+
+        if digest_list is None:
+            continue
+
+        # The same flow can be reported more than once (e.g. in a new epoch
+        # before its entry is installed)
+        flows = {parse_heavy_flow(member) for member in digest_list.data} - blocked.keys()
+        for flow in flows:
+            if len(blocked) >= HEAVY_FLOWS_ENTRIES:
+                unblock(switch, controller, blocked, next(iter(blocked)))
+            try:
+                controller.table_add('heavy_flows', 'drop', list(flow))
+            except Exception as e:
+                print('{}: cannot block {}: {}'.format(switch, flow, e))
+                continue
+            blocked[flow] = now
+            print('{}: blocked heavy flow {}'.format(switch, flow))
+
+topo = load_topo('topology.json')
+controllers = {}
+
+for switch, data in topo.get_p4rtswitches().items():
+    controllers[switch] = SimpleSwitchP4RuntimeAPI(data['device_id'], data['grpc_port'],
+                                                  p4rt_path=data['p4rt_path'],
+                                                  json_path=data['json_path'])
+
+threads = [threading.Thread(target=block_heavy_flows, args=(switch, controller))
+           for switch, controller in controllers.items()]
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
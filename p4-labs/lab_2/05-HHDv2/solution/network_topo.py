@@ -0,0 +1,33 @@
+from p4utils.mininetlib.network_API import NetworkAPI
+
+net = NetworkAPI()
+
+# Network general options
+net.setLogLevel('info')
+net.setCompiler(p4rt=True)
+# control_plane.py configures the switches and exits, then the digest
+# listener runs in the background until the network is stopped (its output
+# is in log/heavy_flows.log)
+net.execScript('sh -c "python control_plane.py && python -u heavy_flows.py > log/heavy_flows.log 2>&1 &"',
+               reboot=True)
+
+# Network definition
+net.addP4RuntimeSwitch('s1')
+net.addP4RuntimeSwitch('s2')
+net.setP4SourceAll('./hdd_v2.p4')
+
+net.addHost('h1')
+net.addHost('h2')
+
+net.addLink("h1", "s1", port2=1)
+net.addLink("s1", "s2", port1=2, port2=2)
+net.addLink("s2", "h2", port1=1)
+
+# Assignment strategy
+net.mixed()
+
+# Nodes general options
+net.enablePcapDumpAll()
+net.enableLogAll()
+net.enableCli()
+net.startNetwork()
\ No newline at end of file
@@ -1,8 +1,24 @@
 #!/usr/bin/env python3
 
+import collections
+import os
+import sys
+
 from p4utils.utils.helper import load_topo
 from p4utils.utils.sswitch_p4runtime_API import SimpleSwitchP4RuntimeAPI
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../tools'))
+from p4rt_bulk import P4UTILS_ELECTION_ID, BulkWriteError, BulkWriter, P4Info  # noqa: E402
+from p4.v1 import p4runtime_pb2  # noqa: E402
+
+# Stateless VIP: the backends are chosen by the action selector, and they
+# listen on another port to tell apart the replies of the two VIPs
+STATELESS_VIP = ('10.0.1.2', '3001')
+STATELESS_BACKEND_PORT = '8001'
+# Buckets of the group of the stateless VIP: a backend gets about
+# NUM_BUCKETS / len(backends) of them
+NUM_BUCKETS = 64
+
 
 topo = load_topo('topology.json')
 controllers = {}
@@ -27,4 +43,120 @@ controller.table_add("virtual_ip", "is_virtual_ip",
                      ["10.0.1.2", '3000'], ["1"])
 
 controller.table_add("backend_to_vip", "backend_to_vip_conversion", [
-                     "10.0.0.1/24"], ["10.0.1.2", '3000', "00:0c:29:c0:94:bf"])
+                     "10.0.0.1/24", '8000'], ["10.0.1.2", '3000', "00:0c:29:c0:94:bf"])
+
+
+class ResilientGroup:
+    """Group of NUM_BUCKETS members of backend_selector for a stateless VIP.
+
+    The members of the group never change, so the hash of a connection always
+    selects the same bucket: when the backends change, only the buckets of the
+    removed backends, and the ones given to the new backends, are rewritten
+    (MODIFY of the member), and the other connections keep their backend.
+    """
+
+    def __init__(self, switch, vip, group_id, first_member_id):
+        data = topo.get_p4rtswitches()[switch]
+        self.grpc_addr = 'localhost:{}'.format(data['grpc_port'])
+        self.device_id = data['device_id']
+        self.p4info = P4Info(data['p4rt_path'])
+        self.vip = vip
+        self.group_id = group_id
+        self.member_ids = [first_member_id + i for i in range(NUM_BUCKETS)]
+        self.buckets = [None] * NUM_BUCKETS
+        self.installed = False
+        # A failed install can leave some members, the group or the entry
+        # on the switch
+        self.partial = False
+
+    def assign(self, backends):
+        """New backend of every bucket, moving as few buckets as possible"""
+        if not backends:
+            raise ValueError('{}:{} needs at least one backend'.format(*self.vip))
+        buckets = [b if b in backends else None for b in self.buckets]
+        counts = collections.Counter(b for b in buckets if b is not None)
+
+        # The backends with more buckets keep the extra one of the division
+        base, extra = divmod(NUM_BUCKETS, len(backends))
+        order = sorted(backends, key=lambda b: -counts[b])
+        quota = {b: base + (1 if i < extra else 0) for i, b in enumerate(order)}
+
+        kept = collections.Counter()
+        for i, b in enumerate(buckets):
+            if b is not None:
+                kept[b] += 1
+                if kept[b] > quota[b]:
+                    buckets[i] = None
+
+        for i, b in enumerate(buckets):
+            if b is None:
+                b = next(b for b in order if kept[b] < quota[b])
+                kept[b] += 1
+                buckets[i] = b
+        return buckets
+
+    @staticmethod
+    def _rewrite(writer, entries):
+        """Retry of a failed install: the entities that are already on the
+        switch fail the INSERT, and they are modified instead"""
+        failed = 0
+        for entry in entries:
+            if writer.write([entry]):
+                failed += writer.write([entry], update_type=p4runtime_pb2.Update.MODIFY) > 0
+        return failed
+
+    def update(self, backends):
+        """backends: list of (port, ip, tcp port, mac), the parameters of
+        set_backend. Raises ValueError if the list is empty and
+        BulkWriteError if some of the updates fail: update() can be called
+        again to retry."""
+        buckets = self.assign(backends)
+        profile = self.p4info.action_profile('backend_selector')
+        action = self.p4info.action('set_backend')
+
+        moved = [i for i, b in enumerate(buckets) if b != self.buckets[i]]
+        changed = [self.p4info.member(profile, self.member_ids[i], action, list(buckets[i]))
+                   for i in moved]
+
+        writer = BulkWriter(self.grpc_addr, self.device_id, P4UTILS_ELECTION_ID, arbitrate=False)
+        try:
+            if not self.installed:
+                group = self.p4info.group(profile, self.group_id, self.member_ids, NUM_BUCKETS)
+                table = self.p4info.table('vip_to_backend_selector')
+                entry = self.p4info.group_table_entry(table, list(self.vip), self.group_id)
+                # The group needs all its members, and the table entry the group
+                for entries in (changed, [group], [entry]):
+                    if self.partial:
+                        failed = self._rewrite(writer, entries)
+                    else:
+                        failed = writer.write(entries)
+                    if failed:
+                        self.partial = True
+                        raise BulkWriteError('{} of {} updates failed while installing the '
+                                             'group of {}:{}'.format(failed, len(entries),
+                                                                     *self.vip))
+                self.installed = True
+            else:
+                failed = writer.write(changed, update_type=p4runtime_pb2.Update.MODIFY)
+                if failed:
+                    # Which members were modified is unknown: the next
+                    # update() writes all the moved buckets again
+                    for i in moved:
+                        self.buckets[i] = None
+                    raise BulkWriteError('{} of {} buckets of {}:{} not moved'.format(
+                        failed, len(changed), *self.vip))
+        finally:
+            writer.close()
+
+        print('{} buckets of {}:{} moved'.format(len(changed), *self.vip))
+        self.buckets = buckets
+
+controller.table_add("virtual_ip", "is_stateless_virtual_ip", list(STATELESS_VIP))
+controller.table_add("backend_to_vip", "backend_to_vip_conversion", [
+                     "10.0.0.1/24", STATELESS_BACKEND_PORT],
+                     [STATELESS_VIP[0], STATELESS_VIP[1], "00:0c:29:c0:94:bf"])
+
+stateless_group = ResilientGroup('s1', STATELESS_VIP, group_id=1, first_member_id=1)
+# Call update() again with the new list when a backend is added or removed
+stateless_group.update([(str(port), '10.0.0.{}'.format(port), STATELESS_BACKEND_PORT,
+                         '00:00:0a:00:00:{:02x}'.format(port)) for port in range(2, 6)])
@@ -0,0 +1,440 @@
+#!/usr/bin/env python3
+#
+# Bulk loader of P4Runtime table entries: instead of one Write RPC per entry,
+# as with table_add of SimpleSwitchP4RuntimeAPI, the entries are packed in
+# WriteRequests of --batch updates each, and up to --inflight requests are
+# sent without waiting for the previous ones to complete.
+#
+# The entries are read from a YAML file with the same format of the
+# config.yaml of the eBPF labs: a list of items (e.g., ips) whose fields
+# become the match keys and the action parameters of a table, e.g.,
+#
+#   p4rt_bulk.py --topo topology.json --switch s1 -c config.yaml --list ips \
+#       --table ipv4_lpm --action ipv4_forward --match ip --params mac,port
+#
+# The loader connects as an additional P4Runtime client with a higher
+# election id, so it becomes the primary client while it writes: when it
+# disconnects, the controller of control_plane.py is the primary again.
+# While the loader is primary, the switch sends it the stream messages
+# (digests, packet-ins) and the controller loses them. With --reuse-primary
+# the loader does not arbitrate and writes with the election id of the
+# controller (--election-id, 1 for p4utils), which stays primary.
+
+import argparse
+import collections
+import ipaddress
+import queue
+import sys
+import time
+
+import grpc
+import yaml
+from google.protobuf import text_format
+from google.rpc import code_pb2, status_pb2
+from p4.config.v1 import p4info_pb2
+from p4.v1 import p4runtime_pb2, p4runtime_pb2_grpc
+
+# Above the election ids of the other clients (p4utils uses low ones)
+ELECTION_ID = (1 << 32, 0)
+# Election id of the clients of SimpleSwitchP4RuntimeAPI
+P4UTILS_ELECTION_ID = (1, 0)
+
+MATCH_EXACT = p4info_pb2.MatchField.EXACT
+MATCH_LPM = p4info_pb2.MatchField.LPM
+MATCH_TERNARY = p4info_pb2.MatchField.TERNARY
+
+# Field of the Entity message of every kind of entry that can be written
+ENTITIES = {
+    'TableEntry': 'table_entry',
+    'ActionProfileMember': 'action_profile_member',
+    'ActionProfileGroup': 'action_profile_group',
+    'MeterEntry': 'meter_entry',
+}
+
+
+class BulkWriteError(Exception):
+    pass
+
+
+def to_int(value):
+    """Integers, IPv4 addresses and MAC addresses (as in control_plane.py)"""
+    if isinstance(value, int):
+        return value
+    value = str(value)
+    if value.count(':') == 5:
+        return int(value.replace(':', ''), 16)
+    try:
+        return int(ipaddress.IPv4Address(value))
+    except ValueError:
+        return int(value, 16) if value.lower().startswith('0x') else int(value)
+
+
+def encode(value, bitwidth):
+    """Canonical P4Runtime bytestring: big endian, without leading zeros"""
+    n = to_int(value)
+    if n < 0 or n >= 1 << bitwidth:
+        raise ValueError('{} does not fit in {} bits'.format(value, bitwidth))
+    return n.to_bytes(max(1, (n.bit_length() + 7) // 8), 'big')
+
+
+class P4Info:
+    """Name lookup in the P4Info (text format) written by p4c, e.g.,
+    the p4rt_path of the switches in topology.json"""
+
+    def __init__(self, path):
+        self.p4info = p4info_pb2.P4Info()
+        with open(path) as f:
+            text_format.Merge(f.read(), self.p4info)
+
+    @staticmethod
+    def _find(objs, name, kind):
+        for obj in objs:
+            if name in (obj.preamble.name, obj.preamble.alias):
+                return obj
+        raise KeyError('no {} named {}'.format(kind, name))
+
+    def table(self, name):
+        return self._find(self.p4info.tables, name, 'table')
+
+    def action(self, name):
+        return self._find(self.p4info.actions, name, 'action')
+
+    def action_profile(self, name):
+        return self._find(self.p4info.action_profiles, name, 'action profile')
+
+    def meter(self, name):
+        return self._find(self.p4info.meters, name, 'meter')
+
+    @staticmethod
+    def _match(entry, table, match):
+        if len(match) != len(table.match_fields):
+            raise ValueError('{} has {} match fields, got {}'.format(
+                table.preamble.name, len(table.match_fields), len(match)))
+
+        for field, value in zip(table.match_fields, match):
+            m = entry.match.add(field_id=field.id)
+            if field.match_type == MATCH_EXACT:
+                m.exact.value = encode(value, field.bitwidth)
+            elif field.match_type == MATCH_LPM:
+                addr, _, plen = str(value).partition('/')
+                plen = int(plen) if plen else field.bitwidth
+                mask = ((1 << plen) - 1) << (field.bitwidth - plen)
+                m.lpm.value = encode(to_int(addr) & mask, field.bitwidth)
+                m.lpm.prefix_len = plen
+            elif field.match_type == MATCH_TERNARY:
+                val, _, mask = str(value).partition('&&&')
+                mask = to_int(mask) if mask else (1 << field.bitwidth) - 1
+                m.ternary.value = encode(to_int(val) & mask, field.bitwidth)
+                m.ternary.mask = encode(mask, field.bitwidth)
+            else:
+                raise ValueError('unsupported match type of {}'.format(field.name))
+
+    @staticmethod
+    def _priority(table, priority):
+        """Entries of tables with ternary fields need a priority > 0, the
+        other ones 0: by default use the lowest valid one"""
+        if priority is not None:
+            return priority
+        return int(any(f.match_type == MATCH_TERNARY for f in table.match_fields))
+
+    @staticmethod
+    def _action(msg, action, params):
+        if len(params) != len(action.params):
+            raise ValueError('{} has {} parameters, got {}'.format(
+                action.preamble.name, len(action.params), len(params)))
+
+        msg.action_id = action.preamble.id
+        for param, value in zip(action.params, params):
+            msg.params.add(param_id=param.id, value=encode(value, param.bitwidth))
+
+    def table_entry(self, table, action, match, params, priority=None):
+        """table and action are P4Info objects, match and params are lists of
+        values in the order of the key and of the action parameters, as in
+        table_add. LPM values without a prefix length are full length ones,
+        ternary values are written as value&&&mask. The selector fields of
+        tables with an action selector are not part of match."""
+        entry = p4runtime_pb2.TableEntry(table_id=table.preamble.id,
+                                         priority=self._priority(table, priority))
+        self._match(entry, table, match)
+        self._action(entry.action.action, action, params)
+        return entry
+
+    def group_table_entry(self, table, match, group_id, priority=None):
+        """Entry of a table with an action selector, pointing to a group"""
+        entry = p4runtime_pb2.TableEntry(table_id=table.preamble.id,
+                                         priority=self._priority(table, priority))
+        self._match(entry, table, match)
+        entry.action.action_profile_group_id = group_id
+        return entry
+
+    def member(self, profile, member_id, action, params):
+        member = p4runtime_pb2.ActionProfileMember(action_profile_id=profile.preamble.id,
+                                                   member_id=member_id)
+        self._action(member.action, action, params)
+        return member
+
+    def group(self, profile, group_id, member_ids, max_size=0):
+        group = p4runtime_pb2.ActionProfileGroup(action_profile_id=profile.preamble.id,
+                                                 group_id=group_id, max_size=max_size)
+        for member_id in member_ids:
+            group.members.add(member_id=member_id, weight=1)
+        return group
+
+    def meter_entry(self, meter, index, cir, cburst, pir, pburst):
+        """Rates of a cell of an indexed meter, in units (packets or bytes)
+        per second, and bursts in units. Meter cells always exist, so they
+        are written with MODIFY updates."""
+        entry = p4runtime_pb2.MeterEntry(meter_id=meter.preamble.id)
+        entry.index.index = index
+        entry.config.cir = cir
+        entry.config.cburst = cburst
+        entry.config.pir = pir
+        entry.config.pburst = pburst
+        return entry
+
+
+class BulkWriter:
+    """With arbitrate, the writer opens a stream and becomes the primary
+    client (election_id must be the highest one): the stream messages of the
+    switch go to the writer and are dropped until it is closed. Otherwise the
+    writes use the election_id of the current primary client (e.g.,
+    P4UTILS_ELECTION_ID for the controller of control_plane.py), which keeps
+    receiving them."""
+
+    def __init__(self, grpc_addr, device_id, election_id=ELECTION_ID, arbitrate=True):
+        self.device_id = device_id
+        self.election_id = election_id
+        self.channel = grpc.insecure_channel(grpc_addr)
+        self.stub = p4runtime_pb2_grpc.P4RuntimeStub(self.channel)
+        self.requests = None
+        if not arbitrate:
+            return
+
+        # The stream must stay open for the whole session
+        self.requests = queue.Queue()
+        self.stream = self.stub.StreamChannel(iter(self.requests.get, None))
+
+        req = p4runtime_pb2.StreamMessageRequest()
+        req.arbitration.device_id = device_id
+        req.arbitration.election_id.high, req.arbitration.election_id.low = election_id
+        self.requests.put(req)
+
+        for resp in self.stream:
+            if resp.HasField('arbitration'):
+                if resp.arbitration.status.code != code_pb2.OK:
+                    self.close()
+                    raise BulkWriteError('not the primary client of device {}: {}'.format(
+                        device_id, resp.arbitration.status.message))
+                break
+
+    def close(self):
+        if self.requests is not None:
+            self.requests.put(None)
+        self.channel.close()
+
+    def push_pipeline(self, p4info, json_path):
+        """Install the program, as p4utils does when it starts the controller"""
+        req = p4runtime_pb2.SetForwardingPipelineConfigRequest(
+            device_id=self.device_id,
+            action=p4runtime_pb2.SetForwardingPipelineConfigRequest.VERIFY_AND_COMMIT)
+        req.election_id.high, req.election_id.low = self.election_id
+        req.config.p4info.CopyFrom(p4info.p4info)
+        with open(json_path, 'rb') as f:
+            req.config.p4_device_config = f.read()
+        self.stub.SetForwardingPipelineConfig(req)
+
+    def _request(self, entries, update_type):
+        req = p4runtime_pb2.WriteRequest(device_id=self.device_id)
+        req.election_id.high, req.election_id.low = self.election_id
+        for entry in entries:
+            update = req.updates.add(type=update_type)
+            getattr(update.entity, ENTITIES[entry.DESCRIPTOR.name]).CopyFrom(entry)
+        return req
+
+    @staticmethod
+    def _errors(rpc_error, entries):
+        """The status of every update of a failed WriteRequest is in the
+        details of the gRPC status: without them, every update failed"""
+        errors = []
+        for key, value in rpc_error.trailing_metadata() or ():
+            if key != 'grpc-status-details-bin':
+                continue
+            status = status_pb2.Status()
+            status.ParseFromString(value)
+            for i, detail in enumerate(status.details):
+                err = p4runtime_pb2.Error()
+                if detail.Unpack(err) and err.canonical_code != code_pb2.OK:
+                    errors.append('{}: {}'.format(text_format.MessageToString(
+                        entries[i], as_one_line=True), err.message))
+        return errors or ['{}'.format(rpc_error.details())] * len(entries)
+
+    def write(self, entries, batch=1000, inflight=4, update_type=p4runtime_pb2.Update.INSERT):
+        """Write the entries (TableEntry, ActionProfileMember,
+        ActionProfileGroup or MeterEntry messages), returns the number of
+        failed updates after printing them"""
+        pending = collections.deque()
+        failed = 0
+
+        def complete():
+            nonlocal failed
+            future, chunk = pending.popleft()
+            try:
+                future.result()
+            except grpc.RpcError as e:
+                errors = self._errors(e, chunk)
+                for err in errors[:10]:
+                    print('Write error: {}'.format(err), file=sys.stderr)
+                failed += len(errors)
+
+        for i in range(0, len(entries), batch):
+            chunk = entries[i:i + batch]
+            pending.append((self.stub.Write.future(self._request(chunk, update_type)), chunk))
+            if len(pending) >= inflight:
+                complete()
+        while pending:
+            complete()
+        return failed
+
+
+def load_entries(p4info, args):
+    # All the values as strings: YAML 1.1 would read a MAC address with only
+    # decimal digits (e.g., 00:00:00:02:01:00) as a base 60 integer
+    with open(args.config) as f:
+        config = yaml.load(f, Loader=yaml.BaseLoader)
+
+    items = config.get(args.list) or []
+    match_fields = args.match.split(',')
+    param_fields = args.params.split(',') if args.params else []
+    table = p4info.table(args.table)
+    action = p4info.action(args.action)
+
+    return [p4info.table_entry(table, action, [item[k] for k in match_fields],
+                               [item[k] for k in param_fields], args.priority)
+            for item in items]
+
+
+def bench_entries(p4info, args, template, count):
+    """count entries with the first match field set to 10.0.0.0 + i (full
+    length if LPM) and the other values of the template entry"""
+    field = p4info.table(args.table).match_fields[0]
+    entries = []
+    for i in range(count):
+        entry = p4runtime_pb2.TableEntry()
+        entry.CopyFrom(template)
+        m = entry.match[0]
+        value = encode(int(ipaddress.IPv4Address('10.0.0.0')) + i, field.bitwidth)
+        if field.match_type == MATCH_LPM:
+            m.lpm.value = value
+            m.lpm.prefix_len = field.bitwidth
+        elif field.match_type == MATCH_EXACT:
+            m.exact.value = value
+        else:
+            m.ternary.value = value
+            m.ternary.mask = encode((1 << field.bitwidth) - 1, field.bitwidth)
+        entries.append(entry)
+    return entries
+
+
+def timed_write(writer, entries, batch, inflight, update_type=p4runtime_pb2.Update.INSERT):
+    start = time.monotonic()
+    failed = writer.write(entries, batch, inflight, update_type)
+    elapsed = time.monotonic() - start
+    return elapsed, failed
+
+
+def bench(writer, p4info, args, template):
+    """Time the insertion of --bench entries with one update per request (as
+    table_add) and with the bulk writer, then delete them"""
+    entries = bench_entries(p4info, args, template, args.bench)
+    single = entries[:min(args.bench_single, len(entries))]
+
+    elapsed, failed = timed_write(writer, single, 1, 1)
+    single_rate = len(single) / elapsed
+    print('One per request: {} entries in {:.2f} s ({:.0f} entries/s, {} failed)'.format(
+        len(single), elapsed, single_rate, failed))
+    writer.write(single, args.batch, args.inflight, p4runtime_pb2.Update.DELETE)
+
+    elapsed, failed = timed_write(writer, entries, args.batch, args.inflight)
+    bulk_rate = len(entries) / elapsed
+    print('Bulk ({} per request, {} in flight): {} entries in {:.2f} s ({:.0f} entries/s, '
+          '{} failed)'.format(args.batch, args.inflight, len(entries), elapsed, bulk_rate, failed))
+    print('Speedup: {:.1f}x ({} entries one per request would take {:.1f} s)'.format(
+        bulk_rate / single_rate, len(entries), len(entries) / single_rate))
+    writer.write(entries, args.batch, args.inflight, p4runtime_pb2.Update.DELETE)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Load table entries from a YAML file with '
+                                     'batched P4Runtime writes')
+    parser.add_argument('--topo', help='topology.json of p4utils, to get the address, the device '
+                        'id and the P4Info of --switch')
+    parser.add_argument('--switch', help='Switch of --topo (e.g., s1)')
+    parser.add_argument('--grpc-addr', default='localhost:9559',
+                        help='Address of the P4Runtime server (without --topo)')
+    parser.add_argument('--device-id', type=int, default=0, help='Device id (without --topo)')
+    parser.add_argument('--p4info', help='P4Info file (without --topo)')
+    parser.add_argument('--json', help='Push the pipeline (bmv2 JSON and P4Info) before writing')
+    parser.add_argument('-c', '--config', required=True, help='YAML file with the entries')
+    parser.add_argument('--list', default='ips', help='List of the YAML file with the entries')
+    parser.add_argument('--table', required=True, help='Table name')
+    parser.add_argument('--action', required=True, help='Action name')
+    parser.add_argument('--match', required=True,
+                        help='Comma separated fields of the items used as match keys')
+    parser.add_argument('--params', default='',
+                        help='Comma separated fields of the items used as action parameters')
+    parser.add_argument('--priority', type=int,
+                        help='Priority (ternary tables, default 1; must be 0 for the other tables)')
+    parser.add_argument('--election-id', type=int, default=ELECTION_ID[0],
+                        help='High word of the election id (the low one is 0)')
+    parser.add_argument('--reuse-primary', action='store_true',
+                        help='Do not become the primary client: write with --election-id, the '
+                        'one of the primary client (1 for p4utils), which keeps its digests')
+    parser.add_argument('-b', '--batch', type=int, default=1000, help='Updates per WriteRequest')
+    parser.add_argument('--inflight', type=int, default=4,
+                        help='WriteRequests sent without waiting for the previous ones')
+    parser.add_argument('--bench', type=int, default=0,
+                        help='Instead of loading the file, time the insertion of this many '
+                        'entries like the first one of the file')
+    parser.add_argument('--bench-single', type=int, default=1000,
+                        help='Entries written one per request in the benchmark')
+    args = parser.parse_args()
+
+    if args.topo:
+        from p4utils.utils.helper import load_topo
+        switches = load_topo(args.topo).get_p4rtswitches()
+        if args.switch not in switches:
+            parser.error('--switch must be one of {}'.format(', '.join(switches)))
+        data = switches[args.switch]
+        args.grpc_addr = 'localhost:{}'.format(data['grpc_port'])
+        args.device_id = data['device_id']
+        args.p4info = data['p4rt_path']
+    elif not args.p4info:
+        parser.error('--p4info is required without --topo')
+
+    p4info = P4Info(args.p4info)
+    start = time.monotonic()
+    entries = load_entries(p4info, args)
+    print('{} entries built in {:.2f} s'.format(len(entries), time.monotonic() - start))
+
+    writer = BulkWriter(args.grpc_addr, args.device_id, (args.election_id, 0),
+                        arbitrate=not args.reuse_primary)
+    try:
+        if args.json:
+            writer.push_pipeline(p4info, args.json)
+
+        if args.bench:
+            if not entries:
+                print('The benchmark needs at least one entry as template', file=sys.stderr)
+                return 1
+            bench(writer, p4info, args, entries[0])
+            return 0
+
+        elapsed, failed = timed_write(writer, entries, args.batch, args.inflight)
+        print('{} entries written in {:.2f} s ({} failed)'.format(len(entries), elapsed, failed))
+        return 1 if failed else 0
+    finally:
+        writer.close()
+
+
+if __name__ == '__main__':
+    sys.exit(main())